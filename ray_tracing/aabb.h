@@ -19,6 +19,18 @@ namespace ray_tracing
 
 		bool hit(const ray& r, double tmin, double tmax) const;
 
+		bool contains(const vec3& p) const
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				if (p.e[i] < m_min.e[i] || p.e[i] > m_max.e[i])
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
 	};
 
 	aabb surrounding_box(aabb box0, aabb box1);
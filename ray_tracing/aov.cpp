@@ -0,0 +1,55 @@
+#include "aov.h"
+
+#include<algorithm>
+#include<cstring>
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const aov_info channel_info[aov_channel_count] =
+		{
+			{ "depth", "" },
+			{ "normal", "XYZ" },
+			{ "albedo", "RGB" },
+			{ "material_id", "" },
+			{ "motion", "XY" },
+			{ "sample_count", "" },
+		};
+	}
+
+	const aov_info& get_aov_info(aov_channel c)
+	{
+		return channel_info[c];
+	}
+
+	int aov_components(aov_channel c)
+	{
+		return std::max(1, static_cast<int>(strlen(channel_info[c].components)));
+	}
+
+	void aov_buffers::allocate(unsigned channel_mask, int w, int h)
+	{
+		enabled = channel_mask;
+		width = w;
+		height = h;
+		for (int c = 0; c < aov_channel_count; ++c)
+		{
+			auto channel = static_cast<aov_channel>(c);
+			if (has(channel) == true)
+			{
+				channels[c].assign(w * h * aov_components(channel), 0.0f);
+			}
+			else
+			{
+				channels[c].clear();
+			}
+		}
+	}
+
+	vec3 aov_buffers::get3(aov_channel c, int pixel) const
+	{
+		const float* v = at(c, pixel);
+		return vec3(v[0], v[1], v[2]);
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include<cstdint>
+#include"constantAndTool.h"
+
+namespace ray_tracing
+{
+	//arbitrary output variables: per pixel data kept next to the radiance
+	enum aov_channel
+	{
+		aov_depth,			//distance to the first hit, 0 for the background
+		aov_normal,			//shading normal of the first hit, zero for the background and media
+		aov_albedo,			//material color of the first hit, 1 for the background
+		aov_material_id,	//material of the pixel's first sample, -1 for the background
+		aov_motion,			//pixels the first hit moves over the shutter, x right and y down
+		aov_sample_count,	//camera samples taken
+		aov_channel_count
+	};
+
+	struct aov_info
+	{
+		const char* name;
+		const char* components;		//suffix letter of each component, "" for single valued channels
+	};
+
+	const aov_info& get_aov_info(aov_channel c);
+	int aov_components(aov_channel c);
+
+	inline unsigned aov_bit(aov_channel c)
+	{
+		return 1u << c;
+	}
+
+	const unsigned all_aovs = (1u << aov_channel_count) - 1;
+	//the channels filled from what the camera ray hits, see aov_sample
+	const unsigned first_hit_aovs = all_aovs & ~aov_bit(aov_sample_count);
+
+	//what one camera ray saw first
+	struct aov_sample
+	{
+		vec3 albedo;
+		vec3 normal;
+		double depth;
+		int material;
+		vec3 position;
+		vec3 velocity;		//world space motion of position per unit of time
+	};
+
+	//float channels over a width x height block of pixels, components interleaved;
+	//disabled channels stay empty
+	struct aov_buffers
+	{
+		unsigned enabled = 0;
+		int width = 0;
+		int height = 0;
+		vector<float> channels[aov_channel_count];
+
+		void allocate(unsigned channel_mask, int w, int h);
+		bool has(aov_channel c) const { return (enabled & aov_bit(c)) != 0; }
+
+		float* at(aov_channel c, int pixel) { return &channels[c][pixel * aov_components(c)]; }
+		const float* at(aov_channel c, int pixel) const { return &channels[c][pixel * aov_components(c)]; }
+		vec3 get3(aov_channel c, int pixel) const;
+	};
+}
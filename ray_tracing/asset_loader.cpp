@@ -0,0 +1,79 @@
+#include"asset_loader.h"
+
+#include<algorithm>
+#ifdef _WIN32
+#include<windows.h>
+#else
+#include<sys/resource.h>
+#endif
+
+namespace ray_tracing
+{
+	asset_loader& asset_loader::global()
+	{
+		static asset_loader loader(static_cast<int>(std::thread::hardware_concurrency()));
+		return loader;
+	}
+
+	asset_loader::asset_loader(int threads)
+	{
+		for (int i = 0; i < std::max(1, threads); ++i)
+		{
+			workers.emplace_back(&asset_loader::work, this);
+		}
+	}
+
+	asset_loader::~asset_loader()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	size_t asset_loader::pending()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return unfinished;
+	}
+
+	void asset_loader::wait_idle()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		idle.wait(guard, [this]() { return unfinished == 0; });
+	}
+
+	void asset_loader::work()
+	{
+		//decoding yields to tracing, and gets the core back whenever a tracer waits on what it decodes
+#ifdef _WIN32
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#else
+		setpriority(PRIO_PROCESS, 0, 19);
+#endif
+		std::unique_lock<std::mutex> guard(lock);
+		while (true)
+		{
+			wake.wait(guard, [this]() { return queue.empty() == false || stopping == true; });
+			//what was queued still runs when stopping
+			if (queue.empty() == true)
+			{
+				return;
+			}
+			auto task = std::move(queue.front());
+			queue.pop_front();
+			guard.unlock();
+			task();
+			guard.lock();
+			if (--unfinished == 0)
+			{
+				idle.notify_all();
+			}
+		}
+	}
+}
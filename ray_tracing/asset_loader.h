@@ -0,0 +1,63 @@
+#pragma once
+
+#include<condition_variable>
+#include<deque>
+#include<functional>
+#include<future>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include"constantAndTool.h"
+
+namespace ray_tracing
+{
+	/*
+	A pool of threads that decode assets while the scene is built and compiled. Builders get a
+	shared_future for every asset they ask for and hand it to whatever uses the asset, which
+	waits on it only when the asset is first needed, so tracing can start before every texture
+	is in. Its threads run at the lowest priority, so even on one core decoding only takes what
+	tracing leaves over and the first pixels do not wait for it. The pool finishes what was
+	queued before its threads are joined.
+	*/
+	class asset_loader
+	{
+	public:
+		//the pool scene builders queue on, one thread per hardware thread
+		static asset_loader& global();
+
+		explicit asset_loader(int threads);
+		~asset_loader();
+		asset_loader(const asset_loader&) = delete;
+		asset_loader& operator=(const asset_loader&) = delete;
+
+		template<typename T>
+		std::shared_future<T> submit(std::function<T()> load)
+		{
+			auto task = std::make_shared<std::packaged_task<T()>>(std::move(load));
+			std::shared_future<T> result = task->get_future().share();
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				queue.push_back([task]() { (*task)(); });
+				++unfinished;
+			}
+			wake.notify_one();
+			return result;
+		}
+
+		//assets queued or being decoded
+		size_t pending();
+		//blocks until nothing is pending
+		void wait_idle();
+
+	private:
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable idle;
+		std::deque<std::function<void()>> queue;
+		size_t unfinished = 0;
+		bool stopping = false;
+		vector<std::thread> workers;
+
+		void work();
+	};
+}
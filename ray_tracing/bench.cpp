@@ -0,0 +1,1388 @@
+#include"bench.h"
+#include"scenes.h"
+#include"material.h"
+#include"texture.h"
+#include"compiled_scene.h"
+#include"integrator.h"
+#include"renderer.h"
+#include"denoiser.h"
+#include"asset_loader.h"
+#include"fast_math.h"
+#include<atomic>
+#include<chrono>
+#include<cstdio>
+#include<cstring>
+#include<fstream>
+#include<mutex>
+#ifdef __GLIBC__
+#include<malloc.h>
+#endif
+
+namespace ray_tracing
+{
+	//camera and background used for each built-in scene when benchmarking
+	struct scene_setup
+	{
+		const char* name;
+		hittable_list(*build)();
+		vec3 lookfrom;
+		vec3 lookat;
+		double vfov;
+		vec3 background;
+	};
+
+	static const scene_setup builtin_scenes[] =
+	{
+		{ "random_scene", random_scene, vec3(13, 2, 3), vec3(0, 0, 0), 20, vec3(0.7, 0.8, 1.0) },
+		{ "two_spheres", two_spheres, vec3(13, 2, 3), vec3(0, 0, 0), 20, vec3(0.7, 0.8, 1.0) },
+		{ "two_perlin_spheres", two_perlin_spheres, vec3(13, 2, 3), vec3(0, 0, 0), 20, vec3(0.7, 0.8, 1.0) },
+		{ "texture_mapping", texture_mapping, vec3(13, 2, 3), vec3(0, 0, 0), 20, vec3(0.7, 0.8, 1.0) },
+		{ "simple_light", simple_light, vec3(26, 3, 6), vec3(0, 2, 0), 20, vec3(0, 0, 0) },
+		{ "cornell_box", cornell_box, vec3(278, 278, -800), vec3(278, 278, 0), 40, vec3(0, 0, 0) },
+		{ "final_scene", final_scene, vec3(278, 450, -800), vec3(278, 490, 0), 40, vec3(0, 0, 0) },
+		{ "many_lights", many_lights, vec3(0, 12, 30), vec3(0, 0, -5), 40, vec3(0, 0, 0) },
+		{ "cloud", cloud, vec3(0, 3, 24), vec3(0, 8, 0), 40, vec3(0.5, 0.6, 0.8) }
+	};
+
+	//the setups of the named built-in scenes, in the order of the table
+	static vector<const scene_setup*> scenes_named(std::initializer_list<const char*> names)
+	{
+		vector<const scene_setup*> found;
+		for (const auto& setup : builtin_scenes)
+		{
+			for (auto name : names)
+			{
+				if (strcmp(setup.name, name) == 0)
+				{
+					found.push_back(&setup);
+				}
+			}
+		}
+		return found;
+	}
+
+	static double rmse(const vector<vec3>& image, const vector<vec3>& reference)
+	{
+		double sum = 0;
+		for (size_t i = 0; i < image.size(); ++i)
+		{
+			sum += (image[i] - reference[i]).length_squared() / 3;
+		}
+		return sqrt(sum / image.size());
+	}
+
+	//the image's mean over the reference's, less one: what a biased estimator adds or loses overall
+	static double mean_bias(const vector<vec3>& image, const vector<vec3>& reference)
+	{
+		double sum = 0, reference_sum = 0;
+		for (size_t i = 0; i < image.size(); ++i)
+		{
+			sum += image[i].x() + image[i].y() + image[i].z();
+			reference_sum += reference[i].x() + reference[i].y() + reference[i].z();
+		}
+		return reference_sum > 0 ? sum / reference_sum - 1 : 0;
+	}
+
+	//the scene built from the same random numbers in every benchmark
+	static hittable_list seeded_build(const scene_setup& setup)
+	{
+		seed_random(7);
+		return setup.build();
+	}
+
+	//a built-in scene compiled, the camera on it at width x height, the settings of the renders
+	//measured and a long render they are measured against
+	struct bench_fixture
+	{
+		const scene_setup& setup;
+		compiled_scene world;
+		render_settings settings;
+		camera cam;
+		framebuffer reference;
+
+		bench_fixture(const scene_setup& setup, int width, int height)
+			: setup(setup), world(seeded_build(setup), 0.0, 1.0),
+			cam(setup.lookfrom, setup.lookat, vec3(0, 1, 0), setup.vfov, double(width) / height, 0.0, 10.0, 0.0, 1.0)
+		{
+			settings.width = width;
+			settings.height = height;
+		}
+
+		//the reference at samples per pixel; the renders after it take other random numbers
+		void render_reference(int samples)
+		{
+			settings.samples_per_pixel = samples;
+			render(world, cam, setup.background, settings, reference);
+			settings.seed = 2;
+		}
+
+		double error(const framebuffer& image) const
+		{
+			return rmse(image.pixels, reference.pixels);
+		}
+
+		double bias(const framebuffer& image) const
+		{
+			return mean_bias(image.pixels, reference.pixels);
+		}
+	};
+
+	//fraction of the hemisphere above rec that is open within radius
+	static double ambient_occlusion(const compiled_scene& world, const hit_record& rec, double time, int samples, double radius)
+	{
+		int open = 0;
+		for (int s = 0; s < samples; ++s)
+		{
+			ray probe(rec.p, rec.normal + random_unit_vector(), time);
+			if (world.occluded(probe, 0.001, radius / probe.get_direction().length()) == false)
+			{
+				++open;
+			}
+		}
+		return double(open) / samples;
+	}
+
+	//material sampling alone, which both representations can run; the authoring objects must have
+	//been lowered into the scene whose registry is given
+	template<class world_type>
+	static vec3 plain_color(const ray& r, const vec3& background, const world_type& world, const material_registry& registry, int depth)
+	{
+		hit_record rec;
+		if (depth <= 0)
+		{
+			return vec3(0, 0, 0);
+		}
+		if (world.hit(r, 0.001, infinity, rec) == false)
+		{
+			return background;
+		}
+		if (rec.mat_id == no_material)
+		{
+			cerr << "An object was hit that no scene has lowered." << endl;
+			return vec3(0, 0, 0);
+		}
+
+		const material& mat = registry.get_material(rec.mat_id);
+		vec3 emitted = mat.emitted(rec.u, rec.v, rec.p);
+		scatter_record srec;
+		if (mat.sample(r, rec, srec) == false)
+		{
+			return emitted;
+		}
+		return emitted + srec.attenuation * plain_color(srec.scattered, background, world, registry, depth - 1);
+	}
+
+	//seconds to path trace a small image of the scene, color giving each sample's radiance
+	template<class color_function>
+	static double time_render(const scene_setup& setup, int width, int height, int samples_per_pixel, color_function color)
+	{
+		camera cam(setup.lookfrom, setup.lookat, vec3(0, 1, 0), setup.vfov, double(width) / height, 0.0, 10.0, 0.0, 1.0);
+
+		seed_random(1);
+		auto start = std::chrono::steady_clock::now();
+		vec3 sum(0, 0, 0);
+		for (int h = height - 1; h >= 0; --h)
+		{
+			for (int w = 0; w < width; ++w)
+			{
+				for (int s = 0; s < samples_per_pixel; ++s)
+				{
+					auto u = ((double)w + random_double()) / width;
+					auto v = ((double)h + random_double()) / height;
+					sum += color(cam.get_ray(u, v));
+				}
+			}
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+
+	//through the given world with the full integrator
+	static double time_render(const compiled_scene& world, const scene_setup& setup, int width, int height, int samples_per_pixel)
+	{
+		const int max_depth = 50;
+		return time_render(setup, width, height, samples_per_pixel, [&](const ray& r) { return ray_color(r, setup.background, world, max_depth); });
+	}
+
+	//build time of every built-in scene and its render time through the virtual hittable tree and the compiled scene
+	static void benchmark_scenes()
+	{
+		const int width = 160, height = 90, samples_per_pixel = 4, max_depth = 50;
+		cout << "hit_record: " << sizeof(hit_record) << " bytes" << endl;
+		cout << "scene                 prims  materials  build(s)  virtual(s)  compiled(s)  speedup" << endl;
+		for (const auto& setup : builtin_scenes)
+		{
+			auto world = seeded_build(setup);
+			auto start = std::chrono::steady_clock::now();
+			compiled_scene compiled(world, 0.0, 1.0);
+			std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+
+			const material_registry& registry = compiled.get_registry();
+			auto virtual_time = time_render(setup, width, height, samples_per_pixel,
+				[&](const ray& r) { return plain_color(r, setup.background, world, registry, max_depth); });
+			auto compiled_time = time_render(setup, width, height, samples_per_pixel,
+				[&](const ray& r) { return plain_color(r, setup.background, compiled, registry, max_depth); });
+			printf("%-20s  %6zu  %9zu  %8.3f  %10.3f  %11.3f  %6.2fx\n", setup.name, compiled.primitive_count(), registry.material_count(),
+				build_time.count(), virtual_time, compiled_time, virtual_time / compiled_time);
+		}
+	}
+
+	//closest-hit and any-hit throughput on the same set of hemisphere rays from the first hits
+	static void benchmark_queries()
+	{
+		const int width = 160, height = 90, rays_per_hit = 8;
+		cout << "scene                 closest(Mrays/s)  occluded(Mrays/s)  ao" << endl;
+		for (const auto& setup : builtin_scenes)
+		{
+			bench_fixture f(setup, width, height);
+			const compiled_scene& world = f.world;
+
+			vector<ray> rays;
+			double ao = 0;
+			int hits = 0;
+			for (int h = 0; h < height; ++h)
+			{
+				for (int w = 0; w < width; ++w)
+				{
+					hit_record rec;
+					ray r = f.cam.get_ray((w + 0.5) / width, (h + 0.5) / height);
+					if (world.hit(r, 0.001, infinity, rec) == false)
+					{
+						continue;
+					}
+					for (int s = 0; s < rays_per_hit; ++s)
+					{
+						rays.push_back(ray(rec.p, rec.normal + random_unit_vector(), r.get_time()));
+					}
+					ao += ambient_occlusion(world, rec, r.get_time(), 4, 100);
+					++hits;
+				}
+			}
+
+			hit_query query;
+			int closest_hits = 0, occluded_hits = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (const auto& r : rays)
+			{
+				closest_hits += world.intersect(r, 0.001, infinity, query);
+			}
+			std::chrono::duration<double> closest_time = std::chrono::steady_clock::now() - start;
+
+			start = std::chrono::steady_clock::now();
+			for (const auto& r : rays)
+			{
+				occluded_hits += world.occluded(r, 0.001, infinity);
+			}
+			std::chrono::duration<double> occluded_time = std::chrono::steady_clock::now() - start;
+
+			printf("%-20s  %16.2f  %17.2f  %.3f\n", setup.name, rays.size() / closest_time.count() * 1e-6,
+				rays.size() / occluded_time.count() * 1e-6, hits > 0 ? ao / hits : 0.0);
+		}
+	}
+
+	//adds whole-image passes of one sample per pixel to image until the time budget runs out
+	static int render_for(const bench_fixture& f, double seconds, vector<vec3>& image)
+	{
+		const int max_depth = 50, width = f.settings.width, height = f.settings.height;
+		image.assign(width * height, vec3(0, 0, 0));
+		int passes = 0;
+		auto start = std::chrono::steady_clock::now();
+		do
+		{
+			for (int h = 0; h < height; ++h)
+			{
+				for (int w = 0; w < width; ++w)
+				{
+					auto u = ((double)w + random_double()) / width;
+					auto v = ((double)h + random_double()) / height;
+					image[h * width + w] += ray_color(f.cam.get_ray(u, v), f.setup.background, f.world, max_depth);
+				}
+			}
+			++passes;
+		} while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds);
+
+		for (auto& pixel : image)
+		{
+			pixel /= passes;
+		}
+		return passes;
+	}
+
+	//uniform light selection against the light tree at equal time, measured against a long light tree render
+	static void benchmark_lights()
+	{
+		const int width = 80, height = 45;
+		const double seconds = 2, reference_seconds = 30;
+		cout << "scene                 lights  tree nodes  mode     spp   rmse" << endl;
+		for (const auto& setup : builtin_scenes)
+		{
+			bench_fixture f(setup, width, height);
+			if (f.world.light_count() == 0)
+			{
+				continue;
+			}
+
+			vector<vec3> reference, image;
+			f.world.set_light_selection(select_light_tree);
+			render_for(f, reference_seconds, reference);
+
+			const light_selection modes[] = { select_uniform, select_power, select_light_tree };
+			const char* names[] = { "uniform", "power", "tree" };
+			for (int m = 0; m < 3; ++m)
+			{
+				f.world.set_light_selection(modes[m]);
+				auto passes = render_for(f, seconds, image);
+				printf("%-20s  %6zu  %10zu  %-7s  %4d  %.4f\n", setup.name, f.world.light_count(), f.world.light_tree_node_count(),
+					names[m], passes, rmse(image, reference));
+			}
+		}
+	}
+
+	//low sample count quality of reservoir direct light against the path estimator
+	static void benchmark_restir()
+	{
+		const int reference_samples = 1024;
+		const int sample_counts[] = { 1, 2, 4 };
+		cout << "scene                 mode            spp  time(s)  rmse" << endl;
+		for (const auto& setup : builtin_scenes)
+		{
+			bench_fixture f(setup, 96, 54);
+			if (f.world.light_count() == 0)
+			{
+				continue;
+			}
+			f.render_reference(reference_samples);
+
+			framebuffer image;
+			const char* names[] = { "path", "restir", "restir+spatial" };
+			for (auto spp : sample_counts)
+			{
+				for (int m = 0; m < 3; ++m)
+				{
+					f.settings.samples_per_pixel = spp;
+					f.settings.direct = m == 0 ? direct_path : direct_restir;
+					f.settings.restir.spatial_reuse = m == 2;
+					auto start = std::chrono::steady_clock::now();
+					render(f.world, f.cam, setup.background, f.settings, image);
+					std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+					printf("%-20s  %-14s  %3d  %7.3f  %.4f\n", setup.name, names[m], spp, elapsed.count(), f.error(image));
+				}
+			}
+		}
+	}
+
+	//error of every sampler against a long render as the sample count doubles
+	static void benchmark_samplers()
+	{
+		const int reference_samples = 4096;
+		const int sample_counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+		const sampler_type samplers[] = { sampler_independent, sampler_sobol, sampler_blue_noise };
+		for (auto setup : scenes_named({ "cornell_box", "random_scene" }))
+		{
+			bench_fixture f(*setup, 64, 36);
+			f.settings.sampler = sampler_sobol;
+			f.render_reference(reference_samples);
+
+			framebuffer image;
+			printf("%s\n  spp", setup->name);
+			for (auto type : samplers)
+			{
+				printf("  %11s", sampler_name(type));
+			}
+			printf("\n");
+			for (auto spp : sample_counts)
+			{
+				printf("  %3d", spp);
+				for (auto type : samplers)
+				{
+					f.settings.samples_per_pixel = spp;
+					f.settings.sampler = type;
+					render(f.world, f.cam, setup->background, f.settings, image);
+					printf("  %11.4f", f.error(image));
+				}
+				printf("\n");
+			}
+		}
+	}
+
+	//the cloud tracked through its majorant supergrid against one global majorant: tracking steps taken
+	//by rays crossing the grid, and an equal sample render of each against a long supergrid render
+	static void benchmark_volume()
+	{
+		const int ray_count = 200000, reference_samples = 256, samples = 16;
+		const char* names[] = { "supergrid", "global" };
+		const int cells[] = { density_grid::brick_size, 0 };
+		auto setup = scenes_named({ "cloud" })[0];
+
+		render_settings settings;
+		settings.width = 96;
+		settings.height = 54;
+		camera cam(setup->lookfrom, setup->lookat, vec3(0, 1, 0), setup->vfov, double(settings.width) / settings.height, 0.0, 10.0, 0.0, 1.0);
+		framebuffer reference, image;
+
+		cout << "majorant    build(s)  bricks     memory(MB)  delta steps  ratio steps  tracking(s)  render(s)  rmse" << endl;
+		for (int m = 0; m < 2; ++m)
+		{
+			seed_random(7);
+			auto start = std::chrono::steady_clock::now();
+			auto grid = cloud_grid(cells[m]);
+			std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+			compiled_scene world(cloud_scene(grid), 0.0, 1.0);
+			if (m == 0)
+			{
+				settings.samples_per_pixel = reference_samples;
+				render(world, cam, setup->background, settings, reference);
+			}
+
+			//rays from a sphere around the grid to points inside it
+			seed_random(3);
+			const aabb& box = grid->bounds();
+			auto center = (box.get_min() + box.get_max()) * 0.5;
+			size_t delta_steps = 0, ratio_steps = 0;
+			double t;
+			start = std::chrono::steady_clock::now();
+			for (int i = 0; i < ray_count; ++i)
+			{
+				auto origin = center + unit_vector(random_unit_vector()) * 12;
+				vec3 target(random_double(box.get_min().x(), box.get_max().x()), random_double(box.get_min().y(), box.get_max().y()),
+					random_double(box.get_min().z(), box.get_max().z()));
+				ray r(origin, target - origin, 0);
+				grid->sample_collision(r, 0, infinity, t, &delta_steps);
+				grid->transmittance(r, 0, infinity, &ratio_steps);
+			}
+			std::chrono::duration<double> tracking_time = std::chrono::steady_clock::now() - start;
+
+			settings.samples_per_pixel = samples;
+			settings.seed = 2;
+			start = std::chrono::steady_clock::now();
+			render(world, cam, setup->background, settings, image);
+			std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+
+			printf("%-10s  %8.3f  %4zu/%-4zu  %10.2f  %11.2f  %11.2f  %11.3f  %9.3f  %.4f\n", names[m], build_time.count(), grid->brick_count(),
+				grid->total_bricks(), grid->memory_bytes() / 1048576.0, double(delta_steps) / ray_count, double(ratio_steps) / ray_count,
+				tracking_time.count(), render_time.count(), rmse(image.pixels, reference.pixels));
+		}
+	}
+
+	//64 samples with and without the denoiser against a long render, with the time of every stage
+	static void benchmark_denoise()
+	{
+		const int reference_samples = 4096, samples = 64;
+		for (auto setup : scenes_named({ "cornell_box", "final_scene" }))
+		{
+			bench_fixture f(*setup, 128, 72);
+			f.settings.aovs = denoise_aovs;
+			auto start = std::chrono::steady_clock::now();
+			f.render_reference(reference_samples);
+			std::chrono::duration<double> reference_time = std::chrono::steady_clock::now() - start;
+
+			framebuffer image;
+			f.settings.samples_per_pixel = samples;
+			start = std::chrono::steady_clock::now();
+			render(f.world, f.cam, setup->background, f.settings, image);
+			std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+			auto raw_error = f.error(image);
+
+			denoise_timings timings;
+			denoise(image, denoise_settings(), &timings);
+			double filter_time = timings.demodulate + timings.remodulate;
+			for (auto pass : timings.passes)
+			{
+				filter_time += pass;
+			}
+
+			printf("%s\n", setup->name);
+			printf("  %4d spp          %8.3f s  reference\n", reference_samples, reference_time.count());
+			printf("  %4d spp          %8.3f s  rmse %.4f\n", samples, render_time.count(), raw_error);
+			printf("  %4d spp+denoise  %8.3f s  rmse %.4f\n", samples, render_time.count() + filter_time, f.error(image));
+			printf("    demodulate %.4f s\n", timings.demodulate);
+			for (size_t i = 0; i < timings.passes.size(); ++i)
+			{
+				printf("    pass %zu (step %d) %.4f s\n", i, 1 << i, timings.passes[i]);
+			}
+			printf("    remodulate %.4f s\n", timings.remodulate);
+		}
+	}
+
+	//guided against plain path tracing at the same sample count, training included in its time, and
+	//against plain path tracing given that time
+	static void benchmark_guiding()
+	{
+		const int reference_samples = 4096, samples = 64;
+		for (auto setup : scenes_named({ "cornell_box", "final_scene" }))
+		{
+			bench_fixture f(*setup, 128, 72);
+			f.render_reference(reference_samples);
+
+			framebuffer image;
+			printf("%s\n  mode     spp  train(s)  render(s)  rmse     regions  nodes\n", setup->name);
+			f.settings.samples_per_pixel = samples;
+			auto start = std::chrono::steady_clock::now();
+			render(f.world, f.cam, setup->background, f.settings, image);
+			std::chrono::duration<double> path_time = std::chrono::steady_clock::now() - start;
+			printf("  path     %3d  %8.3f  %9.3f  %.4f\n", samples, 0.0, path_time.count(), f.error(image));
+
+			aabb bounds;
+			f.world.bounding_box(bounds);
+			path_guide guide(bounds, f.settings.guiding);
+			start = std::chrono::steady_clock::now();
+			train_guide(f.world, f.cam, setup->background, f.settings, guide);
+			std::chrono::duration<double> train_time = std::chrono::steady_clock::now() - start;
+			start = std::chrono::steady_clock::now();
+			render(f.world, f.cam, setup->background, f.settings, image, &guide);
+			std::chrono::duration<double> guided_time = std::chrono::steady_clock::now() - start;
+			printf("  guided   %3d  %8.3f  %9.3f  %.4f  %7zu  %5zu\n", samples, train_time.count(), guided_time.count(),
+				f.error(image), guide.region_count(), guide.directional_node_count());
+
+			//plain path tracing with the samples the guided render's total time buys
+			auto equal_samples = static_cast<int>(samples * (train_time.count() + guided_time.count()) / path_time.count());
+			f.settings.samples_per_pixel = equal_samples;
+			start = std::chrono::steady_clock::now();
+			render(f.world, f.cam, setup->background, f.settings, image);
+			path_time = std::chrono::steady_clock::now() - start;
+			printf("  path     %3d  %8.3f  %9.3f  %.4f\n", equal_samples, 0.0, path_time.count(), f.error(image));
+		}
+	}
+
+	//paths ending in the radiance cache at a few cell sizes against full paths, at equal samples;
+	//the full paths go through a cache too, one they only fill, to count their length
+	static void benchmark_cache()
+	{
+		const int reference_samples = 4096, samples = 128;
+		const struct
+		{
+			const char* name;
+			double cell_fraction;
+			double training_fraction;
+		} modes[] = { { "full", 1.0 / 64, 1.0 }, { "1/32", 1.0 / 32, 0.1 }, { "1/64", 1.0 / 64, 0.1 }, { "1/128", 1.0 / 128, 0.1 } };
+		for (auto setup : scenes_named({ "cornell_box", "final_scene" }))
+		{
+			bench_fixture f(*setup, 128, 72);
+			aabb bounds;
+			f.world.bounding_box(bounds);
+			f.render_reference(reference_samples);
+
+			framebuffer image;
+			printf("%s\n  cell       render(s)  path length  cells   rmse    bias\n", setup->name);
+			f.settings.samples_per_pixel = samples;
+			for (const auto& mode : modes)
+			{
+				auto cache_settings = f.settings.cache;
+				cache_settings.cell_fraction = mode.cell_fraction;
+				cache_settings.training_fraction = mode.training_fraction;
+				radiance_cache cache(bounds, cache_settings);
+				auto start = std::chrono::steady_clock::now();
+				render(f.world, f.cam, setup->background, f.settings, image, nullptr, &cache);
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				printf("  %-9s  %9.3f  %11.2f  %5zu  %.4f  %+.4f\n", mode.name, elapsed.count(), cache.average_path_length(), cache.used_cells(),
+					f.error(image), f.bias(image));
+			}
+		}
+	}
+
+	//a grid of spheres with a texture each, seen from far enough that their texels are smaller than a pixel
+	//clutter small white spheres are scattered behind the grid
+	static hittable_list textured_spheres(const vector<shared_ptr<texture>>& textures, int clutter = 0)
+	{
+		hittable_list objects;
+		int side = static_cast<int>(ceil(sqrt(double(textures.size()))));
+		for (size_t i = 0; i < textures.size(); ++i)
+		{
+			auto x = static_cast<int>(i) % side - (side - 1) / 2.0, y = static_cast<int>(i) / side - (side - 1) / 2.0;
+			objects.add(make_shared<sphere>(vec3(2.5 * x, 2.5 * y, 0), 1, make_shared<lambertian>(textures[i])));
+		}
+		auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
+		for (int i = 0; i < clutter; ++i)
+		{
+			objects.add(make_shared<sphere>(vec3(random_double(-12, 12), random_double(-7, 7), random_double(-30, -5)), 0.05, white));
+		}
+		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+	}
+
+	//texture k of the benchmarks: stripes under hashed grain, detail at every scale down to single texels
+	static void bench_pattern(int k, int size, vector<unsigned char>& pixels)
+	{
+		pixels.resize(size_t(size) * size * 3);
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				uint32_t grain = (uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ (uint32_t(k) * 83492791u);
+				grain = (grain ^ (grain >> 13)) * 0x5bd1e995u;
+				auto stripe = 0.5 + 0.5 * sin((x + y * (k % 4)) * 0.05 * (k + 1));
+				for (int c = 0; c < 3; ++c)
+				{
+					auto value = 0.6 * stripe * ((k >> c) & 1 ? 1.0 : 0.5) + 0.4 * ((grain >> (8 * c)) & 255) / 255.0;
+					pixels[(size_t(y) * size + x) * 3 + c] = static_cast<unsigned char>(255 * value);
+				}
+			}
+		}
+	}
+
+	//textures far larger than the cache's budget: the finest level against the levels ray cones
+	//pick, under a few budgets, against a long render of the finest level
+	static void benchmark_textures()
+	{
+		const int image_count = 16, image_size = 1024, reference_samples = 256, samples = 16;
+		auto& cache = texture_cache::global();
+		vector<shared_ptr<texture>> textures;
+		vector<unsigned char> pixels;
+		size_t total_bytes = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int k = 0; k < image_count; ++k)
+		{
+			bench_pattern(k, image_size, pixels);
+			auto image = cache.add("bench_texture_" + std::to_string(k), pixels.data(), image_size, image_size);
+			textures.push_back(make_shared<image_texture>(image));
+			total_bytes += image->total_bytes();
+		}
+		std::chrono::duration<double> convert_time = std::chrono::steady_clock::now() - start;
+		printf("%d textures of %dx%d, %.1f MB of tiles with their mips, converted in %.3f s\n", image_count, image_size, image_size,
+			total_bytes / 1048576.0, convert_time.count());
+
+		compiled_scene world(textured_spheres(textures), 0.0, 1.0);
+		render_settings settings;
+		settings.width = 320;
+		settings.height = 180;
+		const vec3 background(0.7, 0.8, 1.0);
+		camera cam(vec3(0, 0, 40), vec3(0, 0, 0), vec3(0, 1, 0), 20, double(settings.width) / settings.height, 0.0, 10.0, 0.0, 1.0);
+
+		framebuffer reference, image;
+		cache.set_budget(total_bytes);
+		settings.samples_per_pixel = reference_samples;
+		settings.filter_textures = false;
+		render(world, cam, background, settings, reference);
+
+		const struct
+		{
+			const char* name;
+			bool filtered;
+			size_t budget;
+		} modes[] = { { "finest", false, total_bytes }, { "finest", false, size_t(1) << 20 }, { "cones", true, total_bytes },
+			{ "cones", true, size_t(4) << 20 }, { "cones", true, size_t(1) << 20 } };
+		printf("lookup  budget(MB)  render(s)  peak(MB)  tile reads  hit rate  rmse\n");
+		settings.samples_per_pixel = samples;
+		settings.seed = 2;
+		for (const auto& mode : modes)
+		{
+			//start from an empty cache
+			cache.set_budget(0);
+			cache.set_budget(mode.budget);
+			cache.reset_stats();
+			settings.filter_textures = mode.filtered;
+			start = std::chrono::steady_clock::now();
+			render(world, cam, background, settings, image);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			auto stats = cache.stats();
+			printf("%-6s  %10.1f  %9.3f  %8.2f  %10zu  %7.2f%%  %.4f\n", mode.name, mode.budget / 1048576.0, elapsed.count(),
+				stats.peak_bytes / 1048576.0, stats.reads, 100 - 100.0 * stats.reads / ffmax(1.0, double(stats.requests)),
+				rmse(image.pixels, reference.pixels));
+		}
+	}
+
+	//textures decoded before the scene is built, against decoded on the asset loader while the
+	//scene is built, compiled and traced; the files are written first and removed after
+	static void benchmark_loading()
+	{
+		//the first scene built in a process comes out faster than the later ones, so the modes alternate,
+		//each round on files of its own since the cache keeps what it opened
+		const int image_count = 8, image_size = 1024, clutter = 50000, rounds = 3;
+		const char* modes[] = { "blocking", "async" };
+		vector<unsigned char> pixels;
+		vector<std::string> paths;
+		for (int r = 0; r < rounds; ++r)
+		{
+			for (int m = 0; m < 2; ++m)
+			{
+				for (int k = 0; k < image_count; ++k)
+				{
+					bench_pattern(k, image_size, pixels);
+					paths.push_back(std::string("bench_loading_") + modes[m] + "_" + std::to_string(r) + "_" + std::to_string(k) + ".ppm");
+					std::ofstream file(paths.back(), std::ios::binary);
+					file << "P6\n" << image_size << ' ' << image_size << "\n255\n";
+					file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+				}
+			}
+		}
+
+		render_settings settings;
+		settings.width = 320;
+		settings.height = 180;
+		settings.samples_per_pixel = 4;
+		const vec3 background(0.7, 0.8, 1.0);
+		camera cam(vec3(0, 0, 40), vec3(0, 0, 0), vec3(0, 1, 0), 20, double(settings.width) / settings.height, 0.0, 10.0, 0.0, 1.0);
+
+		printf("%d textures of %dx%d, %d spheres of clutter\n", image_count, image_size, image_size, clutter);
+		printf("textures   textures(s)  scene(s)  first pixel(s)  loading then  image(s)\n");
+		for (int run = 0; run < 2 * rounds; ++run)
+		{
+			auto m = run % 2;
+			seed_random(5);
+			auto start = std::chrono::steady_clock::now();
+			vector<shared_ptr<texture>> textures;
+			for (int k = 0; k < image_count; ++k)
+			{
+				const auto& path = paths[run * image_count + k];
+				textures.push_back(m == 0 ? make_shared<image_texture>(texture_cache::global().open(path)) : make_shared<image_texture>(path.c_str()));
+			}
+			std::chrono::duration<double> texture_time = std::chrono::steady_clock::now() - start;
+			compiled_scene world(textured_spheres(textures, clutter), 0.0, 1.0);
+			std::chrono::duration<double> scene_time = std::chrono::steady_clock::now() - start;
+
+			std::atomic<bool> first_tile(false);
+			std::chrono::duration<double> first_pixel_time(0);
+			size_t loading = 0;
+			settings.on_tile = [&](const tile&)
+			{
+				if (first_tile.exchange(true) == false)
+				{
+					first_pixel_time = std::chrono::steady_clock::now() - start;
+					loading = asset_loader::global().pending();
+				}
+			};
+			framebuffer image;
+			render(world, cam, background, settings, image);
+			std::chrono::duration<double> image_time = std::chrono::steady_clock::now() - start;
+			//what is still converting would otherwise run into the next round
+			asset_loader::global().wait_idle();
+			printf("%-9s  %11.3f  %8.3f  %14.3f  %12zu  %8.3f\n", modes[m], texture_time.count(), scene_time.count(), first_pixel_time.count(),
+				loading, image_time.count());
+		}
+
+		for (const auto& path : paths)
+		{
+			std::remove(path.c_str());
+		}
+	}
+
+	//turbulence one octave at a time against the vectorized one, the baked volume at a few
+	//resolutions, and the render time of the noise scenes
+	static void benchmark_noise()
+	{
+		const int point_count = 1000000, width = 160, height = 90, samples_per_pixel = 32;
+		perlin noise;
+		vector<vec3> points(point_count);
+		seed_random(3);
+		for (auto& p : points)
+		{
+			p = vec3(random_double(-50, 50), random_double(-50, 50), random_double(-50, 50));
+		}
+
+		//the sums only keep the loops from being thrown away
+		double sum = 0, max_difference = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (const auto& p : points)
+		{
+			sum += noise.turb_scalar(p);
+		}
+		std::chrono::duration<double> scalar_time = std::chrono::steady_clock::now() - start;
+		start = std::chrono::steady_clock::now();
+		for (const auto& p : points)
+		{
+			sum -= noise.turb(p);
+		}
+		std::chrono::duration<double> turb_time = std::chrono::steady_clock::now() - start;
+		for (const auto& p : points)
+		{
+			max_difference = ffmax(max_difference, fabs(noise.turb(p) - noise.turb_scalar(p)));
+		}
+		printf("turb    %6.1f ns/point\nscalar  %6.1f ns/point  max difference %.2e\n", 1e9 * turb_time.count() / point_count,
+			1e9 * scalar_time.count() / point_count, max_difference);
+
+		//points in the box baked around the small sphere of two_perlin_spheres
+		aabb box(vec3(-1, 0, -1), vec3(1, 2, 1));
+		for (auto& p : points)
+		{
+			p = vec3(random_double(-1, 1), random_double(0, 2), random_double(-1, 1));
+		}
+		printf("baked  build(s)  memory(MB)  lookup(ns)  rms error\n");
+		for (int resolution : { 32, 64, 128 })
+		{
+			start = std::chrono::steady_clock::now();
+			noise_volume volume(noise, box, resolution);
+			std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+			double error = 0;
+			start = std::chrono::steady_clock::now();
+			for (const auto& p : points)
+			{
+				sum += volume.value(p);
+			}
+			std::chrono::duration<double> lookup_time = std::chrono::steady_clock::now() - start;
+			for (const auto& p : points)
+			{
+				auto d = volume.value(p) - noise.turb(p);
+				error += d * d;
+			}
+			printf("%5d  %8.3f  %10.2f  %10.1f  %.4f\n", resolution, build_time.count(), volume.memory_bytes() / 1048576.0,
+				1e9 * lookup_time.count() / point_count, sqrt(error / point_count));
+		}
+
+		printf("scene                render(s)\n");
+		for (auto setup : scenes_named({ "two_perlin_spheres", "simple_light" }))
+		{
+			compiled_scene world(setup->build(), 0.0, 1.0);
+			printf("%-19s  %9.3f\n", setup->name, time_render(world, *setup, width, height, samples_per_pixel));
+		}
+		auto perlin_setup = scenes_named({ "two_perlin_spheres" })[0];
+		compiled_scene baked(perlin_spheres(64), 0.0, 1.0);
+		printf("%-19s  %9.3f\n", "  baked at 64", time_render(baked, *perlin_setup, width, height, samples_per_pixel));
+	}
+
+	//calls of f(x, y) over the points, rounds times, in ns per call
+	template<typename Function>
+	static double time_math(const vector<double>& xs, const vector<double>& ys, int rounds, Function f)
+	{
+		//the sum only keeps the loop from being thrown away
+		double sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; ++round)
+		{
+			for (size_t i = 0; i < xs.size(); ++i)
+			{
+				sum += f(xs[i], ys[i]);
+			}
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return sum == 0.123456789 ? 0 : 1e9 * elapsed.count() / (double(rounds) * xs.size());
+	}
+
+	//the largest error of the fast:: functions against libm, checked against the bounds fast_math.h
+	//promises, and the time of a call of each; false when a bound does not hold
+	static bool benchmark_math()
+	{
+		const int point_count = 1000000, timed_points = 4096, rounds = 250;
+		seed_random(11);
+		auto uniform = [](double a, double b) {
+			vector<double> v(point_count);
+			for (auto& x : v)
+			{
+				x = random_double(a, b);
+			}
+			return v;
+		};
+		vector<double> angles = uniform(-1000, 1000), xs = uniform(-1, 1), ys = uniform(-1, 1);
+
+		bool all_hold = true;
+		auto report = [&](const char* name, const vector<double>& a, const vector<double>& b, double bound, auto libm, auto approx) {
+			double worst = 0;
+			for (int i = 0; i < point_count; ++i)
+			{
+				worst = ffmax(worst, fabs(approx(a[i], b[i]) - libm(a[i], b[i])));
+			}
+			vector<double> timed_a(a.begin(), a.begin() + timed_points), timed_b(b.begin(), b.begin() + timed_points);
+			auto libm_time = time_math(timed_a, timed_b, rounds, libm);
+			auto fast_time = time_math(timed_a, timed_b, rounds, approx);
+			auto holds = worst <= bound;
+			all_hold = all_hold && holds;
+			printf("%-7s  %8.1f  %8.1f  %7.1fx  %9.2e  %7.0e  %s\n", name, libm_time, fast_time, libm_time / fast_time, worst, bound,
+				holds == true ? "ok" : "FAIL");
+		};
+
+		printf("fast math is %s in this build\n", math::is_fast == true ? "on" : "off");
+		printf("         libm(ns)  fast(ns)  speedup  max error    bound\n");
+		report("sin", angles, angles, 1e-14, [](double x, double) { return std::sin(x); },
+			[](double x, double) { double s, c; fast::sincos(x, s, c); return s; });
+		report("cos", angles, angles, 1e-14, [](double x, double) { return std::cos(x); },
+			[](double x, double) { double s, c; fast::sincos(x, s, c); return c; });
+		report("sincos", angles, angles, 2e-14, [](double x, double) { return std::sin(x) + std::cos(x); },
+			[](double x, double) { double s, c; fast::sincos(x, s, c); return s + c; });
+		report("atan2", ys, xs, 1e-14, [](double y, double x) { return std::atan2(y, x); },
+			[](double y, double x) { return fast::atan2(y, x); });
+		report("asin", xs, xs, 1e-13, [](double x, double) { return std::asin(x); }, [](double x, double) { return fast::asin(x); });
+		return all_hold;
+	}
+
+	//texture graphs looked up through their virtual calls and through the program compiled from them,
+	//and the checker cells of the three sines against those from the half period parity
+	static void benchmark_texture_graph()
+	{
+		//few enough points to stay in cache, so the lookups are timed rather than the memory
+		const int point_count = 4096, rounds = 250;
+		vector<hit_record> points(point_count);
+		seed_random(5);
+		for (auto& rec : points)
+		{
+			rec.p = vec3(random_double(-50, 50), random_double(-50, 50), random_double(-50, 50));
+			rec.u = random_double();
+			rec.v = random_double();
+		}
+
+		auto dark = make_shared<constant_texture>(vec3(0.2, 0.3, 0.1));
+		auto light = make_shared<constant_texture>(vec3(0.9, 0.9, 0.9));
+		auto checker = make_shared<checker_texture>(dark, light);
+		auto noise = make_shared<noise_texture>(4);
+		const struct
+		{
+			const char* name;
+			shared_ptr<texture> graph;
+		} graphs[] = {
+			{ "constant", dark },
+			{ "checker", checker },
+			{ "nested checker", make_shared<checker_texture>(checker, make_shared<checker_texture>(light, dark)) },
+			{ "same constants", make_shared<checker_texture>(dark, make_shared<constant_texture>(vec3(0.2, 0.3, 0.1))) },
+			{ "checker of noise", make_shared<checker_texture>(noise, light) }
+		};
+
+		printf("graph             instructions  virtual(ns)  program(ns)  max difference\n");
+		for (const auto& g : graphs)
+		{
+			texture_program program(g.graph);
+			//the sums only keep the loops from being thrown away
+			vec3 sum(0, 0, 0);
+			auto start = std::chrono::steady_clock::now();
+			for (int round = 0; round < rounds; ++round)
+			{
+				for (const auto& rec : points)
+				{
+					sum += g.graph->value_at(rec);
+				}
+			}
+			std::chrono::duration<double> virtual_time = std::chrono::steady_clock::now() - start;
+			start = std::chrono::steady_clock::now();
+			for (int round = 0; round < rounds; ++round)
+			{
+				for (const auto& rec : points)
+				{
+					sum -= program.eval(rec);
+				}
+			}
+			std::chrono::duration<double> program_time = std::chrono::steady_clock::now() - start;
+			double max_difference = 0;
+			for (const auto& rec : points)
+			{
+				max_difference = ffmax(max_difference, (program.eval(rec) - g.graph->value_at(rec)).length());
+			}
+			printf("%-16s  %12zu  %11.1f  %11.1f  %.2e\n", g.name, program.size(), 1e9 * virtual_time.count() / (point_count * rounds),
+				1e9 * program_time.count() / (point_count * rounds), max_difference);
+		}
+
+		size_t disagree = 0, sine_odd = 0, parity_odd = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; ++round)
+		{
+			for (const auto& rec : points)
+			{
+				sine_odd += sin(10 * rec.p.x()) * sin(10 * rec.p.y()) * sin(10 * rec.p.z()) < 0;
+			}
+		}
+		std::chrono::duration<double> sine_time = std::chrono::steady_clock::now() - start;
+		start = std::chrono::steady_clock::now();
+		for (int round = 0; round < rounds; ++round)
+		{
+			for (const auto& rec : points)
+			{
+				parity_odd += checker_is_odd(rec.p);
+			}
+		}
+		std::chrono::duration<double> parity_time = std::chrono::steady_clock::now() - start;
+		for (int i = 0; i < 1000000; ++i)
+		{
+			vec3 p(random_double(-50, 50), random_double(-50, 50), random_double(-50, 50));
+			disagree += (sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z()) < 0) != checker_is_odd(p);
+		}
+		printf("checker cells  sines %.1f ns, parity %.1f ns, odd %zu and %zu times, disagreeing at %zu of 1000000 points\n",
+			1e9 * sine_time.count() / (point_count * rounds), 1e9 * parity_time.count() / (point_count * rounds), sine_odd, parity_odd, disagree);
+	}
+
+	//heap bytes in use, where the C library tells, large blocks mapped on their own included
+	static size_t heap_in_use()
+	{
+#ifdef __GLIBC__
+		auto info = mallinfo2();
+		return info.uordblks + info.hblkhd;
+#else
+		return 0;
+#endif
+	}
+
+	//blocks --bench-arena lays scene objects out in one after another; nothing is freed before
+	//the last object holding them goes
+	struct bump_blocks
+	{
+		const size_t block_bytes = size_t(64) << 10;
+		vector<std::unique_ptr<unsigned char[]>> blocks;
+		unsigned char* next = nullptr;
+		size_t left = 0;
+
+		void* allocate(size_t bytes, size_t alignment)
+		{
+			auto padding = (alignment - reinterpret_cast<uintptr_t>(next) % alignment) % alignment;
+			if (next == nullptr || padding + bytes > left)
+			{
+				left = std::max(block_bytes, bytes + alignment);
+				blocks.emplace_back(new unsigned char[left]);
+				next = blocks.back().get();
+				padding = (alignment - reinterpret_cast<uintptr_t>(next) % alignment) % alignment;
+			}
+			auto p = next + padding;
+			next += padding + bytes;
+			left -= padding + bytes;
+			return p;
+		}
+	};
+
+	//for allocate_shared: object and reference counts together in the blocks, deallocating does nothing
+	template<typename T>
+	struct bump_allocator
+	{
+		typedef T value_type;
+		shared_ptr<bump_blocks> blocks;
+
+		explicit bump_allocator(const shared_ptr<bump_blocks>& b) : blocks(b) {}
+		template<typename U>
+		bump_allocator(const bump_allocator<U>& other) : blocks(other.blocks) {}
+
+		T* allocate(size_t n) { return static_cast<T*>(blocks->allocate(n * sizeof(T), alignof(T))); }
+		void deallocate(T* p, size_t n) {}
+
+		template<typename U>
+		bool operator==(const bump_allocator<U>& other) const { return blocks == other.blocks; }
+		template<typename U>
+		bool operator!=(const bump_allocator<U>& other) const { return blocks != other.blocks; }
+	};
+
+	//random_scene's spheres, each with a material and texture of its own, made on the heap or in
+	//blocks; the bvh_node over them builds its own nodes on the heap either way
+	static hittable_list scattered_spheres(int count, const shared_ptr<bump_blocks>& blocks)
+	{
+		auto make = [&](auto made) {
+			return blocks == nullptr ? make_shared<decltype(made)>(made) : std::allocate_shared<decltype(made)>(
+				bump_allocator<decltype(made)>(blocks), made);
+		};
+		hittable_list objects;
+		auto side = static_cast<int>(sqrt(double(count)));
+		for (int i = 0; i < count; ++i)
+		{
+			vec3 center(i % side + 0.9 * random_double(), 0.2, i / side + 0.9 * random_double());
+			auto albedo = make(constant_texture(vec3::random() * vec3::random()));
+			objects.add(make(sphere(center, 0.2, make(lambertian(albedo)))));
+		}
+		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+	}
+
+	//scene objects made one by one on the heap against laid out in bump blocks: the time to make
+	//them, to compile them, to trace rays through the authoring graph itself, and to free them
+	static void benchmark_arena()
+	{
+		const int ray_count = 200000, repeats = 3;
+		printf("spheres  made in  build(s)  heap(MB)  compile(s)  virtual(Mrays/s)  free(s)\n");
+		for (int sphere_count : { 10000, 100000 })
+		{
+			for (int mode = 0; mode < 2; ++mode)
+			{
+				std::chrono::duration<double> build_time(0), compile_time(0), trace_time(0), free_time(0);
+				size_t heap = 0;
+				for (int repeat = 0; repeat < repeats; ++repeat)
+				{
+					seed_random(7);
+					auto before = heap_in_use();
+					auto start = std::chrono::steady_clock::now();
+					auto world = make_shared<hittable_list>(scattered_spheres(sphere_count, mode == 1 ? make_shared<bump_blocks>() : nullptr));
+					build_time += std::chrono::steady_clock::now() - start;
+					heap = heap_in_use() - before;
+
+					start = std::chrono::steady_clock::now();
+					auto compiled = make_shared<compiled_scene>(*world, 0.0, 1.0);
+					compile_time += std::chrono::steady_clock::now() - start;
+
+					auto side = sqrt(double(sphere_count));
+					hit_record rec;
+					int hits = 0;
+					start = std::chrono::steady_clock::now();
+					for (int i = 0; i < ray_count; ++i)
+					{
+						ray r(vec3(random_double(0, side), 1, random_double(0, side)), vec3(random_double(-1, 1), -1, random_double(-1, 1)), 0);
+						hits += world->hit(r, 0.001, infinity, rec);
+					}
+					trace_time += std::chrono::steady_clock::now() - start;
+
+					start = std::chrono::steady_clock::now();
+					world.reset();
+					compiled.reset();
+					free_time += std::chrono::steady_clock::now() - start;
+				}
+				printf("%7d  %7s  %8.4f  %8.2f  %10.4f  %16.2f  %7.4f\n", sphere_count, mode == 0 ? "heap" : "blocks", build_time.count() / repeats,
+					heap / 1048576.0, compile_time.count() / repeats, ray_count * repeats / trace_time.count() * 1e-6, free_time.count() / repeats);
+			}
+		}
+	}
+
+	//clouds of random spheres of growing size: the memory of the bvh over them and the closest-hit
+	//and any-hit throughput of rays from random points in random directions
+	static void benchmark_bvh()
+	{
+		const int ray_count = 1000000;
+		printf("wide node: %zu bytes\n", sizeof(wide_bvh_node));
+		printf("spheres    nodes  bvh(MB)  bytes/prim  build(s)  closest(Mrays/s)  occluded(Mrays/s)\n");
+		for (int sphere_count : { 10000, 100000, 1000000 })
+		{
+			seed_random(7);
+			//the density of the cloud the same at every size
+			auto extent = 25 * cbrt(sphere_count / 10000.0);
+			auto mat = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.5, 0.5, 0.5)));
+			hittable_list objects;
+			{
+				for (int i = 0; i < sphere_count; ++i)
+				{
+					vec3 center(random_double(-extent, extent), random_double(-extent, extent), random_double(-extent, extent));
+					objects.add(make_shared<sphere>(center, random_double(0.2, 1.0), mat));
+				}
+			}
+			auto start = std::chrono::steady_clock::now();
+			compiled_scene world(objects, 0.0, 1.0);
+			std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+			objects.clear();
+
+			vector<ray> rays;
+			rays.reserve(ray_count);
+			for (int i = 0; i < ray_count; ++i)
+			{
+				vec3 origin(random_double(-extent, extent), random_double(-extent, extent), random_double(-extent, extent));
+				rays.push_back(ray(origin, random_unit_vector(), 0));
+			}
+
+			hit_query query;
+			int closest_hits = 0, occluded_hits = 0;
+			start = std::chrono::steady_clock::now();
+			for (const auto& r : rays)
+			{
+				closest_hits += world.intersect(r, 0.001, infinity, query);
+			}
+			std::chrono::duration<double> closest_time = std::chrono::steady_clock::now() - start;
+
+			start = std::chrono::steady_clock::now();
+			for (const auto& r : rays)
+			{
+				occluded_hits += world.occluded(r, 0.001, infinity);
+			}
+			std::chrono::duration<double> occluded_time = std::chrono::steady_clock::now() - start;
+
+			printf("%7d  %7zu  %7.2f  %10.1f  %8.3f  %16.2f  %17.2f\n", sphere_count, world.node_count(), world.bvh_bytes() / 1048576.0,
+				double(world.bvh_bytes()) / world.primitive_count(), build_time.count(), ray_count / closest_time.count() * 1e-6,
+				ray_count / occluded_time.count() * 1e-6);
+			if (closest_hits != occluded_hits)
+			{
+				printf("  closest hit %d rays, occluded %d\n", closest_hits, occluded_hits);
+			}
+		}
+	}
+
+	//time budgeted renders over every tile and noisiest tiles first, against a long render: how well each
+	//keeps to the budget, the samples the pixels got, and the error and mean bias of the image
+	static void benchmark_budget()
+	{
+		const int reference_samples = 1024;
+		const double budgets[] = { 0.25, 0.5, 1.0 };
+		printf("scene          budget(s)  mode         passes  time(s)  spp min/mean/max    rmse   worst tile   bias\n");
+		for (auto setup : scenes_named({ "cornell_box", "random_scene" }))
+		{
+			bench_fixture f(*setup, 96, 54);
+			f.settings.tile_size = 16;
+			f.render_reference(reference_samples);
+
+			framebuffer image;
+			f.settings.samples_per_pixel = 1 << 20;
+			for (auto budget : budgets)
+			{
+				for (int noisy_first = 0; noisy_first < 2; ++noisy_first)
+				{
+					auto stats = render_budgeted(f.world, f.cam, setup->background, f.settings, budget, noisy_first == 1, image);
+					double worst = 0;
+					for (const auto& t : make_tiles(f.settings.width, f.settings.height, f.settings.tile_size))
+					{
+						vector<vec3> tile_image, tile_reference;
+						for (int y = t.y0; y < t.y1; ++y)
+						{
+							for (int x = t.x0; x < t.x1; ++x)
+							{
+								tile_image.push_back(image.at(x, y));
+								tile_reference.push_back(f.reference.at(x, y));
+							}
+						}
+						worst = std::max(worst, rmse(tile_image, tile_reference));
+					}
+					printf("%-13s  %9.2f  %-11s  %6d  %7.3f  %4d/%6.1f/%-5d  %.4f  %10.4f  %+.4f\n", setup->name, budget, noisy_first == 1 ? "noisy first" : "every tile",
+						stats.passes, stats.seconds, stats.fewest_samples, stats.mean_samples, stats.most_samples, f.error(image), worst, f.bias(image));
+				}
+			}
+		}
+	}
+
+	//counts and hashes what is written to it, so large images can be checked without keeping them
+	class hashing_buffer : public std::streambuf
+	{
+	public:
+		uint64_t hash = 14695981039346656037ull;
+		size_t bytes = 0;
+
+	protected:
+		int overflow(int c) override
+		{
+			if (c != EOF)
+			{
+				add(static_cast<unsigned char>(c));
+			}
+			return c;
+		}
+		std::streamsize xsputn(const char* s, std::streamsize n) override
+		{
+			for (std::streamsize i = 0; i < n; ++i)
+			{
+				add(static_cast<unsigned char>(s[i]));
+			}
+			return n;
+		}
+
+	private:
+		void add(unsigned char c)
+		{
+			hash = (hash ^ c) * 1099511628211ull;
+			++bytes;
+		}
+	};
+
+	//a tall image rendered whole and written after, and streamed in bands: the peak heap over the
+	//scene's during each, sampled as tiles finish, and whether both put out the same bytes
+	static void benchmark_stream()
+	{
+		const int width = 512, band_rows = 64;
+		const scene_setup& setup = builtin_scenes[0];
+		compiled_scene world(seeded_build(setup), 0.0, 1.0);
+		printf("height  mode     peak heap(MB)  bands(MB)  time(s)  same bytes\n");
+		for (int height : { 1024, 4096, 16384 })
+		{
+			render_settings settings;
+			settings.width = width;
+			settings.height = height;
+			settings.samples_per_pixel = 1;
+			settings.max_depth = 8;
+			camera cam(setup.lookfrom, setup.lookat, vec3(0, 1, 0), setup.vfov, double(width) / height, 0.0, 10.0, 0.0, 1.0);
+
+			std::mutex lock;
+			size_t base = 0, peak = 0;
+			settings.on_tile = [&](const tile&)
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				peak = std::max(peak, heap_in_use());
+			};
+
+			//the binary ppm write_image's bytes would make
+			hashing_buffer whole_bytes;
+			base = peak = heap_in_use();
+			auto start = std::chrono::steady_clock::now();
+			{
+				framebuffer image;
+				render(world, cam, setup.background, settings, image);
+				std::ostream out(&whole_bytes);
+				out << "P6\n" << width << ' ' << height << "\n255\n";
+				for (const auto& pixel : image.pixels)
+				{
+					for (int k = 0; k < 3; ++k)
+					{
+						out.put(static_cast<char>(static_cast<int>(255 * clamp(sqrt(pixel[k]), 0.0, 0.999))));
+					}
+				}
+				peak = std::max(peak, heap_in_use());
+			}
+			std::chrono::duration<double> whole_time = std::chrono::steady_clock::now() - start;
+			printf("%6d  whole    %13.2f  %9s  %7.2f\n", height, (peak - base) / 1048576.0, "", whole_time.count());
+
+			hashing_buffer band_bytes;
+			base = peak = heap_in_use();
+			start = std::chrono::steady_clock::now();
+			std::ostream out(&band_bytes);
+			auto held = render_bands(world, cam, setup.background, settings, out, band_rows);
+			std::chrono::duration<double> band_time = std::chrono::steady_clock::now() - start;
+			printf("%6s  streamed %13.2f  %9.2f  %7.2f  %s\n", "", (peak - base) / 1048576.0, held / 1048576.0, band_time.count(),
+				band_bytes.hash == whole_bytes.hash && band_bytes.bytes == whole_bytes.bytes ? "yes" : "no");
+		}
+	}
+
+	//caustics from photons against the path tracer alone, at equal samples and at equal time
+	static void benchmark_photons()
+	{
+		const int reference_samples = 4096, samples = 64;
+		for (auto setup : scenes_named({ "final_scene" }))
+		{
+			bench_fixture f(*setup, 128, 72);
+			f.render_reference(reference_samples);
+
+			const auto& photons = f.settings.photons;
+			photon_map first_map(f.world, photons, photons.radius, 1, f.settings.threads);
+			auto first_radius = first_map.get_radius();
+			printf("%s: %zu caustic photons of %d per iteration, radius %.3f down to %.3f\n", setup->name, first_map.size(),
+				photons.photons_per_iteration, first_radius, photon_radius(first_radius, photons.alpha, photons.iterations - 1));
+			printf("  mode      spp  render(s)  rmse    bias\n");
+
+			framebuffer image;
+			f.settings.samples_per_pixel = samples;
+			f.settings.photons.enabled = true;
+			auto start = std::chrono::steady_clock::now();
+			render(f.world, f.cam, setup->background, f.settings, image);
+			std::chrono::duration<double> photon_time = std::chrono::steady_clock::now() - start;
+			printf("  photons  %4d  %9.3f  %.4f  %+.4f\n", samples, photon_time.count(), f.error(image), f.bias(image));
+
+			f.settings.photons.enabled = false;
+			start = std::chrono::steady_clock::now();
+			render(f.world, f.cam, setup->background, f.settings, image);
+			std::chrono::duration<double> path_time = std::chrono::steady_clock::now() - start;
+			printf("  path     %4d  %9.3f  %.4f  %+.4f\n", samples, path_time.count(), f.error(image), f.bias(image));
+
+			auto equal_samples = static_cast<int>(samples * photon_time.count() / path_time.count());
+			f.settings.samples_per_pixel = equal_samples;
+			start = std::chrono::steady_clock::now();
+			render(f.world, f.cam, setup->background, f.settings, image);
+			path_time = std::chrono::steady_clock::now() - start;
+			printf("  path     %4d  %9.3f  %.4f  %+.4f\n", equal_samples, path_time.count(), f.error(image), f.bias(image));
+		}
+	}
+
+	bool run_benchmark(const char* option, int& exit_code)
+	{
+		const struct
+		{
+			const char* option;
+			void(*run)();
+		} modes[] = {
+			{ "--bench-lights", benchmark_lights },
+			{ "--bench-restir", benchmark_restir },
+			{ "--bench-denoise", benchmark_denoise },
+			{ "--bench-samplers", benchmark_samplers },
+			{ "--bench-volume", benchmark_volume },
+			{ "--bench-guiding", benchmark_guiding },
+			{ "--bench-cache", benchmark_cache },
+			{ "--bench-photons", benchmark_photons },
+			{ "--bench-noise", benchmark_noise },
+			{ "--bench-textures", benchmark_textures },
+			{ "--bench-loading", benchmark_loading },
+			{ "--bench-texture-graph", benchmark_texture_graph },
+			{ "--bench-arena", benchmark_arena },
+			{ "--bench-bvh", benchmark_bvh },
+			{ "--bench-stream", benchmark_stream },
+			{ "--bench-budget", benchmark_budget }
+		};
+
+		exit_code = 0;
+		if (strcmp(option, "--bench") == 0)
+		{
+			benchmark_scenes();
+			benchmark_queries();
+			return true;
+		}
+		//the only one that can fail
+		if (strcmp(option, "--bench-math") == 0)
+		{
+			exit_code = benchmark_math() == true ? 0 : 1;
+			return true;
+		}
+		for (const auto& mode : modes)
+		{
+			if (strcmp(option, mode.option) == 0)
+			{
+				mode.run();
+				return true;
+			}
+		}
+		return false;
+	}
+}
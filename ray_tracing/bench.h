@@ -0,0 +1,11 @@
+#pragma once
+
+namespace ray_tracing
+{
+	/*
+	The --bench-* modes: each builds the scenes it measures, prints a table to stdout and returns.
+	option is the first command line argument; false when it names no benchmark, and exit_code is
+	what the process should return otherwise.
+	*/
+	bool run_benchmark(const char* option, int& exit_code);
+}
@@ -0,0 +1,1600 @@
+#include "compiled_scene.h"
+#include"grid_medium.h"
+#include<atomic>
+
+#ifdef __AVX__
+#include<immintrin.h>
+#endif
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const size_t max_leaf_prims = 4;
+		//what the count of a flat_bvh_node and the leaf_count of a wide_bvh_node hold
+		const size_t max_leaf_count = 0xffff;
+		const int sah_bins = 12;
+		const int max_sah_depth = 40;
+		const int max_stack_depth = 96;
+		//a wide node pushes up to three of its children
+		const int max_wide_stack_depth = 3 * max_stack_depth;
+		//boundary crossings this close to the closest hit are left to the surface
+		const double interface_nudge = 1e-4;
+		//how far from a surface cross_at_surface looks for the boundaries it lies on
+		const double interface_window = 1e-3;
+		const int max_boundary_crossings = 16;
+		//boundary crossings are stepped past by this share of the medium's extent
+		const double crossing_step = 1e-6;
+
+		//the media find_media last found around a point at a time on this thread; camera rays share theirs
+		struct media_at_point
+		{
+			uint32_t scene = 0;
+			vec3 point;
+			double time = 0;
+			active_media active;
+		};
+		thread_local media_at_point last_media_found;
+		std::atomic<uint32_t> next_scene_id(1);
+
+		//where the search for the next crossing of m along its local ray r starts after the one at t
+		inline double past_crossing(const medium_prim& m, const ray& r, double t)
+		{
+			return t + m.step / r.get_direction().length();
+		}
+
+		//a child of a wide node waiting on the traversal stack, nearest entry point first
+		struct wide_entry
+		{
+			uint32_t index;
+			uint32_t leaf_count;
+			double t;
+		};
+
+		//2^exponent, built from its bits
+		inline double grid_step(int exponent)
+		{
+			return fast::from_bits(static_cast<uint64_t>(exponent + 1023) << 52);
+		}
+
+		//picks origin and exponent for one axis of a wide node over [lo, hi]
+		void quantization_grid(double lo, double hi, float& origin, int& exponent)
+		{
+			origin = static_cast<float>(lo);
+			if (origin > lo)
+			{
+				origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+			}
+			//no finer than 2^-44 of the origin, so the 24 bits of origin and the 8 of a step count
+			//add up exactly in the 53 of a double
+			int finest = origin != 0 ? std::ilogb(origin) - 44 : -126;
+			exponent = std::max(finest, -126);
+			auto extent = (hi - origin) / 255;
+			if (extent > 0)
+			{
+				exponent = std::max(exponent, std::ilogb(extent));
+			}
+			while (exponent < 127 && origin + 255 * grid_step(exponent) < hi)
+			{
+				++exponent;
+			}
+		}
+
+		//the steps of the grid below lo and above hi, clamped to it
+		void quantize_bounds(double lo, double hi, float origin, int exponent, uint8_t& q_lo, uint8_t& q_hi)
+		{
+			auto step = grid_step(exponent);
+			auto low = std::min(std::max(std::floor((lo - origin) / step), 0.0), 255.0);
+			while (low > 0 && origin + low * step > lo)
+			{
+				--low;
+			}
+			auto high = std::min(std::max(std::ceil((hi - origin) / step), 0.0), 255.0);
+			while (high < 255 && origin + high * step < hi)
+			{
+				++high;
+			}
+			q_lo = static_cast<uint8_t>(low);
+			q_hi = static_cast<uint8_t>(high);
+		}
+
+		//the slab test of aabb::hit against the decoded boxes of all children at once; returns the
+		//children hit as bits and where each is entered
+		inline int hit_children(const wide_bvh_node& node, const double origin[3], const double inv_dir[3], double t_min, double t_max,
+			double t_near[4])
+		{
+#ifdef __AVX__
+			__m256d near = _mm256_set1_pd(t_min), far = _mm256_set1_pd(t_max);
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				auto grid_origin = _mm256_set1_pd(node.origin[axis]);
+				auto step = _mm256_set1_pd(grid_step(node.exponent[axis]));
+				int lo_bits, hi_bits;
+				memcpy(&lo_bits, node.lo[axis], sizeof(lo_bits));
+				memcpy(&hi_bits, node.hi[axis], sizeof(hi_bits));
+				auto lo = _mm256_add_pd(grid_origin, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(lo_bits))), step));
+				auto hi = _mm256_add_pd(grid_origin, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(hi_bits))), step));
+				auto o = _mm256_set1_pd(origin[axis]), inv = _mm256_set1_pd(inv_dir[axis]);
+				auto t0 = _mm256_mul_pd(_mm256_sub_pd(lo, o), inv);
+				auto t1 = _mm256_mul_pd(_mm256_sub_pd(hi, o), inv);
+				//min and max return their second operand for a nan, as ffmin and ffmax do
+				near = _mm256_max_pd(_mm256_min_pd(t0, t1), near);
+				far = _mm256_min_pd(_mm256_max_pd(t0, t1), far);
+			}
+			_mm256_storeu_pd(t_near, near);
+			return _mm256_movemask_pd(_mm256_cmp_pd(near, far, _CMP_LE_OQ)) & ((1 << node.child_count) - 1);
+#else
+			int mask = 0;
+			for (int c = 0; c < node.child_count; ++c)
+			{
+				auto near = t_min, far = t_max;
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					auto step = grid_step(node.exponent[axis]);
+					auto t0 = (node.origin[axis] + node.lo[axis][c] * step - origin[axis]) * inv_dir[axis];
+					auto t1 = (node.origin[axis] + node.hi[axis][c] * step - origin[axis]) * inv_dir[axis];
+					near = ffmax(ffmin(t0, t1), near);
+					far = ffmin(ffmax(t0, t1), far);
+				}
+				t_near[c] = near;
+				mask |= (near <= far) << c;
+			}
+			return mask;
+#endif
+		}
+
+		double box_area(const aabb& box)
+		{
+			vec3 d = box.get_max() - box.get_min();
+			return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+		}
+
+		//intersection kernels only find the distance, the surface is rebuilt once for the closest hit
+		inline bool intersect_sphere(const vec3& center, double radius, const ray& r, double t_min, double t_max, double& t)
+		{
+			vec3 oc = r.get_origin() - center;
+			auto a = r.get_direction().length_squared();
+			auto half_b = dot(r.get_direction(), oc);
+			auto c = oc.length_squared() - radius * radius;
+			auto delta = half_b * half_b - a * c;
+			if (delta <= 0)
+			{
+				return false;
+			}
+
+			auto root = sqrt(delta);
+			auto temp = (-half_b - root) / a;
+			if (temp <= t_min || temp >= t_max)
+			{
+				temp = (-half_b + root) / a;
+				if (temp <= t_min || temp >= t_max)
+				{
+					return false;
+				}
+			}
+			t = temp;
+			return true;
+		}
+
+		//axis is the normal of the rectangle, a and b the in-plane axes in (x, y, z) order
+		template<int axis, int a, int b>
+		inline bool intersect_rect(const rect_prim& rect, const ray& r, double t_min, double t_max, double& t)
+		{
+			auto temp = (rect.k - r.get_origin().e[axis]) / r.get_direction().e[axis];
+			if (temp < t_min || temp > t_max)
+			{
+				return false;
+			}
+
+			auto x = r.get_origin().e[a] + temp * r.get_direction().e[a];
+			auto y = r.get_origin().e[b] + temp * r.get_direction().e[b];
+			if (x < rect.a0 || x > rect.a1 || y < rect.b0 || y > rect.b1)
+			{
+				return false;
+			}
+			t = temp;
+			return true;
+		}
+
+		inline void sphere_interaction(const vec3& center, double radius, uint32_t mat_id, uint32_t light, const ray& r, double t, hit_record& rec)
+		{
+			rec.t = t;
+			rec.p = r.at(t);
+			vec3 outward_normal = (rec.p - center) / radius;
+			rec.set_face_normal(r, outward_normal);
+			rec.mat_id = mat_id;
+			rec.light_id = light;
+			get_sphere_uv(outward_normal, rec.u, rec.v);
+		}
+
+		//u wraps around the equator and v runs pole to pole, their geometric mean
+		inline double sphere_uv_per_unit(double radius)
+		{
+			return 1 / (pi * sqrt(2.0) * radius);
+		}
+
+		template<int axis, int a, int b>
+		inline void rect_interaction(const rect_prim& rect, const ray& r, double t, hit_record& rec)
+		{
+			rec.t = t;
+			rec.p = r.at(t);
+			rec.u = (rec.p.e[a] - rect.a0) / (rect.a1 - rect.a0);
+			rec.v = (rec.p.e[b] - rect.b0) / (rect.b1 - rect.b0);
+			vec3 outward_normal;
+			outward_normal.e[axis] = 1;
+			rec.set_face_normal(r, outward_normal);
+			rec.mat_id = rect.mat_id;
+			rec.light_id = rect.light;
+		}
+
+		//object space of a rotate_y child, and back
+		inline vec3 rotate_to_local(const rotate_y_prim& rot, const vec3& v)
+		{
+			return vec3(rot.cos_theta * v[0] - rot.sin_theta * v[2], v[1], rot.sin_theta * v[0] + rot.cos_theta * v[2]);
+		}
+
+		inline vec3 rotate_to_world(const rotate_y_prim& rot, const vec3& v)
+		{
+			return vec3(rot.cos_theta * v[0] + rot.sin_theta * v[2], v[1], -rot.sin_theta * v[0] + rot.cos_theta * v[2]);
+		}
+	}
+
+	compiled_scene::compiled_scene(const hittable& world, double time0, double time1)
+		: time0(time0), time1(time1), root(0), id(next_scene_id++), selection(select_light_tree)
+	{
+		vector<build_item> items;
+		current = &items;
+		world.lower(*this);
+		current = nullptr;
+
+		if (items.empty() == false)
+		{
+			root = build(items, 0, items.size(), 0);
+			scene_box = nodes[root].box;
+
+			//every subtree was built on its own, each is packed on its own
+			root = widen(root);
+			for (auto& t : translates)
+			{
+				t.root = widen(t.root);
+			}
+			for (auto& rot : rotations)
+			{
+				rot.root = widen(rot.root);
+			}
+			for (auto& m : media)
+			{
+				m.root = widen(m.root);
+			}
+			vector<flat_bvh_node>().swap(nodes);
+		}
+
+		vector<light_bounds> bounds;
+		bounds.reserve(lights.size());
+		for (const auto& light : lights)
+		{
+			bounds.push_back(bound_light(light));
+		}
+		tree.build(bounds);
+
+		double total_power = 0;
+		for (const auto& b : bounds)
+		{
+			total_power += b.power;
+			power_cdf.push_back(total_power);
+		}
+		for (size_t i = 0; i < power_cdf.size(); ++i)
+		{
+			//all lights black: fall back to uniform
+			power_cdf[i] = total_power > 0 ? power_cdf[i] / total_power : double(i + 1) / power_cdf.size();
+		}
+	}
+
+	void compiled_scene::add(const shared_ptr<hittable>& object)
+	{
+		object->lower(*this);
+	}
+
+	void compiled_scene::push(prim_type type, size_t index, const aabb& box)
+	{
+		build_item item;
+		item.ref.type = type;
+		item.ref.index = static_cast<uint32_t>(index);
+		item.box = box;
+		item.centroid = (box.get_min() + box.get_max()) * 0.5;
+		current->push_back(item);
+	}
+
+	uint32_t compiled_scene::add_light(prim_type type, size_t index, uint32_t mat_id, double area)
+	{
+		light_prim light;
+		light.type = type;
+		light.index = static_cast<uint32_t>(index);
+		light.mat_id = mat_id;
+		light.area = area;
+		light.to_world = current_transform;
+		lights.push_back(light);
+		return static_cast<uint32_t>(lights.size() - 1);
+	}
+
+	uint32_t compiled_scene::add_sphere(const vec3& center, double radius, const shared_ptr<material>& mat)
+	{
+		auto mat_id = registry.add(mat);
+		auto light = mat->is_emissive() == true ? add_light(prim_sphere, spheres.size(), mat_id, 4 * pi * radius * radius) : no_light;
+		spheres.push_back({ center, radius, mat_id, light });
+		vec3 r(radius, radius, radius);
+		push(prim_sphere, spheres.size() - 1, aabb(center - r, center + r));
+		return mat_id;
+	}
+
+	uint32_t compiled_scene::add_moving_sphere(const vec3& center0, const vec3& center1, double t0, double t1, double radius, const shared_ptr<material>& mat)
+	{
+		moving_sphere_prim s;
+		s.center0 = center0;
+		s.velocity = (center1 - center0) / (t1 - t0);
+		s.time0 = t0;
+		s.radius = radius;
+		s.mat_id = registry.add(mat);
+		s.light = mat->is_emissive() == true ? add_light(prim_moving_sphere, moving_spheres.size(), s.mat_id, 4 * pi * radius * radius) : no_light;
+		moving_spheres.push_back(s);
+
+		vec3 r(radius, radius, radius);
+		vec3 c0 = center0 + s.velocity * (time0 - t0);
+		vec3 c1 = center0 + s.velocity * (time1 - t0);
+		push(prim_moving_sphere, moving_spheres.size() - 1, surrounding_box(aabb(c0 - r, c0 + r), aabb(c1 - r, c1 + r)));
+		return s.mat_id;
+	}
+
+	uint32_t compiled_scene::add_rect(prim_type type, double a0, double a1, double b0, double b1, double k, const shared_ptr<material>& mat)
+	{
+		auto mat_id = registry.add(mat);
+		auto light = mat->is_emissive() == true ? add_light(type, rects.size(), mat_id, (a1 - a0) * (b1 - b0)) : no_light;
+		rects.push_back({ a0, a1, b0, b1, k, mat_id, light });
+
+		aabb box;
+		switch (type)
+		{
+		case prim_xy_rect:
+			box = aabb(vec3(a0, b0, k - 0.0001), vec3(a1, b1, k + 0.0001));
+			break;
+		case prim_xz_rect:
+			box = aabb(vec3(a0, k - 0.0001, b0), vec3(a1, k + 0.0001, b1));
+			break;
+		default:
+			box = aabb(vec3(k - 0.0001, a0, b0), vec3(k + 0.0001, a1, b1));
+			break;
+		}
+		push(type, rects.size() - 1, box);
+		return mat_id;
+	}
+
+	bool compiled_scene::build_subtree(const shared_ptr<hittable>& child, uint32_t& subtree_root)
+	{
+		vector<build_item> items;
+		auto outer = current;
+		current = &items;
+		add(child);
+		current = outer;
+
+		if (items.empty() == true)
+		{
+			return false;
+		}
+		subtree_root = build(items, 0, items.size(), 0);
+		return true;
+	}
+
+	//a hit_query has room for max_instance_depth transforms, objects under more are left out
+	bool compiled_scene::enter_instance()
+	{
+		if (instance_depth == max_instance_depth)
+		{
+			cerr << "compiled_scene: transforms nested deeper than " << max_instance_depth << ", object left out" << endl;
+			return false;
+		}
+		++instance_depth;
+		return true;
+	}
+
+	void compiled_scene::add_translate(const shared_ptr<hittable>& child, const vec3& offset)
+	{
+		translate_prim t;
+		t.offset = offset;
+
+		if (enter_instance() == false)
+		{
+			return;
+		}
+		auto outer_transform = current_transform;
+		current_transform.offset = current_transform.point_to_world(offset);
+		bool is_built = build_subtree(child, t.root);
+		current_transform = outer_transform;
+		--instance_depth;
+		if (is_built == false)
+		{
+			return;
+		}
+		translates.push_back(t);
+
+		const aabb& box = nodes[t.root].box;
+		push(prim_translate, translates.size() - 1, aabb(box.get_min() + offset, box.get_max() + offset));
+	}
+
+	void compiled_scene::add_rotate_y(const shared_ptr<hittable>& child, double sin_theta, double cos_theta)
+	{
+		rotate_y_prim rot;
+		rot.sin_theta = sin_theta;
+		rot.cos_theta = cos_theta;
+
+		if (enter_instance() == false)
+		{
+			return;
+		}
+		//rotations about the same axis compose by adding their angles
+		auto outer_transform = current_transform;
+		current_transform.sin_theta = outer_transform.sin_theta * cos_theta + outer_transform.cos_theta * sin_theta;
+		current_transform.cos_theta = outer_transform.cos_theta * cos_theta - outer_transform.sin_theta * sin_theta;
+		bool is_built = build_subtree(child, rot.root);
+		current_transform = outer_transform;
+		--instance_depth;
+		if (is_built == false)
+		{
+			return;
+		}
+		rotations.push_back(rot);
+
+		//rotate the eight corners of the child box, as rotate_y does
+		const aabb& box = nodes[rot.root].box;
+		vec3 min(infinity, infinity, infinity);
+		vec3 max(-infinity, -infinity, -infinity);
+		for (int i = 0; i < 8; ++i)
+		{
+			auto x = (i & 1) ? box.get_max().x() : box.get_min().x();
+			auto y = (i & 2) ? box.get_max().y() : box.get_min().y();
+			auto z = (i & 4) ? box.get_max().z() : box.get_min().z();
+			vec3 tester(cos_theta * x + sin_theta * z, y, -sin_theta * x + cos_theta * z);
+			for (int c = 0; c < 3; ++c)
+			{
+				min[c] = ffmin(min[c], tester[c]);
+				max[c] = ffmax(max[c], tester[c]);
+			}
+		}
+		push(prim_rotate_y, rotations.size() - 1, aabb(min, max));
+	}
+
+	uint32_t compiled_scene::add_medium(const shared_ptr<hittable>& boundary, double neg_inv_density, const shared_ptr<material>& phase_function)
+	{
+		medium_prim m;
+		m.neg_inv_density = neg_inv_density;
+		m.phase_function = registry.add(phase_function);
+		m.to_world = current_transform;
+		if (build_subtree(boundary, m.root) == false)
+		{
+			return m.phase_function;
+		}
+		m.bounds = nodes[m.root].box;
+		m.step = ffmax((m.bounds.get_max() - m.bounds.get_min()).length() * crossing_step, 1e-9);
+		media.push_back(m);
+
+		push(prim_medium, media.size() - 1, m.bounds);
+		return m.phase_function;
+	}
+
+	uint32_t compiled_scene::add_grid_medium(const shared_ptr<const density_grid>& grid, const shared_ptr<material>& phase_function)
+	{
+		grid_media.push_back({ grid, registry.add(phase_function) });
+		push(prim_grid_medium, grid_media.size() - 1, grid->bounds());
+		return grid_media.back().phase_function;
+	}
+
+	//binned surface area heuristic over the centroids, falls back to a median split
+	//deep in the tree the median split is forced so the traversal stack stays bounded
+	uint32_t compiled_scene::build(vector<build_item>& items, size_t start, size_t end, int depth)
+	{
+		auto node_index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(flat_bvh_node());
+
+		aabb box = items[start].box;
+		aabb centroids(items[start].centroid, items[start].centroid);
+		for (size_t i = start + 1; i < end; ++i)
+		{
+			box = surrounding_box(box, items[i].box);
+			centroids = surrounding_box(centroids, aabb(items[i].centroid, items[i].centroid));
+		}
+		nodes[node_index].box = box;
+
+		size_t count = end - start;
+		vec3 extent = centroids.get_max() - centroids.get_min();
+		int axis = 0;
+		if (extent.y() > extent.x()) axis = 1;
+		if (extent.z() > extent[axis]) axis = 2;
+
+		if (count <= max_leaf_prims || (extent[axis] <= 0 && count <= max_leaf_count))
+		{
+			nodes[node_index].offset = static_cast<uint32_t>(refs.size());
+			nodes[node_index].count = static_cast<uint16_t>(count);
+			for (size_t i = start; i < end; ++i)
+			{
+				refs.push_back(items[i].ref);
+			}
+			return node_index;
+		}
+
+		//centroids all in one point cannot be told apart, they are halved as they come
+		size_t mid = start + count / 2;
+		if (extent[axis] > 0)
+		{
+			//bin the centroids along the widest axis and evaluate every bin boundary
+			int bin_count[sah_bins] = { 0 };
+			aabb bin_box[sah_bins];
+			auto axis_min = centroids.get_min()[axis];
+			auto bin_scale = sah_bins / extent[axis];
+			auto bin_of = [&](const build_item& item)
+			{
+				int b = static_cast<int>((item.centroid[axis] - axis_min) * bin_scale);
+				return b < sah_bins ? b : sah_bins - 1;
+			};
+			for (size_t i = start; i < end; ++i)
+			{
+				int b = bin_of(items[i]);
+				bin_box[b] = bin_count[b] == 0 ? items[i].box : surrounding_box(bin_box[b], items[i].box);
+				++bin_count[b];
+			}
+
+			double right_area[sah_bins];
+			int right_count[sah_bins];
+			aabb acc;
+			int n = 0;
+			for (int b = sah_bins - 1; b > 0; --b)
+			{
+				if (bin_count[b] > 0)
+				{
+					acc = n == 0 ? bin_box[b] : surrounding_box(acc, bin_box[b]);
+					n += bin_count[b];
+				}
+				right_area[b] = n == 0 ? 0 : box_area(acc);
+				right_count[b] = n;
+			}
+
+			int best_split = -1;
+			double best_cost = infinity;
+			n = 0;
+			for (int b = 0; b < sah_bins - 1 && depth < max_sah_depth; ++b)
+			{
+				if (bin_count[b] > 0)
+				{
+					acc = n == 0 ? bin_box[b] : surrounding_box(acc, bin_box[b]);
+					n += bin_count[b];
+				}
+				if (n == 0 || right_count[b + 1] == 0)
+				{
+					continue;
+				}
+				double cost = n * box_area(acc) + right_count[b + 1] * right_area[b + 1];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_split = b;
+				}
+			}
+
+			if (best_split < 0)
+			{
+				std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+					[axis](const build_item& a, const build_item& b) { return a.centroid[axis] < b.centroid[axis]; });
+			}
+			else
+			{
+				auto it = std::partition(items.begin() + start, items.begin() + end,
+					[&](const build_item& item) { return bin_of(item) <= best_split; });
+				mid = it - items.begin();
+			}
+		}
+
+		build(items, start, mid, depth + 1);
+		auto right = build(items, mid, end, depth + 1);
+		nodes[node_index].offset = right;
+		nodes[node_index].count = 0;
+		nodes[node_index].axis = static_cast<uint16_t>(axis);
+		return node_index;
+	}
+
+	//the children are found by opening the interior child of largest area until there are four
+	uint32_t compiled_scene::widen(uint32_t node_index)
+	{
+		uint32_t children[4] = { node_index };
+		int count = 1;
+		if (nodes[node_index].count == 0)
+		{
+			children[0] = node_index + 1;
+			children[1] = nodes[node_index].offset;
+			count = 2;
+		}
+		while (count < 4)
+		{
+			int best = -1;
+			double best_area = -1;
+			for (int c = 0; c < count; ++c)
+			{
+				if (nodes[children[c]].count == 0 && box_area(nodes[children[c]].box) > best_area)
+				{
+					best = c;
+					best_area = box_area(nodes[children[c]].box);
+				}
+			}
+			if (best < 0)
+			{
+				break;
+			}
+			auto opened = children[best];
+			children[best] = opened + 1;
+			children[count++] = nodes[opened].offset;
+		}
+
+		wide_bvh_node wide;
+		memset(&wide, 0, sizeof(wide));
+		wide.child_count = static_cast<uint8_t>(count);
+		const aabb& box = nodes[node_index].box;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			int exponent;
+			quantization_grid(box.get_min()[axis], box.get_max()[axis], wide.origin[axis], exponent);
+			wide.exponent[axis] = static_cast<int8_t>(exponent);
+			for (int c = 0; c < count; ++c)
+			{
+				const aabb& child = nodes[children[c]].box;
+				quantize_bounds(child.get_min()[axis], child.get_max()[axis], wide.origin[axis], exponent, wide.lo[axis][c], wide.hi[axis][c]);
+			}
+		}
+
+		auto wide_index = static_cast<uint32_t>(wide_nodes.size());
+		wide_nodes.push_back(wide);
+		for (int c = 0; c < count; ++c)
+		{
+			const flat_bvh_node& child = nodes[children[c]];
+			auto packed = child.count > 0 ? child.offset : widen(children[c]);
+			wide_nodes[wide_index].child[c] = packed;
+			wide_nodes[wide_index].leaf_count[c] = child.count;
+		}
+		return wide_index;
+	}
+
+	bool compiled_scene::intersect(const ray& r, double t_min, double t_max, hit_query& query) const
+	{
+		if (wide_nodes.empty() == true)
+		{
+			return false;
+		}
+		return intersect_node(root, r, t_min, t_max, query);
+	}
+
+	bool compiled_scene::hit(const ray& r, const double t_min, const double t_max, hit_record& rec, hit_detail* detail) const
+	{
+		hit_query query;
+		if (intersect(r, t_min, t_max, query) == false)
+		{
+			return false;
+		}
+		interact(r, query, rec, detail);
+		return true;
+	}
+
+	bool compiled_scene::bounding_box(aabb& output_box) const
+	{
+		if (wide_nodes.empty() == true)
+		{
+			return false;
+		}
+		output_box = scene_box;
+		return true;
+	}
+
+	bool compiled_scene::intersect_node(uint32_t node_index, const ray& r, double t_min, double t_max, hit_query& query,
+		medium_crossings* crossings) const
+	{
+		const double origin[3] = { r.get_origin().x(), r.get_origin().y(), r.get_origin().z() };
+		const double inv_dir[3] = { 1 / r.get_direction().x(), 1 / r.get_direction().y(), 1 / r.get_direction().z() };
+
+		wide_entry stack[max_wide_stack_depth];
+		int top = 0;
+		bool is_hitted = false;
+		wide_entry current = { node_index, 0, t_min };
+
+		while (true)
+		{
+			if (current.leaf_count > 0)
+			{
+				for (uint32_t i = current.index; i < current.index + current.leaf_count; ++i)
+				{
+					if (intersect_prim(i, r, t_min, t_max, query, crossings) == true)
+					{
+						is_hitted = true;
+						t_max = query.t;
+					}
+				}
+			}
+			else
+			{
+				const wide_bvh_node& node = wide_nodes[current.index];
+				double t_near[4];
+				int mask = hit_children(node, origin, inv_dir, t_min, t_max, t_near);
+				if (mask != 0)
+				{
+					//the children hit, nearest first; the nearest is visited now, the rest pushed farthest first
+					wide_entry hit[4];
+					int count = 0;
+					for (int c = 0; c < 4; ++c)
+					{
+						if ((mask >> c & 1) != 0)
+						{
+							wide_entry e = { node.child[c], node.leaf_count[c], t_near[c] };
+							int j = count++;
+							for (; j > 0 && hit[j - 1].t > e.t; --j)
+							{
+								hit[j] = hit[j - 1];
+							}
+							hit[j] = e;
+						}
+					}
+					for (int j = count - 1; j > 0; --j)
+					{
+						stack[top++] = hit[j];
+					}
+					current = hit[0];
+					continue;
+				}
+			}
+
+			//children entered beyond the closest hit found since they were pushed are skipped
+			do
+			{
+				if (top == 0)
+				{
+					return is_hitted;
+				}
+				current = stack[--top];
+			} while (current.t > t_max);
+		}
+	}
+
+	bool compiled_scene::occluded(const ray& r, double t_min, double t_max) const
+	{
+		if (wide_nodes.empty() == true)
+		{
+			return false;
+		}
+		return occluded_node(root, r, t_min, t_max);
+	}
+
+	//the segment between two points, shortened at both ends to step off the surfaces
+	bool compiled_scene::visible(const vec3& p0, const vec3& p1, double time) const
+	{
+		return occluded(ray(p0, p1 - p0, time), 0.001, 0.999) == false;
+	}
+
+	bool compiled_scene::trace(const ray& r, double t_min, double t_max, hit_record& rec, medium_crossings& crossings, hit_detail* detail) const
+	{
+		hit_query query;
+		crossings.count = 0;
+		bool is_hitted = wide_nodes.empty() == false && intersect_node(root, r, t_min, t_max, query, &crossings) == true;
+		if (is_hitted == true)
+		{
+			interact(r, query, rec, detail);
+			t_max = query.t;
+		}
+
+		//media were walked as far as the closest hit known when they were reached: drop what lies
+		//past the final one and put the rest in order
+		const double t_end = is_hitted == true ? t_max - interface_nudge : t_max;
+		int kept = 0;
+		for (int i = 0; i < crossings.count; ++i)
+		{
+			if (crossings.t[i] < t_end)
+			{
+				auto t = crossings.t[i];
+				auto id = crossings.medium[i];
+				int j = kept++;
+				for (; j > 0 && crossings.t[j - 1] > t; --j)
+				{
+					crossings.t[j] = crossings.t[j - 1];
+					crossings.medium[j] = crossings.medium[j - 1];
+				}
+				crossings.t[j] = t;
+				crossings.medium[j] = id;
+			}
+		}
+		crossings.count = kept;
+		return is_hitted;
+	}
+
+	//what holds a point does not depend on the direction, so a ray starting where and when the last
+	//one did takes its media over instead of counting crossings again; boundaries that move are at
+	//the same place only at the same time
+	void compiled_scene::find_media(const ray& r, double t_min, active_media& active) const
+	{
+		media_at_point& last = last_media_found;
+		auto point = r.at(t_min);
+		if (last.scene == id && last.time == r.get_time() && (last.point - point).length_squared() == 0)
+		{
+			active = last.active;
+			return;
+		}
+
+		double t[max_boundary_crossings];
+		active.count = 0;
+		for (size_t i = 0; i < media.size(); ++i)
+		{
+			//nothing outside the bounds needs its crossings counted
+			if (media[i].bounds.contains(media[i].to_world.point_to_local(point)) == true
+				&& boundary_crossings(media[i], r, t_min, infinity, t) % 2 == 1)
+			{
+				active.enter(static_cast<uint32_t>(i));
+			}
+		}
+		last.scene = id;
+		last.point = point;
+		last.time = r.get_time();
+		last.active = active;
+	}
+
+	//the two directions are compared against the boundary normal there, whichever way it faces
+	void compiled_scene::cross_at_surface(const vec3& incoming, const ray& r, active_media& active) const
+	{
+		for (size_t i = 0; i < media.size(); ++i)
+		{
+			const medium_prim& m = media[i];
+			ray local = to_medium(m, r);
+			hit_query boundary;
+			if (m.bounds.contains(local.get_origin()) == false
+				|| intersect_node(m.root, local, -interface_window, interface_window, boundary) == false)
+			{
+				continue;
+			}
+			hit_record rec;
+			interact(local, boundary, rec);
+			if ((dot(m.to_world.vector_to_local(incoming), rec.normal) > 0) != (dot(local.get_direction(), rec.normal) > 0))
+			{
+				continue;
+			}
+
+			auto id = static_cast<uint32_t>(i);
+			if (active.contains(id) == true)
+			{
+				active.exit(id);
+			}
+			else
+			{
+				active.enter(id);
+			}
+		}
+	}
+
+	double compiled_scene::draw_collision(uint32_t id, const ray& r, double t_from) const
+	{
+		return t_from + media[id].neg_inv_density * log(random_double()) / r.get_direction().length();
+	}
+
+	//a collision only bounds the search when no boundary of its medium comes first
+	double compiled_scene::draw_collisions(active_media& active, const ray& r, double t_min, uint32_t& bounding) const
+	{
+		auto t_bound = infinity;
+		bounding = no_medium;
+		for (int i = 0; i < active.count; ++i)
+		{
+			active.collisions[i] = draw_collision(active.ids[i], r, 0);
+			if (active.collisions[i] < t_bound)
+			{
+				const medium_prim& m = media[active.ids[i]];
+				hit_query boundary;
+				if (intersect_node(m.root, to_medium(m, r), t_min, active.collisions[i], boundary) == false)
+				{
+					t_bound = active.collisions[i];
+					bounding = active.ids[i];
+				}
+			}
+		}
+		return t_bound;
+	}
+
+	void compiled_scene::medium_interaction(uint32_t id, const ray& r, double t, hit_record& rec) const
+	{
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.normal = vec3(0, 0, 0);
+		rec.front_face = true;
+		rec.u = rec.v = 0;
+		rec.mat_id = media[id].phase_function;
+		rec.light_id = no_light;
+	}
+
+	bool compiled_scene::occluded(const ray& r, double t_min, double t_max, const active_media& active, double& transmittance) const
+	{
+		transmittance = 1;
+		//the media around the start first, a shadow ray that scatters in them needs no traversal
+		if (scatters(active, 0, active, r, t_min, t_max) == true)
+		{
+			return true;
+		}
+		active_media crossed = active;
+		if (wide_nodes.empty() == false && occluded_node(root, r, t_min, t_max, &crossed, &transmittance) == true)
+		{
+			return true;
+		}
+		//then those the segment runs into, gathered by the traversal after the ones it started in
+		return crossed.count > active.count && scatters(crossed, active.count, active, r, t_min, t_max) == true;
+	}
+
+	bool compiled_scene::sample_light(const vec3& x, const vec3& n, double time, light_sample& ls) const
+	{
+		return sample_light(x, n, time, selection, ls);
+	}
+
+	bool compiled_scene::sample_light(const vec3& x, const vec3& n, double time, light_selection mode, light_sample& ls) const
+	{
+		if (lights.empty() == true)
+		{
+			return false;
+		}
+
+		uint32_t index;
+		double pmf;
+		if (mode == select_light_tree)
+		{
+			if (tree.sample(x, n, index, pmf) == false)
+			{
+				return false;
+			}
+		}
+		else if (mode == select_power)
+		{
+			auto found = std::upper_bound(power_cdf.begin(), power_cdf.end(), sample_1d(dim_light_select));
+			index = static_cast<uint32_t>(std::min(static_cast<size_t>(found - power_cdf.begin()), lights.size() - 1));
+			pmf = power_pmf(index);
+		}
+		else
+		{
+			index = static_cast<uint32_t>(std::min(static_cast<size_t>(sample_1d(dim_light_select) * lights.size()), lights.size() - 1));
+			pmf = 1.0 / lights.size();
+		}
+		const light_prim& light = lights[index];
+		const material& mat = registry.get_material(light.mat_id);
+		double u, v;
+		vec3 normal;
+		double s0, s1;
+		sample_2d(dim_light, s0, s1);
+
+		if (light.type == prim_sphere || light.type == prim_moving_sphere)
+		{
+			vec3 center;
+			double radius;
+			light_sphere(light, time, center, radius);
+
+			vec3 to_center = center - x;
+			auto dist_squared = to_center.length_squared();
+			if (dist_squared <= radius * radius)
+			{
+				//from inside, a uniform point on the whole surface
+				normal = unit_vector(sphere_direction(s0, s1));
+				ls.p = center + normal * radius;
+				ls.wi = ls.p - x;
+				ls.dist = ls.wi.length();
+				ls.wi /= ls.dist;
+				auto cosine = std::fabs(dot(normal, ls.wi));
+				if (cosine <= 0)
+				{
+					return false;
+				}
+				ls.pdf = ls.dist * ls.dist / (cosine * light.area);
+			}
+			else
+			{
+				//from outside, a uniform direction inside the cone the sphere subtends
+				auto cos_theta_max = sqrt(1 - radius * radius / dist_squared);
+				auto cos_theta = 1 + s0 * (cos_theta_max - 1);
+				auto sin_theta = sqrt(ffmax(0.0, 1 - cos_theta * cos_theta));
+				auto phi = 2 * pi * s1;
+
+				double sine, cosine;
+				math::sincos(phi, sine, cosine);
+				ls.wi = onb(to_center).local(cosine * sin_theta, sine * sin_theta, cos_theta);
+
+				//nearest intersection of that direction with the sphere
+				auto dist_center = sqrt(dist_squared);
+				auto half_chord_squared = radius * radius - dist_squared * sin_theta * sin_theta;
+				ls.dist = dist_center * cos_theta - sqrt(ffmax(0.0, half_chord_squared));
+				ls.p = x + ls.wi * ls.dist;
+				normal = (ls.p - center) / radius;
+				ls.pdf = 1 / (2 * pi * (1 - cos_theta_max));
+			}
+			get_sphere_uv(light.to_world.vector_to_local(normal), u, v);
+		}
+		else
+		{
+			u = s0;
+			v = s1;
+			rect_point(light, u, v, ls.p, normal);
+
+			ls.wi = ls.p - x;
+			ls.dist = ls.wi.length();
+			ls.wi /= ls.dist;
+			//diffus_light emits from both sides
+			auto cosine = std::fabs(dot(normal, ls.wi));
+			if (cosine <= 0)
+			{
+				return false;
+			}
+			ls.pdf = ls.dist * ls.dist / (cosine * light.area);
+		}
+
+		ls.pdf *= pmf;
+		ls.normal = normal;
+		ls.radiance = mat.emitted(u, v, ls.p);
+		return true;
+	}
+
+	bool compiled_scene::sample_emission(int photon_count, emission_sample& es) const
+	{
+		if (lights.empty() == true)
+		{
+			return false;
+		}
+
+		auto found = std::upper_bound(power_cdf.begin(), power_cdf.end(), random_double());
+		auto index = static_cast<uint32_t>(std::min(static_cast<size_t>(found - power_cdf.begin()), lights.size() - 1));
+		const light_prim& light = lights[index];
+		const material& mat = registry.get_material(light.mat_id);
+		auto time = random_double(time0, time1);
+
+		double u, v;
+		vec3 p, normal;
+		double sides = 1;
+		if (light.type == prim_sphere || light.type == prim_moving_sphere)
+		{
+			vec3 center;
+			double radius;
+			light_sphere(light, time, center, radius);
+			normal = unit_vector(sphere_direction(random_double(), random_double()));
+			p = center + normal * radius;
+			get_sphere_uv(light.to_world.vector_to_local(normal), u, v);
+		}
+		else
+		{
+			u = random_double();
+			v = random_double();
+			rect_point(light, u, v, p, normal);
+			//diffus_light emits from both sides
+			sides = 2;
+			if (random_double() < 0.5)
+			{
+				normal = -normal;
+			}
+		}
+
+		//cosine weighted about the normal, so the emitted radiance times pi is the power per area
+		auto direction = normal + sphere_direction(random_double(), random_double());
+		if (direction.length_squared() < 1e-12)
+		{
+			direction = normal;
+		}
+		es.r = ray(p, unit_vector(direction), time);
+		es.power = mat.emitted(u, v, p) * (pi * light.area * sides / (power_pmf(index) * photon_count));
+		return true;
+	}
+
+	double compiled_scene::light_pdf(const vec3& x, const vec3& n, double time, const hit_record& rec) const
+	{
+		if (rec.light_id == no_light)
+		{
+			return 0;
+		}
+
+		const light_prim& light = lights[rec.light_id];
+		if (light.type == prim_sphere || light.type == prim_moving_sphere)
+		{
+			vec3 center;
+			double radius;
+			light_sphere(light, time, center, radius);
+			auto dist_squared = (center - x).length_squared();
+			if (dist_squared > radius * radius)
+			{
+				auto cos_theta_max = sqrt(1 - radius * radius / dist_squared);
+				return selection_pmf(x, n, rec.light_id) / (2 * pi * (1 - cos_theta_max));
+			}
+		}
+
+		//area density converted to solid angle, for rects and for spheres seen from inside
+		vec3 d = rec.p - x;
+		auto dist_squared = d.length_squared();
+		auto cosine = std::fabs(dot(rec.normal, d)) / sqrt(dist_squared);
+		if (cosine <= 0)
+		{
+			return 0;
+		}
+		return selection_pmf(x, n, rec.light_id) * dist_squared / (cosine * light.area);
+	}
+
+	double compiled_scene::selection_pmf(const vec3& x, const vec3& n, uint32_t light) const
+	{
+		switch (selection)
+		{
+		case select_light_tree:
+			return tree.pmf(x, n, light);
+		case select_power:
+			return power_pmf(light);
+		default:
+			return 1.0 / lights.size();
+		}
+	}
+
+	double compiled_scene::power_pmf(uint32_t light) const
+	{
+		return power_cdf[light] - (light > 0 ? power_cdf[light - 1] : 0);
+	}
+
+	//world space box, power and emission cone of one light for the light tree
+	light_bounds compiled_scene::bound_light(const light_prim& light) const
+	{
+		light_bounds b;
+		const material& mat = registry.get_material(light.mat_id);
+		vec3 center;
+
+		if (light.type == prim_sphere || light.type == prim_moving_sphere)
+		{
+			double radius;
+			vec3 r;
+			light_sphere(light, time0, center, radius);
+			r = vec3(radius, radius, radius);
+			b.box = aabb(center - r, center + r);
+			if (light.type == prim_moving_sphere)
+			{
+				vec3 center1;
+				light_sphere(light, time1, center1, radius);
+				b.box = surrounding_box(b.box, aabb(center1 - r, center1 + r));
+			}
+			//normals in every direction, each emitting over its hemisphere
+			b.axis = vec3(0, 0, 1);
+			b.cos_theta_o = -1;
+			b.two_sided = false;
+		}
+		else
+		{
+			const rect_prim& rect = rects[light.index];
+			vec3 corners[2];
+			vec3 normal;
+			switch (light.type)
+			{
+			case prim_xy_rect:
+				corners[0] = vec3(rect.a0, rect.b0, rect.k);
+				corners[1] = vec3(rect.a1, rect.b1, rect.k);
+				normal = vec3(0, 0, 1);
+				break;
+			case prim_xz_rect:
+				corners[0] = vec3(rect.a0, rect.k, rect.b0);
+				corners[1] = vec3(rect.a1, rect.k, rect.b1);
+				normal = vec3(0, 1, 0);
+				break;
+			default:
+				corners[0] = vec3(rect.k, rect.a0, rect.b0);
+				corners[1] = vec3(rect.k, rect.a1, rect.b1);
+				normal = vec3(1, 0, 0);
+				break;
+			}
+
+			//the world box of all eight corner combinations, only four of them are distinct
+			vec3 p = light.to_world.point_to_world(corners[0]);
+			b.box = aabb(p, p);
+			for (int i = 1; i < 8; ++i)
+			{
+				p = light.to_world.point_to_world(vec3(corners[i & 1].x(), corners[(i >> 1) & 1].y(), corners[(i >> 2) & 1].z()));
+				b.box = surrounding_box(b.box, aabb(p, p));
+			}
+			center = (b.box.get_min() + b.box.get_max()) * 0.5;
+			b.axis = light.to_world.vector_to_world(normal);
+			b.cos_theta_o = 1;
+			b.two_sided = true;
+		}
+
+		//diffuse emission, pi * radiance * area per emitting side
+		vec3 radiance = mat.emitted(0.5, 0.5, center);
+		b.power = pi * light.area * (radiance.x() + radiance.y() + radiance.z()) / 3 * (b.two_sided == true ? 2 : 1);
+		b.cos_theta_e = 0;
+		return b;
+	}
+
+	//world space point at (u, v) of a rect light, and its normal
+	void compiled_scene::rect_point(const light_prim& light, double u, double v, vec3& p, vec3& normal) const
+	{
+		const rect_prim& rect = rects[light.index];
+		auto a = rect.a0 + u * (rect.a1 - rect.a0);
+		auto b = rect.b0 + v * (rect.b1 - rect.b0);
+
+		vec3 local;
+		switch (light.type)
+		{
+		case prim_xy_rect:
+			local = vec3(a, b, rect.k);
+			normal = vec3(0, 0, 1);
+			break;
+		case prim_xz_rect:
+			local = vec3(a, rect.k, b);
+			normal = vec3(0, 1, 0);
+			break;
+		default:
+			local = vec3(rect.k, a, b);
+			normal = vec3(1, 0, 0);
+			break;
+		}
+		p = light.to_world.point_to_world(local);
+		normal = light.to_world.vector_to_world(normal);
+	}
+
+	//world space center and radius of a spherical light at the given time
+	void compiled_scene::light_sphere(const light_prim& light, double time, vec3& center, double& radius) const
+	{
+		if (light.type == prim_sphere)
+		{
+			center = spheres[light.index].center;
+			radius = spheres[light.index].radius;
+		}
+		else
+		{
+			const moving_sphere_prim& s = moving_spheres[light.index];
+			center = s.center0 + s.velocity * (time - s.time0);
+			radius = s.radius;
+		}
+		center = light.to_world.point_to_world(center);
+	}
+
+	bool compiled_scene::occluded_node(uint32_t node_index, const ray& r, double t_min, double t_max, active_media* crossed,
+		double* transmittance) const
+	{
+		const double origin[3] = { r.get_origin().x(), r.get_origin().y(), r.get_origin().z() };
+		const double inv_dir[3] = { 1 / r.get_direction().x(), 1 / r.get_direction().y(), 1 / r.get_direction().z() };
+
+		wide_entry stack[max_wide_stack_depth];
+		int top = 0;
+		double t;
+		wide_entry current = { node_index, 0, t_min };
+
+		while (true)
+		{
+			if (current.leaf_count > 0)
+			{
+				for (uint32_t i = current.index; i < current.index + current.leaf_count; ++i)
+				{
+					const prim_ref& ref = refs[i];
+					bool is_hitted = false;
+					switch (ref.type)
+					{
+					case prim_sphere:
+						is_hitted = intersect_sphere(spheres[ref.index].center, spheres[ref.index].radius, r, t_min, t_max, t);
+						break;
+					case prim_moving_sphere:
+					{
+						const moving_sphere_prim& s = moving_spheres[ref.index];
+						is_hitted = intersect_sphere(s.center0 + s.velocity * (r.get_time() - s.time0), s.radius, r, t_min, t_max, t);
+						break;
+					}
+					case prim_xy_rect:
+						is_hitted = intersect_rect<2, 0, 1>(rects[ref.index], r, t_min, t_max, t);
+						break;
+					case prim_xz_rect:
+						is_hitted = intersect_rect<1, 0, 2>(rects[ref.index], r, t_min, t_max, t);
+						break;
+					case prim_yz_rect:
+						is_hitted = intersect_rect<0, 1, 2>(rects[ref.index], r, t_min, t_max, t);
+						break;
+					case prim_medium:
+						if (crossed != nullptr)
+						{
+							crossed->enter(ref.index);
+							break;
+						}
+						is_hitted = intersect_medium(media[ref.index], r, t_min, t_max, t);
+						break;
+					case prim_grid_medium:
+						if (transmittance != nullptr)
+						{
+							*transmittance *= grid_media[ref.index].grid->transmittance(r, t_min, t_max);
+							is_hitted = *transmittance <= 0;
+							break;
+						}
+						is_hitted = grid_media[ref.index].grid->sample_collision(r, t_min, t_max, t);
+						break;
+					case prim_translate:
+					case prim_rotate_y:
+						is_hitted = occluded_node(instance_root(ref), to_local(ref, r), t_min, t_max, crossed, transmittance);
+						break;
+					}
+					if (is_hitted == true)
+					{
+						return true;
+					}
+				}
+			}
+			else
+			{
+				//any order works, nothing shrinks t_max
+				const wide_bvh_node& node = wide_nodes[current.index];
+				double t_near[4];
+				int mask = hit_children(node, origin, inv_dir, t_min, t_max, t_near);
+				for (int c = 0; c < 4; ++c)
+				{
+					if ((mask >> c & 1) != 0)
+					{
+						stack[top++] = { node.child[c], node.leaf_count[c], t_near[c] };
+					}
+				}
+			}
+
+			if (top == 0)
+			{
+				break;
+			}
+			current = stack[--top];
+		}
+
+		return false;
+	}
+
+	//a primitive hit resets the instance path, every enclosing transform appends itself on the way out
+	bool compiled_scene::intersect_prim(uint32_t ref_index, const ray& r, double t_min, double t_max, hit_query& query,
+		medium_crossings* crossings) const
+	{
+		const prim_ref& ref = refs[ref_index];
+		double t;
+		bool is_hitted = false;
+
+		switch (ref.type)
+		{
+		case prim_sphere:
+		{
+			const sphere_prim& s = spheres[ref.index];
+			is_hitted = intersect_sphere(s.center, s.radius, r, t_min, t_max, t);
+			break;
+		}
+		case prim_moving_sphere:
+		{
+			const moving_sphere_prim& s = moving_spheres[ref.index];
+			is_hitted = intersect_sphere(s.center0 + s.velocity * (r.get_time() - s.time0), s.radius, r, t_min, t_max, t);
+			break;
+		}
+		case prim_xy_rect:
+			is_hitted = intersect_rect<2, 0, 1>(rects[ref.index], r, t_min, t_max, t);
+			break;
+		case prim_xz_rect:
+			is_hitted = intersect_rect<1, 0, 2>(rects[ref.index], r, t_min, t_max, t);
+			break;
+		case prim_yz_rect:
+			is_hitted = intersect_rect<0, 1, 2>(rects[ref.index], r, t_min, t_max, t);
+			break;
+		case prim_medium:
+		{
+			if (crossings == nullptr)
+			{
+				is_hitted = intersect_medium(media[ref.index], r, t_min, t_max, t);
+				break;
+			}
+			if (ref.index == crossings->known_clear)
+			{
+				return false;
+			}
+			//r is already in the medium's space here
+			hit_query boundary;
+			auto from = t_min;
+			while (intersect_node(media[ref.index].root, r, from, t_max, boundary) == true && crossings->count < max_medium_crossings)
+			{
+				crossings->add(boundary.t, ref.index);
+				from = past_crossing(media[ref.index], r, boundary.t);
+			}
+			return false;
+		}
+		case prim_grid_medium:
+			//a collision is a hit like any other, the closest one wins
+			is_hitted = grid_media[ref.index].grid->sample_collision(r, t_min, t_max, t);
+			break;
+		case prim_translate:
+		case prim_rotate_y:
+			if (intersect_node(instance_root(ref), to_local(ref, r), t_min, t_max, query, crossings) == false)
+			{
+				return false;
+			}
+			//enter_instance kept the nesting within the room
+			query.instances[query.depth++] = ref_index;
+			return true;
+		}
+
+		if (is_hitted == true)
+		{
+			query.t = t;
+			query.prim = ref_index;
+			query.depth = 0;
+		}
+		return is_hitted;
+	}
+
+	uint32_t compiled_scene::instance_root(const prim_ref& ref) const
+	{
+		return ref.type == prim_translate ? translates[ref.index].root : rotations[ref.index].root;
+	}
+
+	ray compiled_scene::to_local(const prim_ref& ref, const ray& r) const
+	{
+		if (ref.type == prim_translate)
+		{
+			return ray(r.get_origin() - translates[ref.index].offset, r.get_direction(), r.get_time());
+		}
+		const rotate_y_prim& rot = rotations[ref.index];
+		return ray(rotate_to_local(rot, r.get_origin()), rotate_to_local(rot, r.get_direction()), r.get_time());
+	}
+
+	//builds the full record for the closest hit only: position, normal, uv and material
+	void compiled_scene::interact(const ray& r, const hit_query& query, hit_record& rec, hit_detail* detail) const
+	{
+		//walk the transforms from the outermost one down to the primitive's space
+		ray local = r;
+		for (int d = static_cast<int>(query.depth) - 1; d >= 0; --d)
+		{
+			local = to_local(refs[query.instances[d]], local);
+		}
+
+		const prim_ref& ref = refs[query.prim];
+		hit_detail unused;
+		hit_detail& out = detail != nullptr ? *detail : unused;
+		out.velocity = vec3(0, 0, 0);
+		out.uv_per_unit = 0;
+		switch (ref.type)
+		{
+		case prim_sphere:
+		{
+			const sphere_prim& s = spheres[ref.index];
+			sphere_interaction(s.center, s.radius, s.mat_id, s.light, local, query.t, rec);
+			out.uv_per_unit = sphere_uv_per_unit(s.radius);
+			break;
+		}
+		case prim_moving_sphere:
+		{
+			const moving_sphere_prim& s = moving_spheres[ref.index];
+			sphere_interaction(s.center0 + s.velocity * (local.get_time() - s.time0), s.radius, s.mat_id, s.light, local, query.t, rec);
+			out.uv_per_unit = sphere_uv_per_unit(s.radius);
+			out.velocity = s.velocity;
+			break;
+		}
+		case prim_xy_rect:
+		case prim_xz_rect:
+		case prim_yz_rect:
+		{
+			const rect_prim& rect = rects[ref.index];
+			if (ref.type == prim_xy_rect)
+			{
+				rect_interaction<2, 0, 1>(rect, local, query.t, rec);
+			}
+			else if (ref.type == prim_xz_rect)
+			{
+				rect_interaction<1, 0, 2>(rect, local, query.t, rec);
+			}
+			else
+			{
+				rect_interaction<0, 1, 2>(rect, local, query.t, rec);
+			}
+			out.uv_per_unit = 1 / sqrt((rect.a1 - rect.a0) * (rect.b1 - rect.b0));
+			break;
+		}
+		case prim_medium:
+			rec.t = query.t;
+			rec.p = local.at(query.t);
+			//media have no surface
+			rec.normal = vec3(0, 0, 0);
+			rec.front_face = true;
+			rec.u = rec.v = 0;
+			rec.mat_id = media[ref.index].phase_function;
+			rec.light_id = no_light;
+			break;
+		case prim_grid_medium:
+			rec.t = query.t;
+			rec.p = local.at(query.t);
+			rec.normal = vec3(0, 0, 0);
+			rec.front_face = true;
+			rec.u = rec.v = 0;
+			rec.mat_id = grid_media[ref.index].phase_function;
+			rec.light_id = no_light;
+			break;
+		}
+
+		//and back out; translation and rotation both keep the side the ray came from
+		for (uint32_t d = 0; d < query.depth; ++d)
+		{
+			const prim_ref& inst = refs[query.instances[d]];
+			if (inst.type == prim_translate)
+			{
+				rec.p += translates[inst.index].offset;
+			}
+			else
+			{
+				rec.p = rotate_to_world(rotations[inst.index], rec.p);
+				rec.normal = rotate_to_world(rotations[inst.index], rec.normal);
+				out.velocity = rotate_to_world(rotations[inst.index], out.velocity);
+			}
+		}
+	}
+
+	int compiled_scene::boundary_crossings(const medium_prim& m, const ray& r, double t_min, double t_max, double* t) const
+	{
+		ray local = to_medium(m, r);
+		hit_query query;
+		int n = 0;
+		while (n < max_boundary_crossings && intersect_node(m.root, local, t_min, t_max, query) == true)
+		{
+			t[n++] = query.t;
+			t_min = past_crossing(m, local, query.t);
+		}
+		return n;
+	}
+
+	bool compiled_scene::scatters(const active_media& listed, int first, const active_media& active, const ray& r, double t_min, double t_max) const
+	{
+		double t[max_boundary_crossings];
+		double optical_depth = 0;
+		for (int i = first; i < listed.count; ++i)
+		{
+			const medium_prim& m = media[listed.ids[i]];
+			auto n = boundary_crossings(m, r, t_min, t_max, t);
+			auto inside = active.contains(listed.ids[i]);
+			auto t_prev = t_min, length = 0.0;
+			for (int k = 0; k < n; ++k)
+			{
+				if (inside == true)
+				{
+					length += t[k] - t_prev;
+				}
+				inside = !inside;
+				t_prev = t[k];
+			}
+			if (inside == true)
+			{
+				length += t_max - t_prev;
+			}
+			optical_depth -= length / m.neg_inv_density;
+		}
+		return optical_depth > 0 && random_double() >= exp(-optical_depth * r.get_direction().length());
+	}
+
+	ray compiled_scene::to_medium(const medium_prim& m, const ray& r) const
+	{
+		return ray(m.to_world.point_to_local(r.get_origin()), m.to_world.vector_to_local(r.get_direction()), r.get_time());
+	}
+
+	//constant_medium::hit against the compiled boundary, returns the sampled scattering distance
+	//the boundary is convex as there, so a ray starting outside its bounds enters ahead of t_min if at all
+	//and only one starting inside needs the entry behind it searched for
+	bool compiled_scene::intersect_medium(const medium_prim& m, const ray& r, double t_min, double t_max, double& t) const
+	{
+		hit_query q1, q2;
+		auto from = m.bounds.contains(r.at(t_min)) == true ? -infinity : t_min;
+		if (intersect_node(m.root, r, from, t_max, q1) == false)
+		{
+			return false;
+		}
+		if (intersect_node(m.root, r, past_crossing(m, r, q1.t), infinity, q2) == false)
+		{
+			return false;
+		}
+
+		auto t1 = q1.t, t2 = q2.t;
+		if (t1 < t_min) t1 = t_min;
+		if (t2 > t_max) t2 = t_max;
+		if (t1 >= t2) return false;
+		if (t1 < 0) t1 = 0;
+
+		const auto ray_length = r.get_direction().length();
+		const auto distance_inside_boundary = (t2 - t1) * ray_length;
+		const auto hit_distance = m.neg_inv_density * log(random_double());
+		if (hit_distance > distance_inside_boundary)
+		{
+			return false;
+		}
+
+		t = t1 + hit_distance / ray_length;
+		return true;
+	}
+}
@@ -0,0 +1,464 @@
+#pragma once
+
+#include<cstdint>
+#include"aabb.h"
+#include"constantAndTool.h"
+#include"hittable.h"
+#include"light_tree.h"
+#include"material.h"
+
+namespace ray_tracing
+{
+	//Every primitive kind the compiled scene knows how to intersect without a virtual call
+	enum prim_type : uint32_t
+	{
+		prim_sphere,
+		prim_moving_sphere,
+		prim_xy_rect,
+		prim_xz_rect,
+		prim_yz_rect,
+		prim_translate,
+		prim_rotate_y,
+		prim_medium,
+		prim_grid_medium
+	};
+
+	//a bvh leaf entry: the type tag selects the array, the index selects the element
+	struct prim_ref
+	{
+		uint32_t type;
+		uint32_t index;
+	};
+
+	struct sphere_prim
+	{
+		vec3 center;
+		double radius;
+		uint32_t mat_id;
+		uint32_t light;
+	};
+
+	struct moving_sphere_prim
+	{
+		vec3 center0;
+		vec3 velocity;
+		double time0;
+		double radius;
+		uint32_t mat_id;
+		uint32_t light;
+	};
+
+	//axis-aligned rectangle, a and b are the two in-plane axes, k is the plane offset
+	struct rect_prim
+	{
+		double a0, a1, b0, b1, k;
+		uint32_t mat_id;
+		uint32_t light;		//no_light unless the material emits
+	};
+
+	//translate and rotate_y keep their child as a separate subtree of the same node array
+	struct translate_prim
+	{
+		vec3 offset;
+		uint32_t root;
+	};
+
+	struct rotate_y_prim
+	{
+		double sin_theta;
+		double cos_theta;
+		uint32_t root;
+	};
+
+	//rotation about y followed by a translation, what any chain of translate and rotate_y reduces to
+	struct rigid_transform
+	{
+		double sin_theta = 0;
+		double cos_theta = 1;
+		vec3 offset;
+
+		vec3 vector_to_world(const vec3& v) const
+		{
+			return vec3(cos_theta * v[0] + sin_theta * v[2], v[1], -sin_theta * v[0] + cos_theta * v[2]);
+		}
+		vec3 vector_to_local(const vec3& v) const
+		{
+			return vec3(cos_theta * v[0] - sin_theta * v[2], v[1], sin_theta * v[0] + cos_theta * v[2]);
+		}
+		vec3 point_to_world(const vec3& p) const { return vector_to_world(p) + offset; }
+		vec3 point_to_local(const vec3& p) const { return vector_to_local(p - offset); }
+	};
+
+	//the boundary subtree is in the medium's own space, to_world takes it out
+	struct medium_prim
+	{
+		double neg_inv_density;
+		uint32_t phase_function;
+		uint32_t root;
+		aabb bounds;				//of the boundary, in the medium's space
+		double step;				//how far past a boundary crossing the next one is looked for, scaled to the bounds
+		rigid_transform to_world;
+	};
+
+	class density_grid;
+
+	//heterogeneous media need no tracking: their flights are sampled within each segment they are met on
+	struct grid_medium_prim
+	{
+		shared_ptr<const density_grid> grid;
+		uint32_t phase_function;
+	};
+
+	const int max_active_media = 8;
+
+	//the media a point of a path is inside; they need not nest, so this is a small set
+	struct active_media
+	{
+		uint32_t ids[max_active_media];
+		double collisions[max_active_media];	//where each one's free flight ends on the current ray, see draw_collisions
+		int count = 0;
+
+		bool contains(uint32_t id) const
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				if (ids[i] == id)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		//deeper overlaps than max_active_media are ignored
+		void enter(uint32_t id, double collision = infinity)
+		{
+			if (contains(id) == false && count < max_active_media)
+			{
+				ids[count] = id;
+				collisions[count++] = collision;
+			}
+		}
+
+		void exit(uint32_t id)
+		{
+			for (int i = 0; i < count; ++i)
+			{
+				if (ids[i] == id)
+				{
+					--count;
+					ids[i] = ids[count];
+					collisions[i] = collisions[count];
+					return;
+				}
+			}
+		}
+
+		//the media are independent, so a path collides first at the nearest of their collisions
+		double nearest_collision(int& which) const
+		{
+			auto t = infinity;
+			which = -1;
+			for (int i = 0; i < count; ++i)
+			{
+				if (collisions[i] < t)
+				{
+					t = collisions[i];
+					which = i;
+				}
+			}
+			return t;
+		}
+	};
+
+	//an emissive primitive gathered while lowering, sampled directly by next-event estimation
+	struct light_prim
+	{
+		uint32_t type;		//prim_sphere, prim_moving_sphere or one of the rect types
+		uint32_t index;		//into the array of that type
+		uint32_t mat_id;
+		double area;
+		rigid_transform to_world;
+	};
+
+	//a point chosen on a light as seen from a shading point
+	struct light_sample
+	{
+		vec3 p;
+		vec3 normal;	//of the light at p
+		vec3 wi;		//unit direction from the shading point to p
+		double dist;
+		double pdf;		//solid angle density, including the choice of the light
+		vec3 radiance;
+	};
+
+	//a photon leaving a light
+	struct emission_sample
+	{
+		ray r;
+		vec3 power;		//its share of the light's power, for photon_count of them
+	};
+
+	//how sample_light picks one of the scene's lights
+	enum light_selection
+	{
+		select_uniform,		//every light equally often
+		select_power,		//in proportion to emitted power, the same everywhere and cheap
+		select_light_tree	//by the light tree's estimate of each light's contribution
+	};
+
+	const uint32_t max_instance_depth = 8;
+
+	//result of the cheap closest-hit query: distance, leaf entry and the enclosing transforms
+	struct hit_query
+	{
+		double t;
+		uint32_t prim;		//index into the leaf entries
+		uint32_t depth;		//number of transforms above the primitive
+		uint32_t instances[max_instance_depth];		//their leaf entries, innermost first
+	};
+
+	//what a path may want of its hit besides the record, filled in by interact only when asked for
+	struct hit_detail
+	{
+		vec3 velocity;				//motion of the point per unit of time
+		double uv_per_unit = 0;		//how fast (u, v) runs across the surface, per unit of world length; 0 in media
+	};
+
+	const int max_medium_crossings = 8;
+	const uint32_t no_medium = 0xffffffff;
+
+	//the medium boundaries a ray passes before its closest hit, nearest first
+	struct medium_crossings
+	{
+		double t[max_medium_crossings];
+		uint32_t medium[max_medium_crossings];
+		int count = 0;
+		uint32_t known_clear = no_medium;		//a medium not to walk, its boundary is known not to come before t_max
+
+		//crossings past max_medium_crossings are dropped
+		void add(double crossing, uint32_t id)
+		{
+			if (count < max_medium_crossings)
+			{
+				t[count] = crossing;
+				medium[count++] = id;
+			}
+		}
+	};
+
+	//count == 0 marks an interior node: the left child follows it, offset is the right child
+	//count > 0 marks a leaf: refs[offset, offset + count)
+	//the tree is built in this form and then packed into wide_bvh_nodes, which traversal reads
+	struct flat_bvh_node
+	{
+		aabb box;
+		uint32_t offset;
+		uint16_t count;
+		uint16_t axis;
+	};
+
+	/*
+	Up to four children in one cache line. Each child box is stored as 8 bit steps on a grid over
+	the node's box: the grid starts at origin, a float rounded down from the box, and steps 2^exponent
+	along each axis. Bounds are rounded outward onto the grid and the step is never so fine that
+	origin + q * 2^exponent loses a bit in double, so every decoded box contains the exact one.
+	*/
+	struct alignas(64) wide_bvh_node
+	{
+		float origin[3];
+		int8_t exponent[3];
+		uint8_t child_count;
+		uint8_t lo[3][4];			//per axis, per child
+		uint8_t hi[3][4];
+		uint32_t child[4];			//a wide node, or for a leaf its first ref
+		uint16_t leaf_count[4];		//refs of a leaf, 0 for a wide node
+	};
+
+	//std::allocator only honours alignments up to that of max_align_t before C++17
+	template<typename T>
+	class cache_line_allocator
+	{
+	public:
+		typedef T value_type;
+
+		cache_line_allocator() = default;
+		template<typename U>
+		cache_line_allocator(const cache_line_allocator<U>&) {}
+
+		//the block handed to operator new sits just before the aligned one
+		T* allocate(size_t n)
+		{
+			auto block = static_cast<unsigned char*>(::operator new(n * sizeof(T) + 64 + sizeof(void*)));
+			auto aligned = (reinterpret_cast<uintptr_t>(block) + sizeof(void*) + 63) & ~uintptr_t(63);
+			reinterpret_cast<void**>(aligned)[-1] = block;
+			return reinterpret_cast<T*>(aligned);
+		}
+		void deallocate(T* p, size_t n)
+		{
+			::operator delete(reinterpret_cast<void**>(p)[-1]);
+		}
+
+		template<typename U>
+		bool operator==(const cache_line_allocator<U>&) const { return true; }
+		template<typename U>
+		bool operator!=(const cache_line_allocator<U>&) const { return false; }
+	};
+
+	/*
+	Render-time representation of a scene.
+	The hittable classes stay the authoring API; each of them lowers itself into the
+	type-sorted arrays below through hittable::lower, and one flat bvh is built over the result.
+	Intersection then dispatches with a switch on the leaf type tag so every kernel can be inlined.
+	Materials and textures are owned by the scene's registry and referenced by id.
+	Traversal only records the distance and the primitive (intersect); positions, normals, uvs
+	and materials are evaluated once for the final closest hit (interact).
+	*/
+	class compiled_scene
+	{
+	public:
+		compiled_scene(const hittable& world, double time0, double time1);
+
+		bool intersect(const ray& r, double t_min, double t_max, hit_query& query) const;
+		void interact(const ray& r, const hit_query& query, hit_record& rec, hit_detail* detail = nullptr) const;
+		//intersect followed by interact
+		bool hit(const ray& r, const double t_min, const double t_max, hit_record& rec, hit_detail* detail = nullptr) const;
+		//any-hit query for shadow, ambient occlusion and visibility rays: stops at the first blocker
+		//and never builds a record; media block with the probability of scattering inside the segment
+		bool occluded(const ray& r, double t_min, double t_max) const;
+		bool visible(const vec3& p0, const vec3& p1, double time) const;
+
+		/*
+		Medium tracking, for integrators that follow which media a path is inside.
+		The free flight through homogeneous media does not depend on the geometry, so a path draws
+		it up front (draw_collisions) and traces only as far as the nearest collision it cannot
+		leave the medium before. trace is hit with media left out of the closest hit: their
+		boundaries are walked once up to it and returned in order as crossings, each of which
+		flips its medium, and a medium entered on the way draws its own flight from there.
+		A surface lying on a boundary wins the tie, so whether that boundary is crossed is only
+		known once the path leaves the surface; cross_at_surface settles it there.
+		*/
+		bool trace(const ray& r, double t_min, double t_max, hit_record& rec, medium_crossings& crossings, hit_detail* detail = nullptr) const;
+		//the media holding r's origin, by the parity of each boundary's crossings ahead of t_min;
+		//each thread keeps the last answer for the next ray from the same point at the same time
+		void find_media(const ray& r, double t_min, active_media& active) const;
+		//updates active for the boundaries the surface r leaves lies on: r passes one when it goes
+		//on to the other side from the one the path arrived along incoming from
+		void cross_at_surface(const vec3& incoming, const ray& r, active_media& active) const;
+		//where along r a flight through medium id started at t_from ends, an exponential draw
+		double draw_collision(uint32_t id, const ray& r, double t_from) const;
+		//draws every active medium's flight from 0 and returns how far r needs searching, along with
+		//the medium that stops it, whose boundary is known to lie beyond
+		double draw_collisions(active_media& active, const ray& r, double t_min, uint32_t& bounding) const;
+		//fills rec for a collision with medium id at t
+		void medium_interaction(uint32_t id, const ray& r, double t, hit_record& rec) const;
+		//occluded for tracked paths, active holding r's origin: media block with the probability
+		//of scattering between t_min and t_max, taken from their optical depth; grid media do not
+		//block but multiply transmittance by a ratio tracking estimate of theirs
+		bool occluded(const ray& r, double t_min, double t_max, const active_media& active, double& transmittance) const;
+		size_t medium_count() const { return media.size(); }
+
+		//pick a light and a point on it for the shading point x with normal n (zero inside media),
+		//false when nothing emits toward x
+		bool sample_light(const vec3& x, const vec3& n, double time, light_sample& ls) const;
+		bool sample_light(const vec3& x, const vec3& n, double time, light_selection mode, light_sample& ls) const;
+		//density sample_light would have produced the light surface in rec with, seen from x
+		double light_pdf(const vec3& x, const vec3& n, double time, const hit_record& rec) const;
+		//a light picked by power, a uniform point on it and a cosine weighted direction from there,
+		//drawn from the calling thread's generator
+		bool sample_emission(int photon_count, emission_sample& es) const;
+		size_t light_count() const { return lights.size(); }
+		size_t light_tree_node_count() const { return tree.node_count(); }
+		void set_light_selection(light_selection mode) { selection = mode; }
+		bool bounding_box(aabb& output_box) const;
+
+		const material& get_material(uint32_t id) const { return registry.get_material(id); }
+		const material_registry& get_registry() const { return registry; }
+
+		double get_time0() const { return time0; }
+		double get_time1() const { return time1; }
+		size_t primitive_count() const { return refs.size(); }
+		size_t node_count() const { return wide_nodes.size(); }
+		//bytes of the wide nodes and the refs their leaves point into
+		size_t bvh_bytes() const { return wide_nodes.size() * sizeof(wide_bvh_node) + refs.size() * sizeof(prim_ref); }
+
+		//called by hittable::lower; those taking a material return the id it has in this scene
+		void add(const shared_ptr<hittable>& object);
+		uint32_t add_sphere(const vec3& center, double radius, const shared_ptr<material>& mat);
+		uint32_t add_moving_sphere(const vec3& center0, const vec3& center1, double t0, double t1, double radius, const shared_ptr<material>& mat);
+		uint32_t add_rect(prim_type type, double a0, double a1, double b0, double b1, double k, const shared_ptr<material>& mat);
+		void add_translate(const shared_ptr<hittable>& child, const vec3& offset);
+		void add_rotate_y(const shared_ptr<hittable>& child, double sin_theta, double cos_theta);
+		uint32_t add_medium(const shared_ptr<hittable>& boundary, double neg_inv_density, const shared_ptr<material>& phase_function);
+		uint32_t add_grid_medium(const shared_ptr<const density_grid>& grid, const shared_ptr<material>& phase_function);
+
+	private:
+		struct build_item
+		{
+			prim_ref ref;
+			aabb box;
+			vec3 centroid;
+		};
+
+		double time0, time1;
+		uint32_t root;
+		uint32_t id;		//tells the threads' remembered media of different scenes apart
+		material_registry registry;
+
+		vector<sphere_prim> spheres;
+		vector<moving_sphere_prim> moving_spheres;
+		vector<rect_prim> rects;
+		vector<translate_prim> translates;
+		vector<rotate_y_prim> rotations;
+		vector<medium_prim> media;
+		vector<grid_medium_prim> grid_media;
+
+		vector<flat_bvh_node> nodes;		//only while building
+		vector<wide_bvh_node, cache_line_allocator<wide_bvh_node>> wide_nodes;
+		aabb scene_box;
+		vector<prim_ref> refs;
+		vector<light_prim> lights;
+		light_tree tree;
+		vector<double> power_cdf;		//running sum of light power, normalized to end at 1
+		light_selection selection;
+
+		//the list the next lowered primitive goes into, switched while lowering a transform's child
+		vector<build_item>* current;
+		//object to world transform of the primitives being lowered
+		rigid_transform current_transform;
+		uint32_t instance_depth = 0;		//transforms around what is being added
+
+		void push(prim_type type, size_t index, const aabb& box);
+		uint32_t add_light(prim_type type, size_t index, uint32_t mat_id, double area);
+		void light_sphere(const light_prim& light, double time, vec3& center, double& radius) const;
+		void rect_point(const light_prim& light, double u, double v, vec3& p, vec3& normal) const;
+		light_bounds bound_light(const light_prim& light) const;
+		double selection_pmf(const vec3& x, const vec3& n, uint32_t light) const;
+		double power_pmf(uint32_t light) const;
+		bool build_subtree(const shared_ptr<hittable>& child, uint32_t& subtree_root);
+		//false when one more transform would not fit in a hit_query
+		bool enter_instance();
+		uint32_t build(vector<build_item>& items, size_t start, size_t end, int depth);
+		//packs the binary subtree under node_index into wide nodes, returns the index of its root
+		uint32_t widen(uint32_t node_index);
+
+		//given crossings, media are walked into it as trace does instead of sampled
+		bool intersect_node(uint32_t node_index, const ray& r, double t_min, double t_max, hit_query& query,
+			medium_crossings* crossings = nullptr) const;
+		bool intersect_prim(uint32_t ref_index, const ray& r, double t_min, double t_max, hit_query& query,
+			medium_crossings* crossings) const;
+		bool intersect_medium(const medium_prim& m, const ray& r, double t_min, double t_max, double& t) const;
+		//media met are added to crossed instead of being sampled, when it is given, and grid media
+		//scale transmittance instead of blocking
+		bool occluded_node(uint32_t node_index, const ray& r, double t_min, double t_max, active_media* crossed = nullptr,
+			double* transmittance = nullptr) const;
+		//where r crosses the boundary of m in (t_min, t_max), in order; returns how many
+		int boundary_crossings(const medium_prim& m, const ray& r, double t_min, double t_max, double* t) const;
+		//whether a flight along r between t_min and t_max collides in listed.ids[first, count)
+		bool scatters(const active_media& listed, int first, const active_media& active, const ray& r, double t_min, double t_max) const;
+		ray to_medium(const medium_prim& m, const ray& r) const;
+
+		uint32_t instance_root(const prim_ref& ref) const;
+		ray to_local(const prim_ref& ref, const ray& r) const;
+	};
+}
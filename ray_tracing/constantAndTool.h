@@ -7,8 +7,11 @@
 #include <cmath>
 #include <cstdlib>
 #include <limits>
+#include <random>
 #include <vector>
 #include <iostream>
+#include "sampler.h"
+#include "fast_math.h"
 
 using std::shared_ptr;
 using std::make_shared;
@@ -39,9 +42,21 @@ namespace ray_tracing
 		return a >= b ? a : b;
 	}
 
+	//every thread draws from its own generator, so render threads share no state
+	inline std::mt19937& random_engine()
+	{
+		thread_local std::mt19937 engine;
+		return engine;
+	}
+
+	inline void seed_random(unsigned seed)
+	{
+		random_engine().seed(seed);
+	}
+
 	inline double random_double()
 	{
-		return rand() / (RAND_MAX + 1.0);
+		return random_engine()() / 4294967296.0;
 	}
 
 	inline double random_double(double min, double max)
@@ -236,7 +251,9 @@ namespace ray_tracing
 		auto z = random_double(-1, 1);
 		auto r = sqrt(1 - z * z);
 		auto theta = random_double(0, 2 * pi);	//ˮƽ
-		return vec3(r * cos(theta), r * sin(theta), z);
+		double sine, cosine;
+		math::sincos(theta, sine, cosine);
+		return vec3(r * cosine, r * sine, z);
 	}
 	inline vec3 random_in_hemisphere(const vec3& normal)
 	{
@@ -271,7 +288,8 @@ namespace ray_tracing
 	{
 		auto r0 = (1 - ref_idx) / (1 + ref_idx);
 		r0 *= r0;
-		return r0 + (1 - r0) * pow((1 - cosine), 5);
+		auto m = 1 - cosine, m2 = m * m;
+		return r0 + (1 - r0) * (m2 * m2 * m);
 	}
 
 	//emit ray from a unit circle
@@ -285,6 +303,57 @@ namespace ray_tracing
 		}
 	}
 
+	//the point of the unit disk a uniform (u, v) lands on; concentric, so strata of the square stay compact
+	inline vec3 disk_point(double u, double v)
+	{
+		auto a = 2 * u - 1, b = 2 * v - 1;
+		if (a == 0 && b == 0)
+		{
+			return vec3(0, 0, 0);
+		}
+		double r, phi;
+		if (std::fabs(a) > std::fabs(b))
+		{
+			r = a;
+			phi = pi / 4 * (b / a);
+		}
+		else
+		{
+			r = b;
+			phi = pi / 2 - pi / 4 * (a / b);
+		}
+		double sine, cosine;
+		math::sincos(phi, sine, cosine);
+		return vec3(r * cosine, r * sine, 0);
+	}
+
+	//random_unit_vector from a given uniform (u, v)
+	inline vec3 sphere_direction(double u, double v)
+	{
+		auto z = 2 * u - 1;
+		auto r = sqrt(1 - z * z);
+		auto theta = 2 * pi * v;
+		double sine, cosine;
+		math::sincos(theta, sine, cosine);
+		return vec3(r * cosine, r * sine, z);
+	}
+
+	//orthonormal basis around w, for directions sampled in a lobe's local frame
+	struct onb
+	{
+		vec3 u, v, w;
+
+		onb(const vec3& n)
+		{
+			w = unit_vector(n);
+			vec3 a = std::fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+			v = unit_vector(cross(w, a));
+			u = cross(w, v);
+		}
+
+		vec3 local(double a, double b, double c) const { return u * a + v * b + w * c; }
+	};
+
 
 
 	/*ray class*/
@@ -337,13 +406,37 @@ namespace ray_tracing
 			vertical = v * 2 * half_height * focus_dist;
 		}
 
-		ray get_ray(double s, double t)
+		ray get_ray(double s, double t) const
 		{
 			//return ray(origin, lower_left_corner + horizontal * s + vertical * t - origin);
 
-			vec3 rd = random_in_unit_disk() * lens_radius;
+			double lens_u, lens_v;
+			sample_2d(dim_lens, lens_u, lens_v);
+			vec3 rd = disk_point(lens_u, lens_v) * lens_radius;
 			vec3 offset = u * rd.x() + v * rd.y();
-			return ray(origin + offset, lower_left_corner + horizontal * s + vertical * t - origin - offset, random_double(time0, time1));
+			return ray(origin + offset, lower_left_corner + horizontal * s + vertical * t - origin - offset, time0 + (time1 - time0) * sample_1d(dim_time));
+		}
+
+		//the (s, t) for which get_ray looks at p through the lens center, false behind the camera
+		bool project(const vec3& p, double& s, double& t) const
+		{
+			auto depth = dot(origin - p, w);
+			if (depth <= 0)
+			{
+				return false;
+			}
+			auto plane = dot(origin - lower_left_corner, w);
+			vec3 q = origin + (p - origin) * (plane / depth) - lower_left_corner;
+			s = dot(q, horizontal) / horizontal.length_squared();
+			t = dot(q, vertical) / vertical.length_squared();
+			return true;
+		}
+
+		double shutter() const { return time1 - time0; }
+		//angle one pixel of an image of the given height spans, the spread of a camera ray's cone
+		double pixel_spread(int image_height) const
+		{
+			return vertical.length() / dot(origin - lower_left_corner, w) / image_height;
 		}
 
 	private:
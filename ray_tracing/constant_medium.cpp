@@ -1,13 +1,11 @@
 #include"constant_medium.h"
+#include"compiled_scene.h"
 
 namespace ray_tracing
 {
+	//the boundary is taken to be convex: the ray is inside it between its first two crossings
 	bool constant_medium::hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const
 	{
-		//Print  samples when debugging. To enable, set enableDebug true.
-		const bool enableDebug = false;
-		const bool debugging = enableDebug && random_double() < 0.00001;
-
 		hit_record rec1, rec2;
 		if (boundary->hit(r, -infinity, infinity, rec1) == false)
 		{
@@ -18,11 +16,6 @@ namespace ray_tracing
 			return false;
 		}
 
-		if (debugging == true)
-		{
-			std::cerr << std::endl << "t0 = " << rec1.t << ", t1 = " << rec2.t << std::endl;
-		}
-
 		if (rec1.t < t_min) rec1.t = t_min;
 		if (rec2.t > t_max) rec2.t = t_max;
 
@@ -42,16 +35,18 @@ namespace ray_tracing
 		rec.t = rec1.t + hit_distance / ray_length;
 		rec.p = r.at(rec.t);
 
-		if (debugging) {
-			std::cerr << "hit_distance = " << hit_distance << '\n'
-				<< "rec.t = " << rec.t << '\n'
-				<< "rec.p = " << rec.p << '\n';
-		}
-
-		rec.normal = vec3(1, 0, 0);
+		//media have no surface
+		rec.normal = vec3(0, 0, 0);
 		rec.front_face = true;
-		rec.mat_ptr = phase_function;
+		rec.u = rec.v = 0;
+		rec.mat_id = mat_id;
+		rec.light_id = no_light;
 
 		return true;
 	}
+
+	void constant_medium::lower(compiled_scene& scene) const
+	{
+		mat_id = scene.add_medium(boundary, neg_inv_density, phase_function);
+	}
 }
\ No newline at end of file
@@ -13,6 +13,7 @@ namespace ray_tracing
 	private:
 		shared_ptr<hittable> boundary;
 		shared_ptr<material> phase_function;
+		mutable uint32_t mat_id = no_material;	//set by lower
 		double neg_inv_density;
 		constant_medium() = default;
 
@@ -28,5 +29,6 @@ namespace ray_tracing
 		{
 			return boundary->bounding_box(t0, t1, output_box);
 		}
+		virtual void lower(compiled_scene& scene) const override;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "denoiser.h"
+
+#include<chrono>
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const double b3_spline[5] = { 1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16 };
+		const double min_albedo = 0.01;
+
+		inline double seconds_since(const std::chrono::steady_clock::time_point& start)
+		{
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		inline vec3 safe_albedo(const vec3& a)
+		{
+			return vec3(ffmax(a.x(), min_albedo), ffmax(a.y(), min_albedo), ffmax(a.z(), min_albedo));
+		}
+
+		inline vec3 divide(const vec3& a, const vec3& b)
+		{
+			return vec3(a.x() / b.x(), a.y() / b.y(), a.z() / b.z());
+		}
+
+		//the aov channels as doubles, read once per tap
+		struct guide_buffers
+		{
+			int width, height;
+			vector<vec3> albedo;
+			vector<vec3> normal;
+			vector<double> depth;
+		};
+
+		void atrous_pass(const guide_buffers& image, const vector<vec3>& in, vector<vec3>& out, int step, double sigma_color,
+			const denoise_settings& settings, int row_begin, int row_end)
+		{
+			const auto inv_color = 1 / (sigma_color * sigma_color);
+			const auto inv_normal = 1 / (settings.sigma_normal * settings.sigma_normal);
+			const auto inv_albedo = 1 / (settings.sigma_albedo * settings.sigma_albedo);
+
+			for (int y = row_begin; y < row_end; ++y)
+			{
+				for (int x = 0; x < image.width; ++x)
+				{
+					auto p = y * image.width + x;
+					const vec3& color = in[p];
+					//color differences are judged relative to the pixel's own brightness
+					auto scale = 1 / (color.length_squared() + 1e-4);
+
+					vec3 sum(0, 0, 0);
+					double weight_sum = 0;
+					for (int dy = -2; dy <= 2; ++dy)
+					{
+						auto qy = y + dy * step;
+						if (qy < 0 || qy >= image.height)
+						{
+							continue;
+						}
+						for (int dx = -2; dx <= 2; ++dx)
+						{
+							auto qx = x + dx * step;
+							if (qx < 0 || qx >= image.width)
+							{
+								continue;
+							}
+
+							auto q = qy * image.width + qx;
+							auto color_term = (in[q] - color).length_squared() * scale * inv_color;
+							auto normal_term = (image.normal[q] - image.normal[p]).length_squared() * inv_normal;
+							auto albedo_term = (image.albedo[q] - image.albedo[p]).length_squared() * inv_albedo;
+							auto depth_term = std::fabs(image.depth[q] - image.depth[p]) / (settings.sigma_depth * step * ffmax(image.depth[p], 1e-3));
+							auto w = b3_spline[dx + 2] * b3_spline[dy + 2] * exp(-(color_term + normal_term + albedo_term + depth_term));
+
+							sum += in[q] * w;
+							weight_sum += w;
+						}
+					}
+					out[p] = sum / weight_sum;
+				}
+			}
+		}
+	}
+
+	void denoise(framebuffer& image, const denoise_settings& settings, denoise_timings* timings)
+	{
+		if ((image.aovs.enabled & denoise_aovs) != denoise_aovs)
+		{
+			cerr << "denoise: the image has no albedo, normal and depth channels" << endl;
+			return;
+		}
+
+		auto pixel_count = static_cast<int>(image.pixels.size());
+		vector<vec3> current(pixel_count), next(pixel_count);
+		guide_buffers guides{ image.width, image.height, vector<vec3>(pixel_count), vector<vec3>(pixel_count), vector<double>(pixel_count) };
+
+		//filter irradiance, not color, so the blur cannot wash out textures
+		auto start = std::chrono::steady_clock::now();
+		parallel_for(pixel_count, settings.threads, [&](int begin, int end)
+		{
+			for (int p = begin; p < end; ++p)
+			{
+				guides.albedo[p] = safe_albedo(image.aovs.get3(aov_albedo, p));
+				guides.normal[p] = image.aovs.get3(aov_normal, p);
+				guides.depth[p] = image.aovs.at(aov_depth, p)[0];
+				current[p] = divide(image.pixels[p], guides.albedo[p]);
+			}
+		});
+		if (timings != nullptr)
+		{
+			timings->demodulate = seconds_since(start);
+			timings->passes.clear();
+		}
+
+		for (int i = 0; i < settings.iterations; ++i)
+		{
+			start = std::chrono::steady_clock::now();
+			auto sigma_color = settings.sigma_color / (1 << i);
+			parallel_for(image.height, settings.threads, [&](int begin, int end)
+			{
+				atrous_pass(guides, current, next, 1 << i, sigma_color, settings, begin, end);
+			});
+			current.swap(next);
+			if (timings != nullptr)
+			{
+				timings->passes.push_back(seconds_since(start));
+			}
+		}
+
+		start = std::chrono::steady_clock::now();
+		parallel_for(pixel_count, settings.threads, [&](int begin, int end)
+		{
+			for (int p = begin; p < end; ++p)
+			{
+				image.pixels[p] = current[p] * guides.albedo[p];
+			}
+		});
+		if (timings != nullptr)
+		{
+			timings->remodulate = seconds_since(start);
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include"constantAndTool.h"
+#include"renderer.h"
+
+namespace ray_tracing
+{
+	struct denoise_settings
+	{
+		int iterations = 5;			//the footprint doubles with every pass: 5 passes cover 125 pixels across
+		double sigma_color = 1.0;	//relative color difference, halved every pass
+		double sigma_normal = 0.3;
+		double sigma_depth = 0.02;	//relative depth difference per pixel of step
+		double sigma_albedo = 0.1;
+		int threads = 0;			//0 uses every hardware thread
+	};
+
+	//the channels denoise needs in render_settings::aovs
+	const unsigned denoise_aovs = aov_bit(aov_albedo) | aov_bit(aov_normal) | aov_bit(aov_depth);
+
+	//seconds spent in each stage of the last denoise call
+	struct denoise_timings
+	{
+		double demodulate = 0;
+		vector<double> passes;
+		double remodulate = 0;
+	};
+
+	/*
+	Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) over the framebuffer.
+	The albedo is divided out first so texture detail survives, then a 5x5 B3 spline kernel is
+	applied with holes of 1, 2, 4... pixels. Each tap is weighted down where the color, normal,
+	depth or albedo of the two pixels differ, so the blur stops at geometric and material edges.
+	Rows are split among threads for every pass. Images rendered without denoise_aovs are left alone.
+	*/
+	void denoise(framebuffer& image, const denoise_settings& settings, denoise_timings* timings = nullptr);
+}
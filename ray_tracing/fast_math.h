@@ -0,0 +1,124 @@
+#pragma once
+
+#include<cmath>
+#include<cstdint>
+#include<cstring>
+
+namespace ray_tracing
+{
+	/*
+	Approximations of the transcendental functions the hot paths call: a range reduction and
+	then a polynomial, with no table and no loop, so loops over them can be vectorized. Only
+	those that --bench-math finds ahead of libm in a plain -O2 build are kept: sincos, atan2 and
+	asin, each 1.5x to 3x depending on the run. exp came out slower than libm and was dropped.
+	log, pow and sqrt are out of scope: glibc's log and pow are table driven and were not beaten,
+	and sqrt is a correctly rounded instruction.
+	Bounds on the error against libm, which --bench-math checks:
+	  sincos  |error| <= 1e-14                  |x| < 1e5
+	  atan2   |error| <= 1e-14
+	  asin    |error| <= 1e-13                  |x| <= 1
+	Arguments outside those ranges, nans and infinities go to libm.
+	Defining RAY_TRACING_FAST_MATH when building sends the math:: calls of the renderer to
+	these; without it they are libm.
+	*/
+	namespace fast
+	{
+		const double pi = 3.1415926535897932385;
+		const double pio2_hi = 1.57079632673412561417e+00;		//pi / 2 in two parts, the first exact times any k below 2^20
+		const double pio2_lo = 6.07710050650619224932e-11;
+
+		inline double from_bits(uint64_t b)
+		{
+			double x;
+			memcpy(&x, &b, sizeof(x));
+			return x;
+		}
+
+		//x = k pi / 2 + r with |r| <= pi / 4, the sine and cosine of r from their Taylor series
+		//swapped and negated by the quadrant k
+		inline void sincos(double x, double& s, double& c)
+		{
+			if (!(std::fabs(x) < 1e5))
+			{
+				s = std::sin(x);
+				c = std::cos(x);
+				return;
+			}
+			auto k = std::floor(x * 0.63661977236758134 + 0.5);
+			auto r = (x - k * pio2_hi) - k * pio2_lo;
+			auto r2 = r * r;
+			auto sr = r + r * r2 * (-1.0 / 6 + r2 * (1.0 / 120 + r2 * (-1.0 / 5040 + r2 * (1.0 / 362880 + r2 * (-1.0 / 39916800 +
+				r2 * (1.0 / 6227020800 + r2 * (-1.0 / 1307674368000)))))));
+			auto cr = 1 + r2 * (-1.0 / 2 + r2 * (1.0 / 24 + r2 * (-1.0 / 720 + r2 * (1.0 / 40320 + r2 * (-1.0 / 3628800 +
+				r2 * (1.0 / 479001600 + r2 * (-1.0 / 87178291200)))))));
+
+			auto quadrant = static_cast<int64_t>(k) & 3;
+			auto swapped = (quadrant & 1) != 0;
+			s = swapped ? cr : sr;
+			c = swapped ? sr : cr;
+			s = (quadrant & 2) != 0 ? -s : s;
+			c = ((quadrant + 1) & 2) != 0 ? -c : c;
+		}
+
+		//atan of the smaller of |x| and |y| over the larger, moved below tan(pi / 8) by
+		//atan(t) = pi / 4 + atan((t - 1) / (t + 1)); atan(u) / u is a Chebyshev fit in u^2
+		inline double atan2(double y, double x)
+		{
+			auto ax = std::fabs(x), ay = std::fabs(y);
+			if (!(ax < HUGE_VAL && ay < HUGE_VAL) || (ax == 0 && ay == 0))
+			{
+				return std::atan2(y, x);
+			}
+			auto large = ax > ay ? ax : ay, small = ax > ay ? ay : ax;
+			auto reduced = small > 0.41421356237309503 * large;
+			auto u = reduced ? (small - large) / (small + large) : small / large;
+			auto s = u * u;
+			auto a = u * (0.99999999999997324 + s * (-0.33333333330804982 + s * (0.1999999960511763 + s * (-0.14285690434499698 +
+				s * (0.1111038528695404 + s * (-0.090783950029830196 + s * (0.075637232273881513 + s * (-0.058745743223147094 +
+				s * 0.030663415366741446))))))));
+			a = reduced ? pi / 4 + a : a;
+			a = ay > ax ? pi / 2 - a : a;
+			a = x < 0 ? pi - a : a;
+			return std::copysign(a, y);
+		}
+
+		//asin(x) / x is a Chebyshev fit in x^2 for |x| <= 1 / 2; above that
+		//asin(x) = pi / 2 - 2 asin(sqrt((1 - x) / 2)) brings the argument back below 1 / 2
+		inline double asin(double x)
+		{
+			auto ax = std::fabs(x);
+			if (!(ax <= 1))
+			{
+				return std::asin(x);
+			}
+			auto far = ax > 0.5;
+			auto s = far ? (1 - ax) * 0.5 : ax * ax;
+			auto t = far ? std::sqrt(s) : ax;
+			auto a = t * (0.99999999999994926 + s * (0.1666666667072528 + s * (0.074999994674209286 + s * (0.044643126915363963 +
+				s * (0.030375046811300311 + s * (0.022472626932622954 + s * (0.016472766287703989 + s * (0.018638362836861228 +
+				s * (-0.0028559895537808226 + s * 0.031943643923899867)))))))));
+			a = far ? pi / 2 - 2 * a : a;
+			return std::copysign(a, x);
+		}
+	}
+
+	//what the renderer calls, fast:: or libm by RAY_TRACING_FAST_MATH
+	namespace math
+	{
+#ifdef RAY_TRACING_FAST_MATH
+		const bool is_fast = true;
+		inline void sincos(double x, double& s, double& c) { fast::sincos(x, s, c); }
+		inline double atan2(double y, double x) { return fast::atan2(y, x); }
+		inline double asin(double x) { return fast::asin(x); }
+#else
+		const bool is_fast = false;
+		inline void sincos(double x, double& s, double& c)
+		{
+			s = std::sin(x);
+			c = std::cos(x);
+		}
+		inline double atan2(double y, double x) { return std::atan2(y, x); }
+		inline double asin(double x) { return std::asin(x); }
+#endif
+	}
+}
@@ -0,0 +1,314 @@
+#include"grid_medium.h"
+
+#include<algorithm>
+#include"compiled_scene.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		//ratio tracking plays russian roulette below this, so dense media end the walk early
+		const double roulette_transmittance = 0.1;
+	}
+
+	density_grid::density_grid(const aabb& bounds, int nx, int ny, int nz, const vector<float>& voxels, int majorant_cell)
+		: box(bounds)
+	{
+		n[0] = nx;
+		n[1] = ny;
+		n[2] = nz;
+		build([&](int x, int y, int z) { return voxels[x + nx * (y + ny * static_cast<size_t>(z))]; }, majorant_cell);
+	}
+
+	density_grid::density_grid(const aabb& bounds, int nx, int ny, int nz, const std::function<double(const vec3&)>& field, int majorant_cell)
+		: box(bounds)
+	{
+		n[0] = nx;
+		n[1] = ny;
+		n[2] = nz;
+		auto size = bounds.get_max() - bounds.get_min();
+		vec3 step(size.x() / nx, size.y() / ny, size.z() / nz);
+		build([&](int x, int y, int z)
+		{
+			vec3 center(bounds.get_min().x() + (x + 0.5) * step.x(), bounds.get_min().y() + (y + 0.5) * step.y(), bounds.get_min().z() + (z + 0.5) * step.z());
+			return static_cast<float>(field(center));
+		}, majorant_cell);
+	}
+
+	void density_grid::build(const std::function<float(int, int, int)>& voxel_at, int majorant_cell)
+	{
+		const int brick_voxels = brick_size * brick_size * brick_size;
+		auto size = box.get_max() - box.get_min();
+		for (int i = 0; i < 3; ++i)
+		{
+			voxel_size[i] = size[i] / n[i];
+			bricks[i] = (n[i] + brick_size - 1) / brick_size;
+		}
+
+		//bricks that come out all zeros are dropped as soon as they are filled
+		brick_offsets.assign(static_cast<size_t>(bricks[0]) * bricks[1] * bricks[2], -1);
+		vector<float> brick(brick_voxels);
+		for (int bz = 0; bz < bricks[2]; ++bz)
+		{
+			for (int by = 0; by < bricks[1]; ++by)
+			{
+				for (int bx = 0; bx < bricks[0]; ++bx)
+				{
+					bool is_empty = true;
+					for (int z = 0; z < brick_size; ++z)
+					{
+						for (int y = 0; y < brick_size; ++y)
+						{
+							for (int x = 0; x < brick_size; ++x)
+							{
+								int gx = bx * brick_size + x, gy = by * brick_size + y, gz = bz * brick_size + z;
+								float value = 0;
+								if (gx < n[0] && gy < n[1] && gz < n[2])
+								{
+									//negative densities have no meaning, treat them as empty
+									value = std::max(voxel_at(gx, gy, gz), 0.0f);
+								}
+								brick[x + brick_size * (y + brick_size * z)] = value;
+								is_empty = is_empty && value == 0;
+							}
+						}
+					}
+					if (is_empty == false)
+					{
+						brick_offsets[bx + bricks[0] * (by + bricks[1] * bz)] = static_cast<int32_t>(brick_data.size());
+						brick_data.insert(brick_data.end(), brick.begin(), brick.end());
+					}
+				}
+			}
+		}
+
+		//a cell's majorant covers every voxel a point inside it interpolates from, one past each side
+		int k = majorant_cell > 0 ? majorant_cell : std::max(n[0], std::max(n[1], n[2]));
+		for (int i = 0; i < 3; ++i)
+		{
+			cells[i] = (n[i] + k - 1) / k;
+			cell_size[i] = voxel_size[i] * k;
+		}
+		majorants.assign(static_cast<size_t>(cells[0]) * cells[1] * cells[2], 0.0f);
+		for (int cz = 0; cz < cells[2]; ++cz)
+		{
+			for (int cy = 0; cy < cells[1]; ++cy)
+			{
+				for (int cx = 0; cx < cells[0]; ++cx)
+				{
+					float majorant = 0;
+					for (int z = std::max(cz * k - 1, 0); z <= std::min((cz + 1) * k, n[2] - 1); ++z)
+					{
+						for (int y = std::max(cy * k - 1, 0); y <= std::min((cy + 1) * k, n[1] - 1); ++y)
+						{
+							for (int x = std::max(cx * k - 1, 0); x <= std::min((cx + 1) * k, n[0] - 1); ++x)
+							{
+								majorant = std::max(majorant, voxel(x, y, z));
+							}
+						}
+					}
+					majorants[cx + cells[0] * (cy + cells[1] * cz)] = majorant;
+				}
+			}
+		}
+	}
+
+	float density_grid::voxel(int x, int y, int z) const
+	{
+		if (x < 0 || y < 0 || z < 0 || x >= n[0] || y >= n[1] || z >= n[2])
+		{
+			return 0;
+		}
+		auto offset = brick_offsets[x / brick_size + bricks[0] * (y / brick_size + bricks[1] * (z / brick_size))];
+		if (offset < 0)
+		{
+			return 0;
+		}
+		return brick_data[offset + x % brick_size + brick_size * (y % brick_size + brick_size * (z % brick_size))];
+	}
+
+	double density_grid::density(const vec3& p) const
+	{
+		int i0[3];
+		double f[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			auto g = (p[i] - box.get_min()[i]) / voxel_size[i] - 0.5;
+			auto floor_g = floor(g);
+			i0[i] = static_cast<int>(floor_g);
+			f[i] = g - floor_g;
+		}
+
+		double sum = 0;
+		for (int c = 0; c < 8; ++c)
+		{
+			int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+			auto w = (dx == 1 ? f[0] : 1 - f[0]) * (dy == 1 ? f[1] : 1 - f[1]) * (dz == 1 ? f[2] : 1 - f[2]);
+			sum += w * voxel(i0[0] + dx, i0[1] + dy, i0[2] + dz);
+		}
+		return sum;
+	}
+
+	//Amanatides and Woo over the supergrid, after clipping r to the box
+	template<class F> bool density_grid::march(const ray& r, double t_min, double t_max, F segment) const
+	{
+		const vec3 origin = r.get_origin();
+		const vec3 direction = r.get_direction();
+		for (int i = 0; i < 3; ++i)
+		{
+			auto inv = 1 / direction[i];
+			auto t0 = (box.get_min()[i] - origin[i]) * inv;
+			auto t1 = (box.get_max()[i] - origin[i]) * inv;
+			t_min = ffmax(ffmin(t0, t1), t_min);
+			t_max = ffmin(ffmax(t0, t1), t_max);
+		}
+		if (t_min >= t_max)
+		{
+			return false;
+		}
+
+		int cell[3], step[3];
+		double t_next[3], t_delta[3];
+		const vec3 entry = r.at(t_min);
+		for (int i = 0; i < 3; ++i)
+		{
+			auto c = static_cast<int>(floor((entry[i] - box.get_min()[i]) / cell_size[i]));
+			cell[i] = std::min(std::max(c, 0), cells[i] - 1);
+			auto lower = box.get_min()[i] + cell[i] * cell_size[i];
+			if (direction[i] > 0)
+			{
+				step[i] = 1;
+				t_next[i] = t_min + (lower + cell_size[i] - entry[i]) / direction[i];
+				t_delta[i] = cell_size[i] / direction[i];
+			}
+			else if (direction[i] < 0)
+			{
+				step[i] = -1;
+				t_next[i] = t_min + (lower - entry[i]) / direction[i];
+				t_delta[i] = -cell_size[i] / direction[i];
+			}
+			else
+			{
+				step[i] = 0;
+				t_next[i] = t_delta[i] = infinity;
+			}
+		}
+
+		auto t = t_min;
+		while (true)
+		{
+			int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+			auto t_exit = ffmin(t_next[axis], t_max);
+			if (t_exit > t && segment(t, t_exit, majorants[cell[0] + cells[0] * (cell[1] + cells[1] * cell[2])]) == true)
+			{
+				return true;
+			}
+			if (t_next[axis] >= t_max)
+			{
+				return false;
+			}
+			cell[axis] += step[axis];
+			if (cell[axis] < 0 || cell[axis] >= cells[axis])
+			{
+				return false;
+			}
+			t = t_next[axis];
+			t_next[axis] += t_delta[axis];
+		}
+	}
+
+	//tentative collisions come at the cell's majorant rate, each one real with probability density / majorant
+	bool density_grid::sample_collision(const ray& r, double t_min, double t_max, double& t, size_t* steps) const
+	{
+		const auto length = r.get_direction().length();
+		return march(r, t_min, t_max, [&](double t0, double t1, double majorant)
+		{
+			if (majorant <= 0)
+			{
+				return false;
+			}
+			for (auto s = t0;;)
+			{
+				s -= log(random_double()) / (majorant * length);
+				if (s >= t1)
+				{
+					return false;
+				}
+				if (steps != nullptr)
+				{
+					++*steps;
+				}
+				if (random_double() * majorant < density(r.at(s)))
+				{
+					t = s;
+					return true;
+				}
+			}
+		});
+	}
+
+	//the same tentative collisions, each scaling the estimate by the chance it was not real
+	double density_grid::transmittance(const ray& r, double t_min, double t_max, size_t* steps) const
+	{
+		const auto length = r.get_direction().length();
+		double result = 1;
+		march(r, t_min, t_max, [&](double t0, double t1, double majorant)
+		{
+			if (majorant <= 0)
+			{
+				return false;
+			}
+			for (auto s = t0;;)
+			{
+				s -= log(random_double()) / (majorant * length);
+				if (s >= t1)
+				{
+					return false;
+				}
+				if (steps != nullptr)
+				{
+					++*steps;
+				}
+				result *= 1 - density(r.at(s)) / majorant;
+				if (result < roulette_transmittance)
+				{
+					if (random_double() >= 0.5)
+					{
+						result = 0;
+						return true;
+					}
+					result *= 2;
+				}
+			}
+		});
+		return result;
+	}
+
+	size_t density_grid::memory_bytes() const
+	{
+		return sizeof(*this) + brick_offsets.size() * sizeof(int32_t) + brick_data.size() * sizeof(float) + majorants.size() * sizeof(float);
+	}
+
+	bool grid_medium::hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const
+	{
+		double t;
+		if (grid->sample_collision(r, t_min, t_max, t) == false)
+		{
+			return false;
+		}
+
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.normal = vec3(0, 0, 0);
+		rec.front_face = true;
+		rec.u = rec.v = 0;
+		rec.mat_id = mat_id;
+		rec.light_id = no_light;
+		return true;
+	}
+
+	void grid_medium::lower(compiled_scene& scene) const
+	{
+		mat_id = scene.add_grid_medium(grid, phase_function);
+	}
+}
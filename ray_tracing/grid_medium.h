@@ -0,0 +1,84 @@
+#pragma once
+
+#include<cstdint>
+#include<functional>
+#include"aabb.h"
+#include"constantAndTool.h"
+#include"hittable.h"
+#include"material.h"
+#include"texture.h"
+
+namespace ray_tracing
+{
+	/*
+	Density over a box, sampled at nx * ny * nz voxel centers and interpolated trilinearly.
+	Voxels are stored in bricks of brick_size^3 and bricks holding nothing but zeros take no
+	memory, so the empty space around smoke and clouds costs one index each.
+	A coarse supergrid keeps the largest density each of its cells can return. Tracking walks
+	it with a 3D DDA: empty cells are skipped outright and inside the others the tentative
+	collisions are spaced by the local majorant, so thin regions take few steps.
+	majorant_cell is the supergrid's cell size in voxels, 0 makes a single global majorant.
+	*/
+	class density_grid
+	{
+	public:
+		static const int brick_size = 8;
+
+		density_grid(const aabb& bounds, int nx, int ny, int nz, const vector<float>& voxels, int majorant_cell = brick_size);
+		//field is sampled at every voxel center
+		density_grid(const aabb& bounds, int nx, int ny, int nz, const std::function<double(const vec3&)>& field, int majorant_cell = brick_size);
+
+		double density(const vec3& p) const;
+		//delta tracking: where a flight along r between t_min and t_max collides, false when it gets through
+		bool sample_collision(const ray& r, double t_min, double t_max, double& t, size_t* steps = nullptr) const;
+		//ratio tracking: an unbiased estimate of the transmittance between t_min and t_max
+		double transmittance(const ray& r, double t_min, double t_max, size_t* steps = nullptr) const;
+
+		const aabb& bounds() const { return box; }
+		size_t brick_count() const { return brick_data.size() / (brick_size * brick_size * brick_size); }
+		size_t total_bricks() const { return brick_offsets.size(); }
+		size_t memory_bytes() const;
+
+	private:
+		aabb box;
+		int n[3];
+		vec3 voxel_size;
+		int bricks[3];
+		vector<int32_t> brick_offsets;		//into brick_data, -1 for an empty brick
+		vector<float> brick_data;
+		int cells[3];
+		vec3 cell_size;
+		vector<float> majorants;
+
+		void build(const std::function<float(int, int, int)>& voxel_at, int majorant_cell);
+		float voxel(int x, int y, int z) const;
+		//calls segment(t0, t1, majorant) for each supergrid cell r passes between t_min and t_max,
+		//in order, until one returns true
+		template<class F> bool march(const ray& r, double t_min, double t_max, F segment) const;
+	};
+
+	//a volume whose density follows a density_grid, in the grid's own space
+	class grid_medium : public hittable
+	{
+	private:
+		shared_ptr<const density_grid> grid;
+		shared_ptr<material> phase_function;
+		mutable uint32_t mat_id = no_material;	//set by lower
+		grid_medium() = default;
+
+	public:
+		grid_medium(shared_ptr<const density_grid> g, shared_ptr<texture> a)
+			: grid(g)
+		{
+			phase_function = make_shared<isotropic>(a);
+		}
+
+		virtual bool hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const override;
+		virtual bool bounding_box(double t0, double t1, aabb& output_box) const override
+		{
+			output_box = grid->bounds();
+			return true;
+		}
+		virtual void lower(compiled_scene& scene) const override;
+	};
+}
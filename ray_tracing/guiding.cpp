@@ -0,0 +1,306 @@
+#include"guiding.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		//plain relaxed adds: the sums are only read once the pass is over
+		inline void atomic_add(std::atomic<float>& sum, float value)
+		{
+			auto current = sum.load(std::memory_order_relaxed);
+			while (sum.compare_exchange_weak(current, current + value, std::memory_order_relaxed) == false)
+			{
+			}
+		}
+
+		inline void direction_to_square(const vec3& d, double& x, double& y)
+		{
+			auto phi = math::atan2(d.y(), d.x());
+			if (phi < 0)
+			{
+				phi += 2 * pi;
+			}
+			x = clamp((d.z() + 1) / 2, 0.0, 1 - 1e-12);
+			y = clamp(phi / (2 * pi), 0.0, 1 - 1e-12);
+		}
+
+		inline vec3 square_to_direction(double x, double y)
+		{
+			auto cos_theta = 2 * x - 1;
+			auto sin_theta = sqrt(ffmax(0.0, 1 - cos_theta * cos_theta));
+			auto phi = 2 * pi * y;
+			double sine, cosine;
+			math::sincos(phi, sine, cosine);
+			return vec3(sin_theta * cosine, sin_theta * sine, cos_theta);
+		}
+
+		//picks the lower or upper part of [0, 1) with probability p_low for it, rescaling u to reuse it
+		inline int pick(double p_low, double& u)
+		{
+			if (u < p_low)
+			{
+				u = ffmin(u / p_low, 1 - 1e-12);
+				return 0;
+			}
+			u = ffmin((u - p_low) / (1 - p_low), 1 - 1e-12);
+			return 1;
+		}
+	}
+
+	dtree::dtree()
+		: sampling(1, node{ { 0, 0, 0, 0 }, { 0, 0, 0, 0 } }), sampling_total(0), samples(0)
+	{
+		reset_recording(vector<node>(1, node{ { 0, 0, 0, 0 }, { 0, 0, 0, 0 } }));
+	}
+
+	dtree::dtree(const dtree& other)
+		: sampling(other.sampling), sampling_total(other.sampling_total), recording(other.recording),
+		recorded(new std::atomic<float>[other.recording.size() * 4]), samples(other.sample_count())
+	{
+		for (size_t i = 0; i < recording.size() * 4; ++i)
+		{
+			recorded[i].store(other.recorded[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+
+	vec3 dtree::sample(double u, double v) const
+	{
+		uint32_t index = 0;
+		double x0 = 0, y0 = 0, size = 1;
+		while (true)
+		{
+			const node& n = sampling[index];
+			auto left = n.sum[0] + n.sum[2];
+			auto total = left + n.sum[1] + n.sum[3];
+			if (total <= 0)
+			{
+				return square_to_direction(x0 + u * size, y0 + v * size);
+			}
+			auto cx = pick(left / total, u);
+			auto cy = pick(n.sum[cx] / (n.sum[cx] + n.sum[cx + 2]), v);
+			auto q = cx + 2 * cy;
+			size /= 2;
+			x0 += cx * size;
+			y0 += cy * size;
+			if (n.child[q] == 0)
+			{
+				return square_to_direction(x0 + u * size, y0 + v * size);
+			}
+			index = n.child[q];
+		}
+	}
+
+	double dtree::pdf(const vec3& direction) const
+	{
+		if (can_sample() == false)
+		{
+			return 0;
+		}
+
+		double x, y;
+		direction_to_square(direction, x, y);
+		double density = 1;
+		uint32_t index = 0;
+		while (true)
+		{
+			const node& n = sampling[index];
+			auto total = n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+			if (total <= 0)
+			{
+				return 0;
+			}
+			int cx = x >= 0.5 ? 1 : 0, cy = y >= 0.5 ? 1 : 0;
+			auto q = cx + 2 * cy;
+			density *= 4 * n.sum[q] / total;
+			x = 2 * x - cx;
+			y = 2 * y - cy;
+			if (n.child[q] == 0)
+			{
+				break;
+			}
+			index = n.child[q];
+		}
+		return density / (4 * pi);
+	}
+
+	void dtree::record(const vec3& direction, double value)
+	{
+		samples.fetch_add(1, std::memory_order_relaxed);
+		if (value <= 0 || std::isfinite(value) == false)
+		{
+			return;
+		}
+
+		double x, y;
+		direction_to_square(direction, x, y);
+		uint32_t index = 0;
+		while (true)
+		{
+			int cx = x >= 0.5 ? 1 : 0, cy = y >= 0.5 ? 1 : 0;
+			auto q = cx + 2 * cy;
+			atomic_add(recorded[index * 4 + q], static_cast<float>(value));
+			x = 2 * x - cx;
+			y = 2 * y - cy;
+			if (recording[index].child[q] == 0)
+			{
+				break;
+			}
+			index = recording[index].child[q];
+		}
+	}
+
+	void dtree::refine(double split_fraction, int max_depth)
+	{
+		vector<node> learned = recording;
+		double total = 0;
+		for (size_t i = 0; i < learned.size(); ++i)
+		{
+			for (int q = 0; q < 4; ++q)
+			{
+				learned[i].sum[q] = recorded[i * 4 + q].load(std::memory_order_relaxed);
+			}
+		}
+		for (int q = 0; q < 4; ++q)
+		{
+			total += learned[0].sum[q];
+		}
+		//a region nothing reached this pass keeps guiding with what it had
+		if (total > 0)
+		{
+			sampling = std::move(learned);
+			sampling_total = total;
+		}
+
+		//quadrants holding more than split_fraction of the energy are subdivided, the rest merged
+		struct pending
+		{
+			uint32_t target;
+			int32_t source;		//node of sampling the sums come from, -1 past its leaves
+			float sum[4];
+			int depth;
+		};
+		vector<node> topology(1, node{ { 0, 0, 0, 0 }, { 0, 0, 0, 0 } });
+		vector<pending> stack;
+		if (sampling_total > 0)
+		{
+			stack.push_back({ 0, 0, { sampling[0].sum[0], sampling[0].sum[1], sampling[0].sum[2], sampling[0].sum[3] }, 1 });
+		}
+		while (stack.empty() == false)
+		{
+			auto item = stack.back();
+			stack.pop_back();
+			for (int q = 0; q < 4; ++q)
+			{
+				if (item.sum[q] <= split_fraction * sampling_total || item.depth >= max_depth)
+				{
+					continue;
+				}
+				auto child = static_cast<uint32_t>(topology.size());
+				topology.push_back(node{ { 0, 0, 0, 0 }, { 0, 0, 0, 0 } });
+				topology[item.target].child[q] = child;
+
+				pending next{ child, -1, { 0, 0, 0, 0 }, item.depth + 1 };
+				auto source_child = item.source >= 0 ? sampling[item.source].child[q] : 0;
+				if (source_child != 0)
+				{
+					next.source = static_cast<int32_t>(source_child);
+					for (int k = 0; k < 4; ++k)
+					{
+						next.sum[k] = sampling[source_child].sum[k];
+					}
+				}
+				else
+				{
+					for (int k = 0; k < 4; ++k)
+					{
+						next.sum[k] = item.sum[q] / 4;
+					}
+				}
+				stack.push_back(next);
+			}
+		}
+		reset_recording(std::move(topology));
+	}
+
+	void dtree::reset_recording(vector<node>&& topology)
+	{
+		recording = std::move(topology);
+		recorded.reset(new std::atomic<float>[recording.size() * 4]);
+		for (size_t i = 0; i < recording.size() * 4; ++i)
+		{
+			recorded[i].store(0, std::memory_order_relaxed);
+		}
+		samples.store(0, std::memory_order_relaxed);
+	}
+
+	path_guide::path_guide(const aabb& bounds, const guiding_settings& s)
+		: box(bounds), settings(s), training(true)
+	{
+		nodes.push_back({ { 0, 0 }, 0 });
+		regions.push_back(std::unique_ptr<dtree>(new dtree()));
+	}
+
+	dtree* path_guide::find(const vec3& p) const
+	{
+		vec3 lo = box.get_min(), hi = box.get_max();
+		uint32_t index = 0;
+		for (int depth = 0; nodes[index].child[0] != 0; ++depth)
+		{
+			auto axis = depth % 3;
+			auto mid = (lo[axis] + hi[axis]) / 2;
+			if (p[axis] < mid)
+			{
+				hi[axis] = mid;
+				index = nodes[index].child[0];
+			}
+			else
+			{
+				lo[axis] = mid;
+				index = nodes[index].child[1];
+			}
+		}
+		return regions[nodes[index].region].get();
+	}
+
+	void path_guide::refine(int pass)
+	{
+		//leaves appended by a split are visited by the same loop, so busy regions keep splitting
+		auto threshold = settings.spatial_threshold * sqrt(static_cast<double>(1 << pass));
+		for (size_t index = 0; index < nodes.size(); ++index)
+		{
+			if (nodes[index].child[0] != 0)
+			{
+				continue;
+			}
+			auto region = nodes[index].region;
+			if (regions[region]->sample_count() <= threshold)
+			{
+				continue;
+			}
+
+			regions[region]->halve_samples();
+			auto copy = static_cast<uint32_t>(regions.size());
+			regions.push_back(std::unique_ptr<dtree>(new dtree(*regions[region])));
+			auto first = static_cast<uint32_t>(nodes.size());
+			nodes.push_back({ { 0, 0 }, region });
+			nodes.push_back({ { 0, 0 }, copy });
+			nodes[index].child[0] = first;
+			nodes[index].child[1] = first + 1;
+		}
+
+		for (auto& region : regions)
+		{
+			region->refine(settings.split_fraction, settings.max_directional_depth);
+		}
+	}
+
+	size_t path_guide::directional_node_count() const
+	{
+		size_t count = 0;
+		for (const auto& region : regions)
+		{
+			count += region->node_count();
+		}
+		return count;
+	}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include<atomic>
+#include<cstdint>
+#include<memory>
+#include"aabb.h"
+#include"constantAndTool.h"
+#include"material.h"
+
+namespace ray_tracing
+{
+	struct guiding_settings
+	{
+		bool enabled = false;
+		int training_passes = 5;			//pass k takes 2^k samples per pixel, its image is thrown away
+		double bsdf_fraction = 0.5;			//share of guided bounces that still sample the material
+		double spatial_threshold = 4000;	//a region splits past this many vertices times sqrt(2^k) in pass k
+		double split_fraction = 0.01;		//directions holding more of a region's energy are subdivided
+		int max_directional_depth = 12;
+	};
+
+	/*
+	Incoming radiance over the sphere at one region, as a quadtree over (cos theta, phi) in the
+	unit square; the mapping preserves area, so the density over the sphere is that of the
+	square over 4 pi. The tree sampled during a pass was learned in the previous one and is not
+	touched; vertices are recorded into a second tree through atomic adds, and refine turns that
+	one into the next sampled tree, subdividing where the energy concentrates.
+	*/
+	class dtree
+	{
+	public:
+		dtree();
+		dtree(const dtree& other);
+		dtree& operator=(const dtree& other) = delete;
+
+		bool can_sample() const { return sampling_total > 0; }
+		//direction for a uniform (u, v), and the solid angle density of any unit direction
+		vec3 sample(double u, double v) const;
+		double pdf(const vec3& direction) const;
+
+		//radiance along the unit direction, divided by the density the direction was drawn with
+		void record(const vec3& direction, double value);
+		uint32_t sample_count() const { return samples.load(std::memory_order_relaxed); }
+		void halve_samples() { samples.store(sample_count() / 2, std::memory_order_relaxed); }
+		//what was recorded becomes the sampled tree, recording starts over on a refined one
+		void refine(double split_fraction, int max_depth);
+		size_t node_count() const { return sampling.size(); }
+
+	private:
+		//child 0 marks a leaf quadrant; quadrant q covers x half q & 1 and y half q >> 1
+		struct node
+		{
+			uint32_t child[4];
+			float sum[4];
+		};
+
+		vector<node> sampling;
+		double sampling_total;
+		vector<node> recording;
+		std::unique_ptr<std::atomic<float>[]> recorded;		//4 sums per recording node
+		std::atomic<uint32_t> samples;
+
+		void reset_recording(vector<node>&& topology);
+	};
+
+	/*
+	Spatial half of the SD-tree: a kd-tree over the scene bounds, cycling through the axes and
+	splitting regions in the middle, whose leaves each own a dtree. Its shape only changes in
+	refine, between passes, so render threads look regions up without locking.
+	*/
+	class path_guide
+	{
+	public:
+		path_guide(const aabb& bounds, const guiding_settings& settings);
+
+		dtree* find(const vec3& p) const;
+		//after training pass k: splits busy regions, then refines every dtree
+		void refine(int pass);
+
+		bool is_training() const { return training; }
+		void set_training(bool t) { training = t; }
+		const guiding_settings& get_settings() const { return settings; }
+		size_t region_count() const { return regions.size(); }
+		size_t directional_node_count() const;
+
+	private:
+		//child[0] == 0 marks a leaf, region indexes regions then
+		struct stree_node
+		{
+			uint32_t child[2];
+			uint32_t region;
+		};
+
+		aabb box;
+		guiding_settings settings;
+		bool training;
+		vector<stree_node> nodes;
+		vector<std::unique_ptr<dtree>> regions;
+	};
+
+	//a material mixed with the learned distribution of the region it is in
+	struct guided_lobe
+	{
+		const dtree* region;
+		double bsdf_fraction;
+
+		double pdf(const material& mat, const ray& r_in, const hit_record& rec, const vec3& wi) const
+		{
+			return bsdf_fraction * mat.pdf(r_in, rec, wi) + (1 - bsdf_fraction) * region->pdf(wi);
+		}
+	};
+}
@@ -1,8 +1,8 @@
 #include "hittable.h"
+#include "compiled_scene.h"
 
 namespace ray_tracing
 {
-
 	bool sphere::hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const
 	{
 		vec3 oc = r.get_origin() - center;
@@ -16,26 +16,19 @@ namespace ray_tracing
 			auto root = sqrt(delta);
 
 			auto temp = (-half_b - root) / a;	//t
-			if (temp > t_min && temp < t_max)
+			if (temp <= t_min || temp >= t_max)
 			{
-				rec.t = temp;
-				rec.p = r.at(rec.t);
-				vec3 outward_normal = (rec.p - center) / radius;
-				rec.set_face_normal(r, outward_normal);
-				rec.mat_ptr = mat_ptr;
-				get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-				return true;
+				temp = (-half_b + root) / a;
 			}
-
-			temp = (-half_b + root) / a;
 			if (temp > t_min && temp < t_max)
 			{
 				rec.t = temp;
 				rec.p = r.at(rec.t);
 				vec3 outward_normal = (rec.p - center) / radius;
 				rec.set_face_normal(r, outward_normal);
-				rec.mat_ptr = mat_ptr;
-				get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
+				rec.mat_id = mat_id;
+				rec.light_id = no_light;
+				get_sphere_uv(outward_normal, rec.u, rec.v);
 				return true;
 			}
 
@@ -58,24 +51,19 @@ namespace ray_tracing
 			auto root = sqrt(delta);
 
 			auto temp = (-half_b - root) / a;
-			if (temp > t_min && temp < t_max)
+			if (temp <= t_min || temp >= t_max)
 			{
-				rec.t = temp;
-				rec.p = r.at(rec.t);
-				vec3 outward_normal = (rec.p - center(r.get_time())) / radius;
-				rec.set_face_normal(r, outward_normal);
-				rec.mat_ptr = mat_ptr;
-				return true;
+				temp = (-half_b + root) / a;
 			}
-
-			temp = (-half_b + root) / a;
 			if (temp > t_min && temp < t_max)
 			{
 				rec.t = temp;
 				rec.p = r.at(rec.t);
 				vec3 outward_normal = (rec.p - center(r.get_time())) / radius;
 				rec.set_face_normal(r, outward_normal);
-				rec.mat_ptr = mat_ptr;
+				rec.mat_id = mat_id;
+				rec.light_id = no_light;
+				get_sphere_uv(outward_normal, rec.u, rec.v);
 				return true;
 			}
 
@@ -125,9 +113,15 @@ namespace ray_tracing
 	}
 
 
-	 bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1)
+	//the whole tree works on one copy of the range, every node sorts its own part of it
+	bvh_node::bvh_node(const vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1)
+	{
+		vector<shared_ptr<hittable>> sorted(objects.begin() + start, objects.begin() + end);
+		build(sorted, 0, sorted.size(), time0, time1);
+	}
+
+	void bvh_node::build(vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1)
 	{
-		auto temp_objects = objects;
 		int axis = random_int(0, 2);
 		auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
 
@@ -135,27 +129,31 @@ namespace ray_tracing
 		size_t object_span = end - start;
 		if (object_span == 1)
 		{
-			left = right = temp_objects[start];
+			left = right = objects[start];
 		}
 		else if (object_span == 2)
 		{
-			if (comparator(temp_objects[start], temp_objects[start + 1]) == true)
+			if (comparator(objects[start], objects[start + 1]) == true)
 			{
-				left = temp_objects[start];
-				right = temp_objects[start + 1];
+				left = objects[start];
+				right = objects[start + 1];
 			}
 			else
 			{
-				left = temp_objects[start + 1];
-				right = temp_objects[start];
+				left = objects[start + 1];
+				right = objects[start];
 			}
 		}
 		else
 		{
-			std::sort(temp_objects.begin() + start, temp_objects.begin() + end, comparator);
+			std::sort(objects.begin() + start, objects.begin() + end, comparator);
 			auto mid = start + object_span / 2;
-			left = make_shared<bvh_node>(temp_objects, start, mid, time0, time1);
-			right = make_shared<bvh_node>(temp_objects, mid, end, time0, time1);
+			auto left_node = make_shared<bvh_node>();
+			left_node->build(objects, start, mid, time0, time1);
+			left = left_node;
+			auto right_node = make_shared<bvh_node>();
+			right_node->build(objects, mid, end, time0, time1);
+			right = right_node;
 		}
 
 		aabb box_left, box_right;
@@ -189,7 +187,8 @@ namespace ray_tracing
 		rec.t = t;
 		vec3 outward_normal = vec3(0, 0, 1);
 		rec.set_face_normal(r, outward_normal);
-		rec.mat_ptr = mp;
+		rec.mat_id = mat_id;
+		rec.light_id = no_light;
 		rec.p = r.at(t);
 		return true;
 	}
@@ -213,7 +212,8 @@ namespace ray_tracing
 		rec.t = t;
 		vec3 outward_normal = vec3(0, 1, 0);
 		rec.set_face_normal(r, outward_normal);
-		rec.mat_ptr = mp;
+		rec.mat_id = mat_id;
+		rec.light_id = no_light;
 		rec.p = r.at(t);
 		return true;
 	}
@@ -237,7 +237,8 @@ namespace ray_tracing
 		rec.t = t;
 		vec3 outward_normal = vec3(1, 0, 0);
 		rec.set_face_normal(r, outward_normal);
-		rec.mat_ptr = mp;
+		rec.mat_id = mat_id;
+		rec.light_id = no_light;
 		rec.p = r.at(t);
 		return true;
 	}
@@ -298,17 +299,69 @@ namespace ray_tracing
 			return false;
 		}
 
-		vec3 normal = rec.normal;
-		vec3 p = rec.p;
+		//rotation keeps the side the ray came from, so front_face stays as the child set it
+		rec.p = vec3(cos_theta * rec.p[0] + sin_theta * rec.p[2], rec.p[1], -sin_theta * rec.p[0] + cos_theta * rec.p[2]);
+		rec.normal = vec3(cos_theta * rec.normal[0] + sin_theta * rec.normal[2], rec.normal[1], -sin_theta * rec.normal[0] + cos_theta * rec.normal[2]);
+		return true;
+	}
 
-		p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
-		p[1] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
-		normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
-		normal[0] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
+	//lowering into the compiled scene; objects with a material keep the id it got there for hit
+	void sphere::lower(compiled_scene& scene) const
+	{
+		mat_id = scene.add_sphere(center, radius, mat_ptr);
+	}
 
-		rec.p = p;
-		rec.set_face_normal(rotated_r, normal);
-		return true;
+	void moving_sphere::lower(compiled_scene& scene) const
+	{
+		mat_id = scene.add_moving_sphere(center0, center1, time0, time1, radius, mat_ptr);
+	}
+
+	void hittable_list::lower(compiled_scene& scene) const
+	{
+		for (const auto& object : objects)
+		{
+			scene.add(object);
+		}
+	}
+
+	//the authoring tree is discarded, the compiled scene builds its own
+	void bvh_node::lower(compiled_scene& scene) const
+	{
+		scene.add(left);
+		if (right != left)
+		{
+			scene.add(right);
+		}
+	}
+
+	void xy_rect::lower(compiled_scene& scene) const
+	{
+		mat_id = scene.add_rect(prim_xy_rect, x0, x1, y0, y1, k, mp);
+	}
+
+	void xz_rect::lower(compiled_scene& scene) const
+	{
+		mat_id = scene.add_rect(prim_xz_rect, x0, x1, z0, z1, k, mp);
+	}
+
+	void yz_rect::lower(compiled_scene& scene) const
+	{
+		mat_id = scene.add_rect(prim_yz_rect, y0, y1, z0, z1, k, mp);
+	}
+
+	void box::lower(compiled_scene& scene) const
+	{
+		sides.lower(scene);
+	}
+
+	void translate::lower(compiled_scene& scene) const
+	{
+		scene.add_translate(ptr, offset);
+	}
+
+	void rotate_y::lower(compiled_scene& scene) const
+	{
+		scene.add_rotate_y(ptr, sin_theta, cos_theta);
 	}
 
 
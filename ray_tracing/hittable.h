@@ -2,12 +2,20 @@
 
 #include"aabb.h"
 #include<algorithm>
+#include<cstdint>
 #include"constantAndTool.h"
 #include"texture.h"
 
 namespace ray_tracing
 {
 	class material;
+	class compiled_scene;
+
+	//light id of surfaces that are not sampled as lights
+	const uint32_t no_light = 0xffffffff;
+	//material id of an object no scene has lowered yet
+	const uint32_t no_material = 0xffffffff;
+
 	struct hit_record
 	{
 
@@ -17,7 +25,8 @@ namespace ray_tracing
 		double u;
 		double v;
 		bool front_face;	
-		shared_ptr<material>mat_ptr;
+		uint32_t mat_id;	//index into the scene's material_registry
+		uint32_t light_id;	//index into the scene's lights, or no_light
 
 		inline void set_face_normal(const ray& r, const vec3& outward_normal)
 		{
@@ -30,8 +39,13 @@ namespace ray_tracing
 	class hittable
 	{
 	public:
+		//the reference path, a closest hit straight through the authoring objects; it is what
+		//compiled_scene::hit gives, slower, with the material ids of the scene they were last lowered
+		//into (no_material before any) and no light ids
 		virtual bool hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const = 0;
 		virtual bool bounding_box(double t0, double t1, aabb& output_box) const = 0;
+		//emit this object into the render-time representation, see compiled_scene.h
+		virtual void lower(compiled_scene& scene) const = 0;
 	};
 
 	class sphere : public hittable
@@ -46,11 +60,13 @@ namespace ray_tracing
 			output_box = aabb(center - vec3(radius, radius, radius), center + vec3(radius, radius, radius));
 			return true;
 		}
+		virtual void lower(compiled_scene& scene) const override;
 
 	private:
 		vec3 center;
 		double radius;
 		shared_ptr<material>mat_ptr;
+		mutable uint32_t mat_id = no_material;	//set by lower
 
 	};
 
@@ -71,6 +87,7 @@ namespace ray_tracing
 			output_box = surrounding_box(box0, box1);
 			return true;
 		}
+		virtual void lower(compiled_scene& scene) const override;
 		vec3 center(double time) const
 		{
 			return center0 + ((center1 - center0) * (time - time0) / (time1 - time0));
@@ -81,6 +98,7 @@ namespace ray_tracing
 		double time0, time1;
 		double radius;
 		shared_ptr<material>mat_ptr;
+		mutable uint32_t mat_id = no_material;	//set by lower
 	};
 
 
@@ -108,6 +126,7 @@ namespace ray_tracing
 
 		virtual bool hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const override;
 		virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+		virtual void lower(compiled_scene& scene) const override;
 
 	private:
 		vector<shared_ptr<hittable>> objects;
@@ -121,6 +140,9 @@ namespace ray_tracing
 		shared_ptr<hittable>right;
 		aabb box;
 
+		//splits objects[start, end), sorting that range in place
+		void build(vector<shared_ptr<hittable>>& objects, size_t start, size_t end, double time0, double time1);
+
 	public:
 		bvh_node() = default;
 		bvh_node(hittable_list& list, double time0, double time1)
@@ -146,6 +168,8 @@ namespace ray_tracing
 			output_box = box;
 			return true;
 		}
+
+		virtual void lower(compiled_scene& scene) const override;
 	};
 
 
@@ -155,6 +179,7 @@ namespace ray_tracing
 	private:
 		double x0, x1, y0, y1, k;
 		shared_ptr<material> mp;
+		mutable uint32_t mat_id = no_material;	//set by lower
 
 	public:
 		xy_rect() = default;
@@ -169,6 +194,8 @@ namespace ray_tracing
 			return true;
 		}
 
+		virtual void lower(compiled_scene& scene) const override;
+
 	};
 
 	//xz
@@ -177,6 +204,7 @@ namespace ray_tracing
 	private:
 		double x0, x1, z0, z1, k;
 		shared_ptr<material>mp;
+		mutable uint32_t mat_id = no_material;	//set by lower
 
 	public:
 		xz_rect() = default;
@@ -189,6 +217,8 @@ namespace ray_tracing
 			output_box = aabb(vec3(x0, k - 0.0001, z0), vec3(x1, k + 0.0001, z1));
 			return true;
 		}
+
+		virtual void lower(compiled_scene& scene) const override;
 	};
 
 	//yz
@@ -197,6 +227,7 @@ namespace ray_tracing
 	private:
 		double y0, y1, z0, z1, k;
 		shared_ptr<material>mp;
+		mutable uint32_t mat_id = no_material;	//set by lower
 	public:
 		yz_rect() = default;
 		yz_rect(double _y0, double _y1, double _z0, double _z1, double _k, shared_ptr<material> mat)
@@ -209,6 +240,8 @@ namespace ray_tracing
 			output_box = aabb(vec3(k - 0.0001, y0, z0), vec3(k + 0.0001, y1, z1));
 			return true;
 		}
+
+		virtual void lower(compiled_scene& scene) const override;
 	};
 
 
@@ -234,6 +267,8 @@ namespace ray_tracing
 			output_box = aabb(box_min, box_max);
 			return true;
 		}
+
+		virtual void lower(compiled_scene& scene) const override;
 	};
 
 	inline box::box(const vec3& p0, const vec3& p1, shared_ptr<material> ptr)
@@ -265,6 +300,7 @@ namespace ray_tracing
 		virtual bool hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const override;
 
 		virtual bool bounding_box(double t0, double t1, aabb& output_box) const override;
+		virtual void lower(compiled_scene& scene) const override;
 	};
 
 	inline bool translate::hit(const ray& r, const double t_min, const double t_max, hit_record& rec) const
@@ -276,7 +312,6 @@ namespace ray_tracing
 		}
 
 		rec.p += offset;
-		rec.set_face_normal(moved_r, rec.normal);
 
 		return true;
 	}
@@ -312,11 +347,12 @@ namespace ray_tracing
 			output_box = bbox;
 			return hasbox;
 		}
+		virtual void lower(compiled_scene& scene) const override;
 	};
 
 
 	//the compare function of std::sort
-	inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable>b, int axis)
+	inline bool box_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b, int axis)
 	{
 		aabb box_a;
 		aabb box_b;
@@ -329,25 +365,25 @@ namespace ray_tracing
 		return box_a.get_min().e[axis] < box_b.get_min().e[axis];
 	}
 
-	inline bool box_x_compare(const shared_ptr<hittable>a, const shared_ptr<hittable> b)
+	inline bool box_x_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b)
 	{
 		return box_compare(a, b, 0);
 	}
 
-	inline bool box_y_compare(const shared_ptr<hittable>a, const shared_ptr<hittable> b)
+	inline bool box_y_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b)
 	{
 		return box_compare(a, b, 1);
 	}
 
-	inline bool box_z_compare(const shared_ptr<hittable>a, const shared_ptr<hittable> b)
+	inline bool box_z_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b)
 	{
 		return box_compare(a, b, 2);
 	}
 	//The UV coordinates of the sphere
 	inline void get_sphere_uv(const vec3& p, double& u, double& v)
 	{
-		auto phi = std::atan2(p.z(), p.x());
-		auto theta = std::asin(p.y());
+		auto phi = math::atan2(p.z(), p.x());
+		auto theta = math::asin(p.y());
 		u = 1 - (phi + pi) / (2 * pi);
 		v = (theta + pi / 2) / pi;
 	}
@@ -0,0 +1,401 @@
+#include"integrator.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const int max_path_vertices = 32;
+
+		//a / b per channel, 0 where b is
+		inline vec3 divide_by(const vec3& a, const vec3& b)
+		{
+			return vec3(b.x() > 0 ? a.x() / b.x() : 0, b.y() > 0 ? a.y() / b.y() : 0, b.z() > 0 ? a.z() / b.z() : 0);
+		}
+
+		//the smooth bounces of a training path, each gathering the radiance that came back along its direction
+		struct guide_path
+		{
+			struct vertex
+			{
+				dtree* region;
+				vec3 direction;
+				double pdf;
+				vec3 throughput;	//of the path past the vertex
+				vec3 radiance;
+			};
+
+			vertex vertices[max_path_vertices];
+			int count = 0;
+			bool made_ray = false;		//the newest vertex scattered the ray being traced
+
+			void push(dtree* region, const vec3& direction, double pdf, const vec3& throughput)
+			{
+				made_ray = count < max_path_vertices;
+				if (made_ray == true)
+				{
+					vertices[count++] = { region, direction, pdf, throughput, vec3(0, 0, 0) };
+				}
+			}
+
+			//contribution: what reached the camera past every vertex
+			void add(const vec3& contribution)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					vertices[i].radiance += divide_by(contribution, vertices[i].throughput);
+				}
+			}
+
+			//the vertex whose ray found the emitter takes all of emitted, the weight only splits it between strategies
+			void add_emission(const vec3& contribution, const vec3& emitted)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					vertices[i].radiance += made_ray == true && i == count - 1 ? emitted : divide_by(contribution, vertices[i].throughput);
+				}
+			}
+
+			void commit() const
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					const vertex& v = vertices[i];
+					v.region->record(v.direction, (v.radiance.x() + v.radiance.y() + v.radiance.z()) / (3 * v.pdf));
+				}
+			}
+		};
+
+		//the diffuse surfaces of a path filling the radiance cache, each gathering the light it reflected
+		struct cache_path
+		{
+			struct vertex
+			{
+				uint64_t key;
+				vec3 throughput;	//of the path up to the vertex
+				vec3 albedo;
+				vec3 radiance;
+			};
+
+			vertex vertices[max_path_vertices];
+			int count = 0;
+
+			void push(uint64_t key, const vec3& throughput, const vec3& albedo)
+			{
+				if (count < max_path_vertices)
+				{
+					vertices[count++] = { key, throughput, albedo, vec3(0, 0, 0) };
+				}
+			}
+
+			void add(const vec3& contribution)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					vertices[i].radiance += divide_by(contribution, vertices[i].throughput);
+				}
+			}
+
+			void commit(radiance_cache& cache) const
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					cache.add(vertices[i].key, divide_by(vertices[i].radiance, vertices[i].albedo));
+				}
+			}
+		};
+	}
+
+	vec3 sample_direct(const ray& r_in, const hit_record& rec, const material& mat, const compiled_scene& world, const active_media& media,
+		const guided_lobe* lobe)
+	{
+		light_sample ls;
+		if (world.sample_light(rec.p, rec.normal, r_in.get_time(), ls) == false || ls.pdf <= 0)
+		{
+			return vec3(0, 0, 0);
+		}
+
+		vec3 f = mat.eval(r_in, rec, ls.wi);
+		if (f.length_squared() <= 0)
+		{
+			return vec3(0, 0, 0);
+		}
+
+		//shadow ray, stopping just short of the light
+		double transmittance;
+		if (world.occluded(ray(rec.p, ls.wi, r_in.get_time()), 0.001, ls.dist * 0.999, media, transmittance) == true)
+		{
+			return vec3(0, 0, 0);
+		}
+
+		auto weight = power_heuristic(ls.pdf, lobe != nullptr ? lobe->pdf(mat, r_in, rec, ls.wi) : mat.pdf(r_in, rec, ls.wi));
+		return f * ls.radiance * (weight * transmittance / ls.pdf);
+	}
+
+	//what the aovs keep of the first surface the camera ray hits
+	void record_first_hit(const ray& r, const hit_record& rec, const vec3& velocity, const material& mat, aov_sample& first)
+	{
+		first.albedo = mat.albedo_at(rec);
+		first.normal = rec.normal;
+		first.depth = rec.t * r.get_direction().length();
+		first.material = static_cast<int>(rec.mat_id);
+		first.position = rec.p;
+		first.velocity = velocity;
+	}
+
+	//what the aovs keep of a camera ray that leaves the scene
+	void record_background(const ray& r, aov_sample& first)
+	{
+		first.albedo = vec3(1, 1, 1);
+		first.normal = vec3(0, 0, 0);
+		first.depth = 0;
+		first.material = -1;
+		first.position = r.get_origin();
+		first.velocity = vec3(0, 0, 0);
+	}
+
+	/*
+	Lights are reached two ways after every smooth bounce: sample_direct picks a point on one,
+	and the scattered ray may run into one. Both estimates are kept and weighted with the power
+	heuristic, so small bright lights rely on light sampling and tight glossy lobes on the material.
+	Emission seen from the camera or through a specular bounce has nothing to be weighted against.
+	Media are tracked rather than intersected: the path knows which ones it is in, starting from
+	the parity of their boundaries ahead of the camera ray, and updates that at every boundary it
+	crosses. The flight to the next surface is then sampled in closed form against those media.
+	With a path guide, smooth bounces draw from the mix of the material and the learned incoming
+	light of the region (one sample MIS, so the weight is the mixture's density), and training
+	paths hand each vertex the radiance that came back along its direction when they end.
+	With a radiance cache, a share of the paths is traced in full and hands the cache what each of
+	its diffuse surfaces reflected; the others stop at their second diffuse surface if its cell
+	has enough of those, taking the cell's average for everything past it.
+	With a photon map, light reaching the first non-specular surface through specular chains is
+	taken from the photons there, so emitters found past it through specular bounces only are
+	left out.
+	*/
+	vec3 ray_color(const ray& r_in, const vec3& background, const compiled_scene& world, int depth, bool count_emitted, aov_sample* first,
+		path_guide* guide, radiance_cache* cache, const photon_map* photons, double spread)
+	{
+		if (first != nullptr)
+		{
+			record_background(r_in, *first);
+		}
+
+		vec3 color(0, 0, 0);
+		vec3 throughput(1, 1, 1);
+		ray r = r_in;
+		//density of the bounce that produced r, 0 for the camera ray and specular bounces
+		double scatter_pdf = 0;
+		vec3 scatter_origin, scatter_normal;
+		guide_path path;
+		cache_path filled;
+		const bool fills_cache = cache != nullptr && random_double() < cache->get_settings().training_fraction;
+		bool after_diffuse = false;
+		int segments = 0;
+		bool gathered = false;
+		//every bounce since the surface the photons were gathered at was specular
+		bool in_caustic_chain = false;
+		//length of the path so far; the cone keeps its spread through every bounce, as if surfaces were flat
+		double travelled = 0;
+
+		active_media media;
+		if (world.medium_count() > 0)
+		{
+			world.find_media(r, 0.001, media);
+		}
+
+		for (int bounce = 0; depth > 0; --depth, ++bounce)
+		{
+			start_bounce(bounce);
+			segments = bounce + 1;
+			hit_record rec;
+			//only the cone and the first hit's aovs look past the record
+			hit_detail detail;
+			hit_detail* wanted = spread > 0 || first != nullptr ? &detail : nullptr;
+			bool is_hitted = false;
+			double t_min = 0.001;
+			//nothing past t_bound matters, the path scatters there if not before
+			uint32_t bounding;
+			auto t_bound = world.draw_collisions(media, r, t_min, bounding);
+			int scatterer;
+			for (;;)
+			{
+				medium_crossings crossings;
+				crossings.known_clear = bounding;
+				is_hitted = world.trace(r, t_min, t_bound, rec, crossings, wanted);
+				for (int i = 0; i < crossings.count && media.nearest_collision(scatterer) >= crossings.t[i]; ++i)
+				{
+					auto id = crossings.medium[i];
+					if (media.contains(id) == false)
+					{
+						media.enter(id, world.draw_collision(id, r, crossings.t[i]));
+					}
+					else
+					{
+						media.exit(id);
+					}
+				}
+
+				auto t_collision = media.nearest_collision(scatterer);
+				if (scatterer >= 0 && t_collision <= (is_hitted == true ? rec.t : t_bound))
+				{
+					world.medium_interaction(media.ids[scatterer], r, t_collision, rec);
+					detail = hit_detail();
+					is_hitted = true;
+				}
+				else if (is_hitted == false && t_bound < infinity)
+				{
+					//the medium bounding the search was left before its collision after all, carry on past it
+					t_min = t_bound;
+					t_bound = infinity;
+					bounding = no_medium;
+					continue;
+				}
+				break;
+			}
+			if (is_hitted == false)
+			{
+				color += throughput * background;
+				path.add_emission(throughput * background, background);
+				filled.add(throughput * background);
+				break;
+			}
+
+			const material& mat = world.get_material(rec.mat_id);
+			auto segment = rec.t * r.get_direction().length();
+			double footprint = 0;
+			if (spread > 0 && rec.normal.length_squared() > 0)
+			{
+				//stretched across the surface as the cone meets it at a slant
+				auto cosine = fabs(dot(rec.normal, r.get_direction())) / r.get_direction().length();
+				footprint = spread * (travelled + segment) / ffmax(cosine, 0.05) * detail.uv_per_unit;
+			}
+			use_footprint(footprint);
+			if (first != nullptr)
+			{
+				record_first_hit(r, rec, detail.velocity, mat, *first);
+				first = nullptr;
+			}
+			vec3 emitted = count_emitted == true && (in_caustic_chain == false || scatter_pdf > 0) ? mat.emitted(rec.u, rec.v, rec.p) : vec3(0, 0, 0);
+			if (emitted.length_squared() > 0)
+			{
+				auto weight = scatter_pdf > 0 ? power_heuristic(scatter_pdf, world.light_pdf(scatter_origin, scatter_normal, r.get_time(), rec)) : 1.0;
+				color += throughput * emitted * weight;
+				path.add_emission(throughput * emitted * weight, emitted);
+				filled.add(throughput * emitted * weight);
+			}
+
+			if (cache != nullptr && mat.is_diffuse() == true)
+			{
+				auto key = cache->key(rec.p, rec.normal);
+				vec3 cached;
+				if (fills_cache == true)
+				{
+					filled.push(key, throughput, mat.albedo_at(rec));
+				}
+				else if (after_diffuse == true && cache->lookup(key, cached) == true)
+				{
+					color += throughput * mat.albedo_at(rec) * cached;
+					break;
+				}
+				after_diffuse = true;
+			}
+
+			scatter_record srec;
+			auto is_scattered = mat.sample(r, rec, srec);
+			//the guide takes its share of the smooth bounces, those the material alone would have absorbed too
+			dtree* region = nullptr;
+			if (guide != nullptr && mat.is_emissive() == false && (is_scattered == false || srec.is_specular == false))
+			{
+				region = guide->find(rec.p);
+			}
+			guided_lobe lobe{ region, guide != nullptr ? guide->get_settings().bsdf_fraction : 1.0 };
+			const bool is_guided = region != nullptr && region->can_sample() == true;
+			if (is_scattered == false && is_guided == false)
+			{
+				break;
+			}
+
+			const bool is_smooth = is_guided == true || srec.is_specular == false;
+			in_caustic_chain = in_caustic_chain == true && is_smooth == false;
+			if (photons != nullptr && is_smooth == true && gathered == false && rec.normal.length_squared() > 0)
+			{
+				auto caustic = throughput * photons->estimate(r, rec, mat);
+				color += caustic;
+				path.add(caustic);
+				filled.add(caustic);
+				gathered = true;
+				in_caustic_chain = true;
+			}
+
+			if (is_smooth == true && world.light_count() > 0)
+			{
+				auto direct = throughput * sample_direct(r, rec, mat, world, media, is_guided == true ? &lobe : nullptr);
+				color += direct;
+				path.add(direct);
+				filled.add(direct);
+			}
+
+			if (is_guided == true)
+			{
+				auto use_guide = sample_1d(dim_bsdf_lobe) >= lobe.bsdf_fraction;
+				if (use_guide == false && is_scattered == false)
+				{
+					break;
+				}
+				vec3 wi;
+				if (use_guide == true)
+				{
+					double u, v;
+					sample_2d(dim_bsdf, u, v);
+					wi = region->sample(u, v);
+				}
+				else
+				{
+					wi = unit_vector(srec.scattered.get_direction());
+				}
+				auto f = mat.eval(r, rec, wi);
+				auto pdf = lobe.pdf(mat, r, rec, wi);
+				if (pdf <= 0 || f.length_squared() <= 0)
+				{
+					break;
+				}
+				srec.scattered = ray(rec.p, wi, r.get_time());
+				srec.attenuation = f / pdf;
+				srec.pdf = pdf;
+				srec.is_specular = false;
+			}
+
+			throughput = throughput * srec.attenuation;
+			if (region != nullptr && guide->is_training() == true && srec.pdf > 0)
+			{
+				path.push(region, unit_vector(srec.scattered.get_direction()), srec.pdf, throughput);
+			}
+			else
+			{
+				path.made_ray = false;
+			}
+			scatter_pdf = srec.is_specular == true ? 0 : srec.pdf;
+			scatter_origin = rec.p;
+			scatter_normal = rec.normal;
+			count_emitted = true;
+			//media collisions have no surface to share with a boundary
+			if (rec.normal.length_squared() > 0 && world.medium_count() > 0)
+			{
+				world.cross_at_surface(r.get_direction(), srec.scattered, media);
+			}
+			travelled += segment;
+			r = srec.scattered;
+		}
+
+		if (guide != nullptr && guide->is_training() == true)
+		{
+			path.commit();
+		}
+		if (cache != nullptr)
+		{
+			filled.commit(*cache);
+			cache->count_path(segments);
+		}
+		use_footprint(0);
+		return color;
+	}
+}
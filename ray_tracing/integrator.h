@@ -0,0 +1,38 @@
+#pragma once
+
+#include"aov.h"
+#include"compiled_scene.h"
+#include"constantAndTool.h"
+#include"guiding.h"
+#include"material.h"
+#include"photon_map.h"
+#include"radiance_cache.h"
+
+namespace ray_tracing
+{
+	//radiance arriving along r, following at most depth bounces
+	//count_emitted is false when the lights r may hit were already estimated where r starts
+	//first, when given, receives what r meets first
+	//guide, when given, takes a share of the smooth bounces and learns from the path while training
+	//cache, when given, either ends the path at its second diffuse surface or is filled by it
+	//photons, when given, estimate the caustics at the first non-specular surface
+	//spread is the angle of the pixel's ray cone, which picks the texture level; 0 reads the finest
+	vec3 ray_color(const ray& r, const vec3& background, const compiled_scene& world, int depth, bool count_emitted = true, aov_sample* first = nullptr,
+		path_guide* guide = nullptr, radiance_cache* cache = nullptr, const photon_map* photons = nullptr, double spread = 0);
+
+	void record_first_hit(const ray& r, const hit_record& rec, const vec3& velocity, const material& mat, aov_sample& first);
+	void record_background(const ray& r, aov_sample& first);
+
+	//next-event estimation: light reaching rec straight from one sampled point on a light,
+	//weighted against the chance of the material sampling the same direction;
+	//media is what rec is inside, for the transmittance of the shadow ray; lobe, when given, is
+	//what the bounce from rec samples instead of the material alone
+	vec3 sample_direct(const ray& r_in, const hit_record& rec, const material& mat, const compiled_scene& world, const active_media& media,
+		const guided_lobe* lobe = nullptr);
+
+	//multiple importance sampling weight of a strategy with density f against one with density g
+	inline double power_heuristic(double f, double g)
+	{
+		return f * f / (f * f + g * g);
+	}
+}
@@ -0,0 +1,357 @@
+#include "light_tree.h"
+
+#include<algorithm>
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const int light_bins = 12;
+		const int max_saoh_depth = 40;
+
+		inline double safe_sqrt(double x)
+		{
+			return sqrt(ffmax(0.0, x));
+		}
+
+		inline double safe_acos(double x)
+		{
+			return acos(clamp(x, -1.0, 1.0));
+		}
+
+		//cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+		inline double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+		{
+			return cos_a > cos_b ? 1 : cos_a * cos_b + sin_a * sin_b;
+		}
+
+		inline double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+		{
+			return cos_a > cos_b ? 0 : sin_a * cos_b - cos_a * sin_b;
+		}
+
+		//v rotated by theta around the unit axis k
+		inline vec3 rotate(const vec3& v, const vec3& k, double theta)
+		{
+			auto c = cos(theta);
+			return v * c + cross(k, v) * sin(theta) + k * (dot(k, v) * (1 - c));
+		}
+
+		double box_area(const aabb& box)
+		{
+			vec3 d = box.get_max() - box.get_min();
+			return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+		}
+
+		//smallest cone holding the two cones of a and b, written into a
+		void merge_cones(light_bounds& a, const light_bounds& b)
+		{
+			auto theta_a = safe_acos(a.cos_theta_o);
+			auto theta_b = safe_acos(b.cos_theta_o);
+			auto theta_d = safe_acos(dot(a.axis, b.axis));
+			if (ffmin(theta_d + theta_b, pi) <= theta_a)
+			{
+				return;
+			}
+			if (ffmin(theta_d + theta_a, pi) <= theta_b)
+			{
+				a.axis = b.axis;
+				a.cos_theta_o = b.cos_theta_o;
+				return;
+			}
+
+			auto theta_o = (theta_a + theta_d + theta_b) / 2;
+			vec3 k = cross(a.axis, b.axis);
+			if (theta_o >= pi || k.length_squared() <= 0)
+			{
+				a.cos_theta_o = -1;
+				return;
+			}
+			a.axis = unit_vector(rotate(a.axis, unit_vector(k), theta_o - theta_a));
+			a.cos_theta_o = cos(theta_o);
+		}
+
+		light_bounds merge(const light_bounds& a, const light_bounds& b)
+		{
+			light_bounds result = a;
+			result.box = surrounding_box(a.box, b.box);
+			merge_cones(result, b);
+			result.cos_theta_e = ffmin(a.cos_theta_e, b.cos_theta_e);
+			result.power = a.power + b.power;
+			result.two_sided = a.two_sided || b.two_sided;
+			return result;
+		}
+
+		//solid angle measure of the directions the cone emits into, the orientation term of the split cost
+		double orientation_measure(const light_bounds& b)
+		{
+			auto theta_o = safe_acos(b.cos_theta_o);
+			auto theta_e = safe_acos(b.cos_theta_e);
+			auto theta_w = ffmin(theta_o + theta_e, pi);
+			auto sin_o = sin(theta_o);
+			return 2 * pi * (1 - b.cos_theta_o)
+				+ pi / 2 * (2 * theta_w * sin_o - cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_o + b.cos_theta_o);
+		}
+
+		double split_cost(const light_bounds& b)
+		{
+			return b.power * orientation_measure(b) * box_area(b.box);
+		}
+
+		//conservative estimate of the light the group sends to x; n is the surface normal or zero
+		double importance(const light_bounds& b, const vec3& x, const vec3& n)
+		{
+			vec3 center = (b.box.get_min() + b.box.get_max()) * 0.5;
+			auto radius = (b.box.get_max() - b.box.get_min()).length() / 2;
+			vec3 d = x - center;
+			auto dist_squared = ffmax(d.length_squared(), radius);
+			//from inside the bounding sphere every light of the group may face x
+			if (d.length_squared() < radius * radius)
+			{
+				return b.power / dist_squared;
+			}
+			vec3 wi = unit_vector(d);
+
+			//angle between the cone axis and the direction to x
+			auto cos_theta_w = dot(b.axis, wi);
+			if (b.two_sided == true)
+			{
+				cos_theta_w = std::fabs(cos_theta_w);
+			}
+			auto sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+
+			//half angle of the bounding sphere as seen from x
+			auto cos_theta_b = safe_sqrt(1 - radius * radius / d.length_squared());
+			auto sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+			//smallest angle between any emitting normal and any direction from the group to x
+			auto sin_theta_o = safe_sqrt(1 - b.cos_theta_o * b.cos_theta_o);
+			auto cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, b.cos_theta_o);
+			auto sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, b.cos_theta_o);
+			auto cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+			if (cos_theta_p <= b.cos_theta_e)
+			{
+				return 0;
+			}
+
+			auto result = b.power * cos_theta_p / dist_squared;
+			if (n.length_squared() > 0)
+			{
+				auto cos_theta_i = std::fabs(dot(wi, n));
+				auto sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+				result *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+			}
+			return ffmax(result, 0.0);
+		}
+	}
+
+	void light_tree::build(const vector<light_bounds>& lights)
+	{
+		nodes.clear();
+		trails.assign(lights.size(), 0);
+		if (lights.empty() == true)
+		{
+			return;
+		}
+
+		vector<build_item> items(lights.size());
+		for (size_t i = 0; i < lights.size(); ++i)
+		{
+			items[i].light = static_cast<uint32_t>(i);
+			items[i].bounds = lights[i];
+			items[i].centroid = (lights[i].box.get_min() + lights[i].box.get_max()) * 0.5;
+		}
+		nodes.reserve(2 * lights.size() - 1);
+		build(items, 0, items.size(), 0, 0);
+	}
+
+	//binned split over power, box area and orientation spread, falling back to the median
+	uint32_t light_tree::build(vector<build_item>& items, size_t start, size_t end, int depth, uint64_t trail)
+	{
+		auto node_index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(light_tree_node());
+
+		light_bounds bounds = items[start].bounds;
+		vec3 cmin = items[start].centroid, cmax = items[start].centroid;
+		for (size_t i = start + 1; i < end; ++i)
+		{
+			bounds = merge(bounds, items[i].bounds);
+			for (int a = 0; a < 3; ++a)
+			{
+				cmin.e[a] = ffmin(cmin.e[a], items[i].centroid.e[a]);
+				cmax.e[a] = ffmax(cmax.e[a], items[i].centroid.e[a]);
+			}
+		}
+		nodes[node_index].bounds = bounds;
+
+		if (end - start == 1)
+		{
+			nodes[node_index].offset = items[start].light;
+			nodes[node_index].count = 1;
+			trails[items[start].light] = trail;
+			return node_index;
+		}
+
+		vec3 extent = cmax - cmin;
+		int axis = 0;
+		if (extent.y() > extent.e[axis]) axis = 1;
+		if (extent.z() > extent.e[axis]) axis = 2;
+
+		size_t mid = start;
+		if (depth < max_saoh_depth)
+		{
+			auto best_cost = infinity;
+			int best_axis = -1, best_split = 0;
+			for (int a = 0; a < 3; ++a)
+			{
+				if (extent.e[a] <= 0)
+				{
+					continue;
+				}
+
+				int counts[light_bins] = {};
+				light_bounds bins[light_bins];
+				for (size_t i = start; i < end; ++i)
+				{
+					auto b = std::min(static_cast<int>(light_bins * (items[i].centroid.e[a] - cmin.e[a]) / extent.e[a]), light_bins - 1);
+					bins[b] = counts[b] == 0 ? items[i].bounds : merge(bins[b], items[i].bounds);
+					++counts[b];
+				}
+
+				//splits that are thin along the box's long axis are penalized
+				auto regularization = extent.e[axis] / extent.e[a];
+				for (int split = 0; split < light_bins - 1; ++split)
+				{
+					light_bounds left, right;
+					int left_count = 0, right_count = 0;
+					for (int b = 0; b <= split; ++b)
+					{
+						if (counts[b] > 0)
+						{
+							left = left_count == 0 ? bins[b] : merge(left, bins[b]);
+							left_count += counts[b];
+						}
+					}
+					for (int b = split + 1; b < light_bins; ++b)
+					{
+						if (counts[b] > 0)
+						{
+							right = right_count == 0 ? bins[b] : merge(right, bins[b]);
+							right_count += counts[b];
+						}
+					}
+					if (left_count == 0 || right_count == 0)
+					{
+						continue;
+					}
+
+					auto cost = regularization * (split_cost(left) + split_cost(right));
+					if (cost < best_cost)
+					{
+						best_cost = cost;
+						best_axis = a;
+						best_split = split;
+					}
+				}
+			}
+
+			if (best_axis >= 0)
+			{
+				auto pivot = std::partition(items.begin() + start, items.begin() + end, [&](const build_item& item)
+				{
+					auto b = std::min(static_cast<int>(light_bins * (item.centroid.e[best_axis] - cmin.e[best_axis]) / extent.e[best_axis]), light_bins - 1);
+					return b <= best_split;
+				});
+				mid = pivot - items.begin();
+			}
+		}
+
+		//coincident centroids, or too deep for the trail: split by count
+		if (mid == start || mid == end)
+		{
+			mid = (start + end) / 2;
+			std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end, [axis](const build_item& a, const build_item& b)
+			{
+				return a.centroid.e[axis] < b.centroid.e[axis];
+			});
+		}
+
+		nodes[node_index].count = 0;
+		build(items, start, mid, depth + 1, trail);
+		nodes[node_index].offset = build(items, mid, end, depth + 1, trail | (uint64_t(1) << depth));
+		return node_index;
+	}
+
+	bool light_tree::sample(const vec3& x, const vec3& n, uint32_t& light, double& pmf) const
+	{
+		if (nodes.empty() == true)
+		{
+			return false;
+		}
+
+		//one uniform number, rescaled at every level
+		auto u = sample_1d(dim_light_select);
+		uint32_t index = 0;
+		pmf = 1;
+		while (nodes[index].count == 0)
+		{
+			auto left = index + 1;
+			auto right = nodes[index].offset;
+			auto importance_left = importance(nodes[left].bounds, x, n);
+			auto importance_right = importance(nodes[right].bounds, x, n);
+			if (importance_left <= 0 && importance_right <= 0)
+			{
+				return false;
+			}
+
+			auto p_left = importance_left / (importance_left + importance_right);
+			if (u < p_left)
+			{
+				u = ffmin(u / p_left, 1 - 1e-12);
+				pmf *= p_left;
+				index = left;
+			}
+			else
+			{
+				u = ffmin((u - p_left) / (1 - p_left), 1 - 1e-12);
+				pmf *= 1 - p_left;
+				index = right;
+			}
+		}
+
+		light = nodes[index].offset;
+		return true;
+	}
+
+	double light_tree::pmf(const vec3& x, const vec3& n, uint32_t light) const
+	{
+		uint64_t trail = trails[light];
+		uint32_t index = 0;
+		double result = 1;
+		while (nodes[index].count == 0)
+		{
+			auto left = index + 1;
+			auto right = nodes[index].offset;
+			auto importance_left = importance(nodes[left].bounds, x, n);
+			auto importance_right = importance(nodes[right].bounds, x, n);
+			if (importance_left <= 0 && importance_right <= 0)
+			{
+				return 0;
+			}
+
+			auto p_left = importance_left / (importance_left + importance_right);
+			if ((trail & 1) == 0)
+			{
+				result *= p_left;
+				index = left;
+			}
+			else
+			{
+				result *= 1 - p_left;
+				index = right;
+			}
+			trail >>= 1;
+		}
+		return result;
+	}
+}
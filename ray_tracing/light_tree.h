@@ -0,0 +1,63 @@
+#pragma once
+
+#include<cstdint>
+#include"aabb.h"
+#include"constantAndTool.h"
+
+namespace ray_tracing
+{
+	//what the light tree needs to know about one light, or about a group of them
+	struct light_bounds
+	{
+		aabb box;
+		vec3 axis;				//center of the cone holding every emitting normal
+		double cos_theta_o;		//spread of the normals around axis, -1 when they point everywhere
+		double cos_theta_e;		//how far past its normal a point still emits, 0 for diffuse emitters
+		double power;
+		bool two_sided;			//emits along -normal as well
+	};
+
+	//count == 0 marks an interior node: the left child follows it, offset is the right child
+	//count == 1 marks a leaf: offset is the light
+	struct light_tree_node
+	{
+		light_bounds bounds;
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	/*
+	Bounding hierarchy over the scene's lights for many-light sampling.
+	Each node keeps the box, total power and orientation cone of the lights below it, which bound
+	how much they can contribute to a shading point. Sampling walks from the root and picks a child
+	in proportion to that bound, so a light is chosen in logarithmic time and faraway, dim or
+	back-facing groups are rarely visited.
+	*/
+	class light_tree
+	{
+	public:
+		void build(const vector<light_bounds>& lights);
+
+		//choose a light for the shading point x with normal n (zero inside media),
+		//false when no light can reach x
+		bool sample(const vec3& x, const vec3& n, uint32_t& light, double& pmf) const;
+		//probability that sample chooses the given light
+		double pmf(const vec3& x, const vec3& n, uint32_t light) const;
+
+		size_t node_count() const { return nodes.size(); }
+
+	private:
+		struct build_item
+		{
+			uint32_t light;
+			light_bounds bounds;
+			vec3 centroid;
+		};
+
+		vector<light_tree_node> nodes;
+		//left (0) and right (1) turns from the root to each light, lowest bit first
+		vector<uint64_t> trails;
+
+		uint32_t build(vector<build_item>& items, size_t start, size_t end, int depth, uint64_t trail);
+	};
+}
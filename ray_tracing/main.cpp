@@ -1,292 +1,168 @@
 #pragma once
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 #include"material.h"
 #include"texture.h"
 #include"constantAndTool.h"
 #include "aabb.h"
 #include "constant_medium.h"
 #include"hittable.h"
+#include"scenes.h"
+#include"bench.h"
+#include"compiled_scene.h"
+#include"integrator.h"
+#include"renderer.h"
+#include"denoiser.h"
+#include"asset_loader.h"
+#include<atomic>
+#include<chrono>
+#include<cstring>
+#include<fstream>
 
 namespace ray_tracing
 {
-	static hittable_list final_scene() {
-		hittable_list boxes1;
-		auto ground =
-			make_shared<lambertian>(make_shared<constant_texture>(vec3(0.48, 0.83, 0.53)));
-
-		const int boxes_per_side = 20;
-		for (int i = 0; i < boxes_per_side; i++) {
-			for (int j = 0; j < boxes_per_side; j++) {
-				auto w = 100.0;
-				auto x0 = -1000.0 + i * w;
-				auto z0 = -1000.0 + j * w;
-				auto y0 = 0.0;
-				auto x1 = x0 + w;
-				auto y1 = random_double(1, 101);
-				auto z1 = z0 + w;
+	//denoised renders stop at 64 samples, the filter makes up the rest
+	//exr_path, when given, also gets every aov channel
+	//streamed renders go out in bands of rows as binary ppm, and are neither denoised nor written to exr
+	//a budget in seconds renders passes until it is spent, the sample count then only a cap
+	static void output_image(direct_lighting direct, sampler_type sampler, bool guided, bool cached, bool caustics, bool denoised, const char* exr_path,
+		bool streamed, int width, int height, double budget, bool noisy_first)
+	{
+		auto start = std::chrono::steady_clock::now();
+		render_settings settings;
+		settings.width = width;
+		//settings.width = 192 * 4;
+		settings.height = height;
+		//settings.height = 108 * 4;
+		settings.samples_per_pixel = denoised == true ? 64 : 10000;
+		settings.max_depth = 50;
+		settings.direct = direct;
+		settings.sampler = sampler;
+		settings.guiding.enabled = guided;
+		settings.cache.enabled = cached;
+		settings.photons.enabled = caustics;
+		settings.aovs = exr_path != nullptr ? all_aovs : denoised == true ? denoise_aovs : 0;
+		const vec3 background(0, 0, 0);
 
-				boxes1.add(make_shared<box>(vec3(x0, y0, z0), vec3(x1, y1, z1), ground));
+		compiled_scene world(final_scene(), 0.0, 1.0);
+		std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+		//textures are still decoding while the render starts
+		std::atomic<bool> first_tile(false);
+		std::chrono::duration<double> first_pixel_time(0);
+		size_t loading_at_first_pixel = 0;
+		settings.on_tile = [&](const tile&)
+		{
+			if (first_tile.exchange(true) == false)
+			{
+				first_pixel_time = std::chrono::steady_clock::now() - start;
+				loading_at_first_pixel = asset_loader::global().pending();
 			}
-		}
-
-		hittable_list objects;
-
-		objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-
-		auto light = make_shared<diffus_light>(make_shared<constant_texture>(vec3(7, 7, 7)));
-		objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
-
-		auto center1 = vec3(400, 400, 200);
-		auto center2 = center1 + vec3(30, 0, 0);
-		auto moving_sphere_material =
-			make_shared<lambertian>(make_shared<constant_texture>(vec3(0.7, 0.3, 0.1)));
-		objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-		objects.add(make_shared<sphere>(vec3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-		objects.add(make_shared<sphere>(
-			vec3(0, 150, 145), 50, make_shared<metal>(vec3(0.8, 0.8, 0.9), 10.0)
-			));
-
-		auto boundary = make_shared<sphere>(vec3(360, 150, 145), 70, make_shared<dielectric>(1.5));
-		objects.add(boundary);
-		objects.add(make_shared<constant_medium>(
-			boundary, 0.2, make_shared<constant_texture>(vec3(0.2, 0.4, 0.9))
-			));
-		boundary = make_shared<sphere>(vec3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-		objects.add(make_shared<constant_medium>(
-			boundary, .0001, make_shared<constant_texture>(vec3(1, 1, 1))));
+		};
+		vec3 lookfrom(278, 450, -800);
+		vec3 lookat(278, 490, 0);
+		vec3 up_vector(0, 1, 0);
+		auto dist_to_focus = 10.0;
+		auto aperture = 0.0;
+		const auto aspect_ratio = double(settings.width) / settings.height;
 
-		int nx, ny, nn;
-		auto tex_data = stbi_load("Bronya.jpg", &nx, &ny, &nn, 0);
-		auto emat = make_shared<lambertian>(make_shared<image_texture>(tex_data, nx, ny));
-		objects.add(make_shared<sphere>(vec3(400, 200, 400), 100, emat));
-		auto pertext = make_shared<noise_texture>(0.1);
-		objects.add(make_shared<sphere>(vec3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+		camera cam(lookfrom, lookat, up_vector, 40.0, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
 
-		hittable_list boxes2;
-		auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
-		int ns = 1000;
-		for (int j = 0; j < ns; j++) {
-			boxes2.add(make_shared<sphere>(vec3::random(0, 165), 10, white));
+		if (streamed == true)
+		{
+			auto held = render_bands(world, cam, background, settings, cout, 64);
+			std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+			cerr << "scene built in " << build_time.count() << " s, first pixel after " << first_pixel_time.count() << " s, streamed after "
+				<< render_time.count() << " s holding " << held / 1048576.0 << " MB of bands" << endl;
+			return;
 		}
 
-		objects.add(make_shared<translate>(
-			make_shared<rotate_y>(
-				make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-			vec3(-100, 270, 395)
-			)
-		);
-
-		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
-	}
-	static hittable_list cornell_box()
-	{
-		hittable_list objects;
-		auto red = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.65, 0.05, 0.05)));
-		auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
-		auto green = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.12, 0.45, 0.15)));
-		auto light = make_shared<diffus_light>(make_shared<constant_texture>(vec3(7, 7, 7)));
-
-		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-		objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-		objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-		objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-		objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-		shared_ptr<hittable> box1 = make_shared<box>(vec3(0, 0, 0), vec3(165, 330, 165), white);
-		box1 = make_shared<rotate_y>(box1, 15);
-		box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-		objects.add(box1);
-		
-		shared_ptr<hittable> box2 = make_shared<box>(vec3(0, 0, 0), vec3(165, 165, 165), white);
-		box2 = make_shared<rotate_y>(box2, -18);
-		box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-		objects.add(box2);
-
-		objects.add(make_shared<constant_medium>(box1, 0.01, make_shared<constant_texture>(vec3(0, 0, 0))));
-		objects.add(make_shared<constant_medium>(box2, 0.01, make_shared<constant_texture>(vec3(1, 1, 1))));
-		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
-	}
-
-	//About the rectangle and the light source
-	static hittable_list simple_light()
-	{
-		hittable_list objects;
-		auto pertext = make_shared<noise_texture>(4);
-		objects.add(make_shared<sphere>(vec3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-		objects.add(make_shared<sphere>(vec3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-		auto diff_light = make_shared<diffus_light>(make_shared<constant_texture>(vec3(4, 4, 4)));
-		//objects.add(make_shared<sphere>(vec3(0, 7, 0), 2, diff_light));
-		objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, diff_light));
-
-		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
-		//return objects;
-	}
-
-	static hittable_list texture_mapping()
-	{
-		int nx, ny, nn;
-		unsigned char* texture_data = stbi_load("Bronya.jpg", &nx, &ny, &nn, 0);
-
-		auto bronya_surface = make_shared<lambertian>(make_shared<image_texture>(texture_data, nx, ny));
-		auto bronya = make_shared<sphere>(vec3(0, 0, 0), 2, bronya_surface);
-		return hittable_list(bronya);
-	}
-
-	//about perlin noise
-	static hittable_list two_perlin_spheres()
-	{
-
-		hittable_list objects;
-		auto pertext = make_shared<noise_texture>(5.0);
-		objects.add(make_shared<sphere>(vec3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-		objects.add(make_shared<sphere>(vec3(0, 1, 0), 1, make_shared<lambertian>(pertext)));
-		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
-
+		framebuffer image;
+		if (budget > 0)
+		{
+			auto stats = render_budgeted(world, cam, background, settings, budget, noisy_first, image);
+			cerr << stats.passes << " passes in " << stats.seconds << " s, " << stats.fewest_samples << " to " << stats.most_samples
+				<< " samples a pixel, " << stats.mean_samples << " on average" << endl;
+		}
+		else
+		{
+			render(world, cam, background, settings, image);
+		}
+		std::chrono::duration<double> render_time = std::chrono::steady_clock::now() - start;
+		cerr << "scene built in " << build_time.count() << " s, first pixel after " << first_pixel_time.count() << " s with "
+			<< loading_at_first_pixel << " assets still loading, rendered after " << render_time.count() << " s" << endl;
+		if (denoised == true)
+		{
+			denoise(image, denoise_settings());
+		}
+		write_image(cout, image);
+		if (exr_path != nullptr)
+		{
+			std::ofstream exr(exr_path, std::ios::binary);
+			write_exr(exr, image);
+		}
+		cerr << endl << "Done." << endl;
 	}
+}
 
-	//about rgb texture
-	static hittable_list two_spheres()
+int main(int argc, char* argv[])
+{
+	int exit_code = 0;
+	if (argc > 1 && ray_tracing::run_benchmark(argv[1], exit_code) == true)
 	{
-		hittable_list objects;
-
-		auto checkerboard = make_shared<checker_texture>
-			(
-			make_shared<constant_texture>(vec3(0.2, 0.3, 0.1)),
-			make_shared<constant_texture>(vec3(0.9, 0.9, 0.9))
-			);
-		objects.add(make_shared<sphere>(vec3(0, -10, 0), 10, make_shared<lambertian>(checkerboard)));
-		objects.add(make_shared<sphere>(vec3(0, 10, 0), 10, make_shared<lambertian>(checkerboard)));
-
-		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+		return exit_code;
 	}
 
-	static hittable_list random_scene()
+	bool restir = false, denoised = false, guided = false, cached = false, caustics = false, streamed = false;
+	bool noisy_first = false;
+	int width = 1920, height = 1080;
+	double budget = 0;
+	const char* exr_path = nullptr;
+	auto sampler = ray_tracing::sampler_independent;
+	for (int i = 1; i < argc; ++i)
 	{
-		hittable_list world;
-
-		auto checkerboard = make_shared<checker_texture>(make_shared<constant_texture>(vec3(0.2, 0.3, 0.1)),
-			make_shared<constant_texture>(vec3(0.9, 0.9, 0.9)));
-		world.add(make_shared<sphere>(vec3(0, -1000, 0), 1000, make_shared<lambertian>(checkerboard)));
-
-		int i = 1;
-		for (int a = -10; a < 10; ++a)
+		restir = restir || strcmp(argv[i], "--restir") == 0;
+		denoised = denoised || strcmp(argv[i], "--denoise") == 0;
+		guided = guided || strcmp(argv[i], "--guide") == 0;
+		cached = cached || strcmp(argv[i], "--cache") == 0;
+		caustics = caustics || strcmp(argv[i], "--photons") == 0;
+		streamed = streamed || strcmp(argv[i], "--stream") == 0;
+		noisy_first = noisy_first || strcmp(argv[i], "--noisy-first") == 0;
+		if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
 		{
-			for (int b = -10; b < 10; ++b)
-			{
-				auto choose_mat = random_double();
-				vec3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-				if ((center - vec3(4, 0.2, 0)).length() > 0.9)
-				{
-					if (choose_mat < 0.8)
-					{
-						//diffuse
-						auto albedo = vec3::random() * vec3::random();
-						world.add(make_shared<moving_sphere>(center, center + vec3(0, random_double(0, 0.5), 0), 0.0, 1.0, 0.2, make_shared<lambertian>(make_shared<constant_texture>(albedo))));
-					}
-					else if (choose_mat < 0.95)
-					{
-						//metal
-						auto albedo = vec3::random(0.5, 1);
-						auto fuzz = random_double(0, 0.5);
-						world.add(make_shared<sphere>(center, 0.2, make_shared<metal>(albedo, fuzz)));
-					}
-					else
-					{
-						//glass
-						world.add(make_shared<sphere>(center, 0.2, make_shared<dielectric>(1.5)));
-					}
-				}
-			}
+			budget = atof(argv[++i]);
 		}
-
-		world.add(make_shared<sphere>(vec3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
-
-		world.add(
-			make_shared<sphere>(vec3(-4, 1, 0), 1.0, make_shared<lambertian>(make_shared<constant_texture>(vec3(0.4, 0.2, 0.1)))));
-
-		world.add(
-			make_shared<sphere>(vec3(4, 1, 0), 1.0, make_shared<metal>(vec3(0.7, 0.6, 0.5), 0.0)));
-
-		return static_cast<hittable_list>(make_shared<bvh_node>(world, 0.0, 1.0));
-	}
-
-	static vec3 ray_color(const ray& r, const vec3& background,  const hittable& world, int depth)
-	{
-
-		hit_record rec;
-
-		if (depth <= 0)
+		if (strcmp(argv[i], "--size") == 0 && i + 2 < argc)
 		{
-			return vec3(0, 0, 0);
+			width = std::max(1, atoi(argv[++i]));
+			height = std::max(1, atoi(argv[++i]));
 		}
-		if (world.hit(r, 0.001, infinity, rec) == false)
+		if (strcmp(argv[i], "--exr") == 0 && i + 1 < argc)
 		{
-			return background;
+			exr_path = argv[++i];
 		}
-		ray scattered;
-		vec3 attenuation;
-		vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-		if (rec.mat_ptr->scatter(r, rec, attenuation, scattered) == false)
+		if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
 		{
-			return emitted;
+			ray_tracing::texture_cache::global().set_budget(static_cast<size_t>(atof(argv[++i]) * 1048576));
 		}
-
-		return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
-		
-	}
-
-
-	static void output_image()
-	{
-		const int image_width = 1920;
-		//const int image_width = 192 * 4;
-		const int image_height = 1080;
-		//const int image_height = 108 * 4;
-		const int samples_per_pixel = 10000;
-		const int max_depth = 50;
-		const vec3 background(0, 0, 0);
-
-		cout << "P3" << endl << image_width << ' ';
-		cout << image_height << endl << "255" << endl;
-
-		auto world = final_scene();
-		vec3 lookfrom(278, 450, -800);
-		vec3 lookat(278, 490, 0);
-		vec3 up_vector(0, 1, 0);
-		auto dist_to_focus = 10.0;
-		auto aperture = 0.0;
-		const auto aspect_ratio = double(image_width) / image_height;
-
-		camera cam(lookfrom, lookat, up_vector, 40.0, aspect_ratio, aperture, dist_to_focus, 0.0, 1.0);
-
-		for (int h = image_height - 1; h >= 0; --h)
+		if (strcmp(argv[i], "--sampler") == 0 && i + 1 < argc)
 		{
-			//Progress Indicator
-			cerr << endl << "Scanlines remaining: " << h << ' ' << flush << endl;
-			for (int w = 0; w < image_width; ++w)
+			++i;
+			bool known = false;
+			for (auto type : { ray_tracing::sampler_independent, ray_tracing::sampler_sobol, ray_tracing::sampler_blue_noise })
 			{
-				vec3 color(0, 0, 0);
-				for (int s = 0; s < samples_per_pixel; ++s)
+				if (strcmp(argv[i], ray_tracing::sampler_name(type)) == 0)
 				{
-					auto u = ((double)w + random_double()) / image_width;
-					auto v = ((double)h + random_double()) / image_height;
-					ray r = cam.get_ray(u, v);
-					color += ray_color(r, background, world, max_depth);
+					sampler = type;
+					known = true;
 				}
-				color.write_color(cout, samples_per_pixel);
+			}
+			if (known == false)
+			{
+				std::cerr << "Unknown sampler " << argv[i] << ", expected independent, sobol or blue_noise." << std::endl;
+				return 1;
 			}
 		}
-		cerr << endl << "Done." << endl;
 	}
-}
-
-int main()
-{
-	ray_tracing::output_image();
+	ray_tracing::output_image(restir == true ? ray_tracing::direct_restir : ray_tracing::direct_path, sampler, guided, cached, caustics, denoised, exr_path,
+		streamed, width, height, budget, noisy_first);
 
 
 	return 0;
@@ -4,10 +4,70 @@ namespace ray_tracing
 {
 
 
-	bool dielectric::scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+	bool metal::sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const
+	{
+		vec3 reflected = reflect(unit_vector(r_in.get_direction()), rec.normal);
+		if (fuzz <= 0)
+		{
+			srec.scattered = ray(rec.p, reflected, r_in.get_time());
+			srec.attenuation = albedo;
+			srec.pdf = 0;
+			srec.is_specular = true;
+			return true;
+		}
+
+		double u, v;
+		sample_2d(dim_bsdf, u, v);
+		auto cos_alpha = pow(u, 1 / (exponent + 1));
+		auto sin_alpha = sqrt(ffmax(0.0, 1 - cos_alpha * cos_alpha));
+		auto phi = 2 * pi * v;
+		double sine, cosine_phi;
+		math::sincos(phi, sine, cosine_phi);
+		vec3 wi = onb(reflected).local(cosine_phi * sin_alpha, sine * sin_alpha, cos_alpha);
+
+		//the part of the lobe below the surface is absorbed
+		auto cosine = dot(rec.normal, wi);
+		if (cosine <= 0)
+		{
+			return false;
+		}
+		srec.scattered = ray(rec.p, wi, r_in.get_time());
+		srec.attenuation = albedo * ((exponent + 2) / (exponent + 1) * cosine);
+		srec.pdf = (exponent + 1) / (2 * pi) * pow(cos_alpha, exponent);
+		srec.is_specular = false;
+		return true;
+	}
+
+	vec3 metal::eval(const ray& r_in, const hit_record& rec, const vec3& wi) const
+	{
+		vec3 reflected = reflect(unit_vector(r_in.get_direction()), rec.normal);
+		auto cos_alpha = dot(reflected, wi);
+		auto cosine = dot(rec.normal, wi);
+		if (fuzz <= 0 || cos_alpha <= 0 || cosine <= 0)
+		{
+			return vec3(0, 0, 0);
+		}
+		//normalized phong brdf
+		return albedo * ((exponent + 2) / (2 * pi) * pow(cos_alpha, exponent) * cosine);
+	}
+
+	double metal::pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const
+	{
+		vec3 reflected = reflect(unit_vector(r_in.get_direction()), rec.normal);
+		auto cos_alpha = dot(reflected, wi);
+		if (fuzz <= 0 || cos_alpha <= 0)
+		{
+			return 0;
+		}
+		return (exponent + 1) / (2 * pi) * pow(cos_alpha, exponent);
+	}
+
+	bool dielectric::sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const
 	{
 		//absorptivity
-		attenuation = vec3(1.0, 1.0, 1.0);
+		srec.attenuation = vec3(1.0, 1.0, 1.0);
+		srec.pdf = 0;
+		srec.is_specular = true;
 		double etai_over_etat;
 		if (rec.front_face == true)
 		{
@@ -25,21 +85,37 @@ namespace ray_tracing
 		if (etai_over_etat * sin_theta > 1.0)
 		{
 			vec3 reflected = reflect(unit_direction, rec.normal);
-			scattered = ray(rec.p, reflected);
+			srec.scattered = ray(rec.p, reflected, r_in.get_time());
 			return true;
 		}
 
 		double reflect_prob = schlick(cos_theta, etai_over_etat);
-		if (random_double() < reflect_prob)
+		if (sample_1d(dim_bsdf_lobe) < reflect_prob)
 		{
 			vec3 reflected = reflect(unit_direction, rec.normal);
-			scattered = ray(rec.p, reflected);
+			srec.scattered = ray(rec.p, reflected, r_in.get_time());
 			return true;
 		}
 
 		vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
-		scattered = ray(rec.p, refracted);
+		srec.scattered = ray(rec.p, refracted, r_in.get_time());
 		return true;
 	}
 
+
+	//the same material shared by many primitives gets a single id
+	uint32_t material_registry::add(const shared_ptr<material>& mat)
+	{
+		auto found = material_ids.find(mat.get());
+		if (found != material_ids.end())
+		{
+			return found->second;
+		}
+
+		auto id = static_cast<uint32_t>(materials.size());
+		materials.push_back(mat);
+		material_ids[mat.get()] = id;
+		return id;
+	}
+
 }
\ No newline at end of file
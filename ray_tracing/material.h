@@ -1,59 +1,117 @@
 #pragma once 
 
+#include<cstdint>
+#include<unordered_map>
 #include"constantAndTool.h"
 #include "hittable.h"
 #include"texture.h"
+#include"texture_program.h"
 
 namespace ray_tracing
 {
 
+	//one direction drawn by material::sample
+	struct scatter_record
+	{
+		ray scattered;
+		vec3 attenuation;	//eval / pdf for smooth lobes, the plain weight for specular ones
+		double pdf;			//solid angle density of the direction, 0 for specular ones
+		bool is_specular;	//a delta lobe that eval and pdf cannot describe, lights are not sampled there
+	};
+
 	class material
 	{
 	public:
-		//scattering 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
+		//scattering, false when the path ends here
+		virtual bool sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const = 0;
 		virtual vec3 emitted(double u, double v, const vec3& p) const
 		{
 			return vec3(0, 0, 0);
 		}
+
+		//lights are gathered from the primitives whose material emits
+		virtual bool is_emissive() const { return false; }
+		//fraction of the light arriving from the unit direction wi that leaves along -r_in, cosine included
+		virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const
+		{
+			return vec3(0, 0, 0);
+		}
+		//density sample draws the unit direction wi with, in solid angle
+		virtual double pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const
+		{
+			return 0;
+		}
+		//surface color without lighting, a guide for the denoiser
+		virtual vec3 albedo_at(const hit_record& rec) const
+		{
+			return vec3(1, 1, 1);
+		}
+		//reflects the same radiance in every direction, so a radiance cache can stand in for it
+		virtual bool is_diffuse() const { return false; }
 	};
 	 
 	//diffused reflection material
 	class lambertian : public material
 	{
 	public:
-		lambertian( shared_ptr<texture> a ) : albedo(a) {}
+		lambertian( shared_ptr<texture> a ) : albedo(a), albedo_program(a) {}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const override
+		//cosine-weighted, so eval / pdf is just the albedo
+		virtual bool sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
 		{
-			vec3 scatter_direction = rec.normal + random_unit_vector();
-			scattered = ray(rec.p, scatter_direction, r_in.get_time());
-			attenuation = albedo->value(rec.u, rec.v, rec.p);
+			double u, v;
+			sample_2d(dim_bsdf, u, v);
+			vec3 scatter_direction = rec.normal + sphere_direction(u, v);
+			if (scatter_direction.length_squared() < 1e-12)
+			{
+				scatter_direction = rec.normal;
+			}
+			srec.scattered = ray(rec.p, unit_vector(scatter_direction), r_in.get_time());
+			srec.attenuation = albedo_program.eval(rec);
+			srec.pdf = ffmax(0.0, dot(rec.normal, srec.scattered.get_direction())) / pi;
+			srec.is_specular = false;
 			return true;
 		}
 
+
+		virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const override
+		{
+			auto cosine = dot(rec.normal, wi);
+			return cosine <= 0 ? vec3(0, 0, 0) : albedo_program.eval(rec) * (cosine / pi);
+		}
+		virtual double pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const override
+		{
+			return ffmax(0.0, dot(rec.normal, wi)) / pi;
+		}
+		virtual vec3 albedo_at(const hit_record& rec) const override
+		{
+			return albedo_program.eval(rec);
+		}
+		virtual bool is_diffuse() const override { return true; }
+
 	private:
 		shared_ptr<texture> albedo;
+		texture_program albedo_program;
 	};
 
 
 	//metal material
+	//fuzz 0 is a perfect mirror, anything above is a phong lobe around the mirror direction
+	//whose exponent shrinks to 0 (a cosine lobe) as fuzz reaches 1
 	class metal : public material
 	{
 	public:
-		metal(const vec3& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+		metal(const vec3& a, double f) : albedo(a), fuzz(f < 1 ? f : 1), exponent(fuzz > 0 ? 2 / (fuzz * fuzz) - 2 : 0) {}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const override
-		{
-			vec3 reflected = reflect(unit_vector(r_in.get_direction()), rec.normal);
-			scattered = ray(rec.p, reflected + random_in_unit_sphere() * fuzz);
-			attenuation = albedo;
-			return (dot(scattered.get_direction(), rec.normal) > 0);
-		}
+		virtual bool sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const override;
+		virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const override;
+		virtual double pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const override;
+		virtual vec3 albedo_at(const hit_record& rec) const override { return albedo; }
 
 	private:
 		vec3 albedo;
 		double fuzz;
+		double exponent;
 	};
 
 
@@ -63,7 +121,7 @@ namespace ray_tracing
 	public:
 		dielectric(double ri) : ref_idx(ri) {}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const override;
+		virtual bool sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const override;
 
 	private:
 		double ref_idx;
@@ -74,35 +132,78 @@ namespace ray_tracing
 	{
 	private:
 		shared_ptr<texture> emit;
+		texture_program emit_program;
 	public:
-		diffus_light(shared_ptr<texture> a) : emit(a) {}
+		diffus_light(shared_ptr<texture> a) : emit(a), emit_program(a) {}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const override
+		virtual bool sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
 		{
 			return false;
 		}
 
 		virtual vec3 emitted(double u, double v, const vec3& p) const override
 		{
-			return emit->value(u, v, p);
+			return emit_program.eval(u, v, p);
 		}
+
+
+		virtual bool is_emissive() const override { return true; }
 	};
 
 	class isotropic : public material
 	{
 	private:
 		shared_ptr<texture> albedo;
+		texture_program albedo_program;
 
 	public:
-		isotropic(shared_ptr<texture> a) : albedo(a) {}
+		isotropic(shared_ptr<texture> a) : albedo(a), albedo_program(a) {}
 
-		virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const override
+		//the phase function is uniform over the sphere
+		virtual bool sample(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
 		{
-			scattered = ray(rec.p, random_in_unit_sphere(), r_in.get_time());
-			attenuation = albedo->value(rec.u, rec.v, rec.p);
+			double u, v;
+			sample_2d(dim_bsdf, u, v);
+			srec.scattered = ray(rec.p, sphere_direction(u, v), r_in.get_time());
+			srec.attenuation = albedo_program.eval(rec.u, rec.v, rec.p);
+			srec.pdf = 1 / (4 * pi);
+			srec.is_specular = false;
 			return true;
 		}
 
+
+		virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wi) const override
+		{
+			return albedo_program.eval(rec.u, rec.v, rec.p) / (4 * pi);
+		}
+		virtual double pdf(const ray& r_in, const hit_record& rec, const vec3& wi) const override
+		{
+			return 1 / (4 * pi);
+		}
+		virtual vec3 albedo_at(const hit_record& rec) const override
+		{
+			return albedo_program.eval(rec.u, rec.v, rec.p);
+		}
+
+	};
+
+
+	/*
+	Scene-owned storage for materials.
+	Ownership is resolved once while the scene is compiled: primitives and hit records only carry
+	a 32-bit id, so shading looks the material up without touching any reference count.
+	*/
+	class material_registry
+	{
+	public:
+		uint32_t add(const shared_ptr<material>& mat);
+
+		const material& get_material(uint32_t id) const { return *materials[id]; }
+		size_t material_count() const { return materials.size(); }
+
+	private:
+		vector<shared_ptr<material>> materials;
+		std::unordered_map<const material*, uint32_t> material_ids;
 	};
 
-}
+}
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include"photon_map.h"
+
+#include<algorithm>
+#include<cmath>
+#include<thread>
+#include"renderer.h"
+
+namespace ray_tracing
+{
+	double photon_radius(double first_radius, double alpha, int iteration)
+	{
+		auto squared = first_radius * first_radius;
+		for (int i = 1; i <= iteration; ++i)
+		{
+			squared *= (i + alpha) / (i + 1);
+		}
+		return sqrt(squared);
+	}
+
+	photon_map::photon_map(const compiled_scene& world, const photon_settings& settings, double r, unsigned seed, int threads)
+		: radius(r), inverse_cell(0), bucket_mask(0)
+	{
+		const int thread_count = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+		vector<vector<photon>> buffers(std::max(1, thread_count));
+		parallel_for(static_cast<int>(buffers.size()), thread_count, [&](int begin, int end)
+		{
+			use_sampler(nullptr);
+			for (int i = begin; i < end; ++i)
+			{
+				seed_random(seed * 2654435761u + static_cast<unsigned>(i));
+				auto count = settings.photons_per_iteration * (i + 1) / static_cast<int>(buffers.size()) - settings.photons_per_iteration * i / static_cast<int>(buffers.size());
+				trace(world, settings, count, buffers[i]);
+			}
+		});
+
+		size_t total = 0;
+		for (const auto& buffer : buffers)
+		{
+			total += buffer.size();
+		}
+		if (radius <= 0)
+		{
+			for (const auto& buffer : buffers)
+			{
+				photons.insert(photons.end(), buffer.begin(), buffer.end());
+			}
+			radius = typical_radius(settings.neighbours);
+		}
+		if (radius <= 0)
+		{
+			//too few caustics to tell a radius from, and to estimate anything with
+			buffers.clear();
+			total = 0;
+			radius = 1;
+		}
+		inverse_cell = 1 / (2 * radius);
+		uint32_t bucket_count = 1;
+		while (bucket_count < total)
+		{
+			bucket_count *= 2;
+		}
+		bucket_mask = bucket_count - 1;
+
+		//counting sort by bucket, so each cell's photons sit next to each other
+		bucket_start.assign(bucket_count + 1, 0);
+		vector<uint32_t> buckets;
+		buckets.reserve(total);
+		for (const auto& buffer : buffers)
+		{
+			for (const auto& ph : buffer)
+			{
+				auto b = bucket(static_cast<int64_t>(floor(ph.p[0] * inverse_cell)), static_cast<int64_t>(floor(ph.p[1] * inverse_cell)),
+					static_cast<int64_t>(floor(ph.p[2] * inverse_cell)));
+				buckets.push_back(b);
+				++bucket_start[b + 1];
+			}
+		}
+		for (uint32_t b = 0; b < bucket_count; ++b)
+		{
+			bucket_start[b + 1] += bucket_start[b];
+		}
+		photons.resize(total);
+		vector<uint32_t> next(bucket_start.begin(), bucket_start.end() - 1);
+		size_t i = 0;
+		for (const auto& buffer : buffers)
+		{
+			for (const auto& ph : buffer)
+			{
+				photons[next[buckets[i++]]++] = ph;
+			}
+		}
+	}
+
+	uint32_t photon_map::bucket(int64_t x, int64_t y, int64_t z) const
+	{
+		auto h = static_cast<uint64_t>(x) * 73856093u ^ static_cast<uint64_t>(y) * 19349663u ^ static_cast<uint64_t>(z) * 83492791u;
+		return static_cast<uint32_t>(h ^ h >> 32) & bucket_mask;
+	}
+
+	double photon_map::typical_radius(int neighbours) const
+	{
+		const size_t probes = 256;
+		if (photons.size() <= static_cast<size_t>(neighbours))
+		{
+			return 0;
+		}
+
+		vector<double> radii, distances(photons.size());
+		auto step = std::max<size_t>(1, photons.size() / probes);
+		for (size_t i = 0; i < photons.size(); i += step)
+		{
+			for (size_t j = 0; j < photons.size(); ++j)
+			{
+				vec3 d(photons[j].p[0] - photons[i].p[0], photons[j].p[1] - photons[i].p[1], photons[j].p[2] - photons[i].p[2]);
+				distances[j] = d.length_squared();
+			}
+			//the probe itself is its own nearest photon
+			std::nth_element(distances.begin(), distances.begin() + neighbours, distances.end());
+			radii.push_back(distances[neighbours]);
+		}
+		std::nth_element(radii.begin(), radii.begin() + radii.size() / 2, radii.end());
+		return sqrt(radii[radii.size() / 2]);
+	}
+
+	void photon_map::trace(const compiled_scene& world, const photon_settings& settings, int count, vector<photon>& out) const
+	{
+		for (int n = 0; n < count; ++n)
+		{
+			emission_sample es;
+			if (world.sample_emission(settings.photons_per_iteration, es) == false)
+			{
+				continue;
+			}
+
+			ray r = es.r;
+			vec3 power = es.power;
+			bool through_specular = false;
+			for (int depth = 0; depth < settings.max_depth; ++depth)
+			{
+				hit_record rec;
+				if (world.hit(r, 0.001, infinity, rec) == false)
+				{
+					break;
+				}
+				const material& mat = world.get_material(rec.mat_id);
+				if (mat.is_emissive() == true)
+				{
+					break;
+				}
+				scatter_record srec;
+				if (mat.sample(r, rec, srec) == true && srec.is_specular == true)
+				{
+					power = power * srec.attenuation;
+					r = srec.scattered;
+					through_specular = true;
+					continue;
+				}
+
+				//only caustics are kept, and only on surfaces: media collisions have no normal
+				if (through_specular == true && rec.normal.length_squared() > 0)
+				{
+					auto wi = -unit_vector(r.get_direction());
+					out.push_back({ { static_cast<float>(rec.p.x()), static_cast<float>(rec.p.y()), static_cast<float>(rec.p.z()) },
+						{ static_cast<float>(power.x()), static_cast<float>(power.y()), static_cast<float>(power.z()) },
+						{ static_cast<float>(wi.x()), static_cast<float>(wi.y()), static_cast<float>(wi.z()) } });
+				}
+				break;
+			}
+		}
+	}
+
+	vec3 photon_map::estimate(const ray& r_in, const hit_record& rec, const material& mat) const
+	{
+		vec3 sum(0, 0, 0);
+		if (photons.empty() == true)
+		{
+			return sum;
+		}
+
+		//the cells the gather sphere touches, 2 on each axis since cells are a diameter wide, but rounding
+		//the two ends apart can reach a third
+		int64_t lo[3], hi[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			lo[axis] = static_cast<int64_t>(floor((rec.p[axis] - radius) * inverse_cell));
+			hi[axis] = std::min(static_cast<int64_t>(floor((rec.p[axis] + radius) * inverse_cell)), lo[axis] + 2);
+		}
+		uint32_t visited[27];
+		int visited_count = 0;
+		const auto radius_squared = radius * radius;
+		for (auto x = lo[0]; x <= hi[0]; ++x)
+		{
+			for (auto y = lo[1]; y <= hi[1]; ++y)
+			{
+				for (auto z = lo[2]; z <= hi[2]; ++z)
+				{
+					//two cells hashed to one bucket must not be gathered twice
+					auto b = bucket(x, y, z);
+					if (std::find(visited, visited + visited_count, b) != visited + visited_count)
+					{
+						continue;
+					}
+					visited[visited_count++] = b;
+
+					for (auto i = bucket_start[b]; i < bucket_start[b + 1]; ++i)
+					{
+						const photon& ph = photons[i];
+						vec3 d(ph.p[0] - rec.p.x(), ph.p[1] - rec.p.y(), ph.p[2] - rec.p.z());
+						if (d.length_squared() > radius_squared)
+						{
+							continue;
+						}
+						vec3 wi(ph.wi[0], ph.wi[1], ph.wi[2]);
+						//eval carries the cosine, the photon's power already has it
+						auto cosine = dot(rec.normal, wi);
+						if (cosine <= 1e-6)
+						{
+							continue;
+						}
+						sum += mat.eval(r_in, rec, wi) / cosine * vec3(ph.power[0], ph.power[1], ph.power[2]);
+					}
+				}
+			}
+		}
+		return sum / (pi * radius_squared);
+	}
+}
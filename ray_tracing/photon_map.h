@@ -0,0 +1,64 @@
+#pragma once
+
+#include<cstdint>
+#include"compiled_scene.h"
+#include"constantAndTool.h"
+#include"material.h"
+
+namespace ray_tracing
+{
+	struct photon_settings
+	{
+		bool enabled = false;
+		int photons_per_iteration = 1000000;	//emitted, only those landing after a specular bounce are kept
+		int iterations = 8;					//at most one per sample, each with its own photons and a smaller radius
+		double radius = 0;					//of the first iteration, 0 to take it from that iteration's photons
+		int neighbours = 16;				//photons an automatic radius reaches around a typical photon
+		double alpha = 2.0 / 3;				//share of the photons kept by each radius reduction
+		int max_depth = 16;
+	};
+
+	//gather radius of iteration i, counting from 0: r_i+1^2 = r_i^2 (i + 1 + alpha) / (i + 2), which
+	//shrinks slowly enough for the sum over iterations to converge (Knaus and Zwicker 2011)
+	double photon_radius(double first_radius, double alpha, int iteration);
+
+	/*
+	Caustic photons: light that went through at least one specular bounce and landed on a
+	non-specular surface. Threads trace slices of the photons into buffers of their own, merged
+	once; the photons are then sorted by cell of a hashed grid two radii wide, so a gather reads
+	at most 8 contiguous runs of 36 byte photons.
+	The path tracer leaves out the emitters it finds through specular chains from its first
+	non-specular surface and estimates them there from the photons instead, see ray_color.
+	*/
+	class photon_map
+	{
+	public:
+		//seed starts the generators of the tracing threads; radius 0 picks one from settings.neighbours
+		photon_map(const compiled_scene& world, const photon_settings& settings, double radius, unsigned seed, int threads = 0);
+
+		//radiance reflected by rec toward -r_in.direction from the photons within the radius of rec.p
+		vec3 estimate(const ray& r_in, const hit_record& rec, const material& mat) const;
+
+		size_t size() const { return photons.size(); }
+		double get_radius() const { return radius; }
+
+	private:
+		struct photon
+		{
+			float p[3];
+			float power[3];
+			float wi[3];		//unit, back toward where the photon came from
+		};
+
+		double radius;
+		double inverse_cell;
+		uint32_t bucket_mask;
+		vector<photon> photons;				//sorted by bucket
+		vector<uint32_t> bucket_start;		//photons of bucket b are [bucket_start[b], bucket_start[b + 1])
+
+		uint32_t bucket(int64_t x, int64_t y, int64_t z) const;
+		//median over a sample of photons of the distance to their neighbours-th nearest photon
+		double typical_radius(int neighbours) const;
+		void trace(const compiled_scene& world, const photon_settings& settings, int count, vector<photon>& out) const;
+	};
+}
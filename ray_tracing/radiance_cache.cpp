@@ -0,0 +1,154 @@
+#include"radiance_cache.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const double fixed_point_scale = 65536;
+		const double max_sample = 1e6;		//keeps a firefly from overflowing a cell's sums
+		const int max_probes = 8;
+		const int coordinate_bits = 20;
+
+		inline uint64_t mix(uint64_t x)
+		{
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccdull;
+			x ^= x >> 33;
+			x *= 0xc4ceb9fe1a85ec53ull;
+			x ^= x >> 33;
+			return x;
+		}
+	}
+
+	radiance_cache::radiance_cache(const aabb& bounds, const radiance_cache_settings& s)
+		: settings(s), origin(bounds.get_min()), capacity(size_t(1) << s.capacity_log2), cells(new cell[size_t(1) << s.capacity_log2]), paths(0), segments(0)
+	{
+		auto diagonal = (bounds.get_max() - bounds.get_min()).length();
+		inverse_cell = 1 / ffmax(diagonal * settings.cell_fraction, 1e-6);
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			cells[i].key.store(0, std::memory_order_relaxed);
+			for (int k = 0; k < 3; ++k)
+			{
+				cells[i].sum[k].store(0, std::memory_order_relaxed);
+			}
+			cells[i].count.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	//20 bits per axis, 3 for the normal's dominant axis and sign, and the top bit so no key is 0
+	uint64_t radiance_cache::key(const vec3& p, const vec3& normal) const
+	{
+		uint64_t k = 1ull << 63;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			auto c = floor((p[axis] - origin[axis]) * inverse_cell) + (1 << (coordinate_bits - 1));
+			if (c < 0 || c >= (1 << coordinate_bits))
+			{
+				return 0;
+			}
+			k |= static_cast<uint64_t>(c) << (axis * coordinate_bits);
+		}
+
+		int dominant = 0;
+		for (int axis = 1; axis < 3; ++axis)
+		{
+			if (fabs(normal[axis]) > fabs(normal[dominant]))
+			{
+				dominant = axis;
+			}
+		}
+		uint64_t side = dominant * 2 + (normal[dominant] < 0 ? 1 : 0);
+		return k | side << (3 * coordinate_bits);
+	}
+
+	radiance_cache::cell* radiance_cache::find(uint64_t key, bool claim) const
+	{
+		auto index = mix(key) & (capacity - 1);
+		for (int probe = 0; probe < max_probes; ++probe, index = (index + 1) & (capacity - 1))
+		{
+			cell& c = cells[index];
+			auto current = c.key.load(std::memory_order_acquire);
+			if (current == key)
+			{
+				return &c;
+			}
+			if (current != 0)
+			{
+				continue;
+			}
+			if (claim == false)
+			{
+				return nullptr;
+			}
+			//another thread may take the slot first, for this key or another
+			if (c.key.compare_exchange_strong(current, key, std::memory_order_acq_rel) == true || current == key)
+			{
+				return &c;
+			}
+		}
+		return nullptr;
+	}
+
+	void radiance_cache::add(uint64_t key, const vec3& radiance)
+	{
+		cell* c = key != 0 ? find(key, true) : nullptr;
+		if (c == nullptr)
+		{
+			return;
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			auto value = radiance[k] >= 0 ? ffmin(radiance[k], max_sample) : 0.0;
+			c->sum[k].fetch_add(static_cast<uint64_t>(value * fixed_point_scale), std::memory_order_relaxed);
+		}
+		//readers take the count first, so the sums they see are at least this sample's
+		c->count.fetch_add(1, std::memory_order_release);
+	}
+
+	bool radiance_cache::lookup(uint64_t key, vec3& radiance) const
+	{
+		const cell* c = key != 0 ? find(key, false) : nullptr;
+		if (c == nullptr)
+		{
+			return false;
+		}
+		auto count = c->count.load(std::memory_order_acquire);
+		if (count < settings.min_samples)
+		{
+			return false;
+		}
+		auto scale = 1 / (fixed_point_scale * count);
+		radiance = vec3(c->sum[0].load(std::memory_order_relaxed) * scale, c->sum[1].load(std::memory_order_relaxed) * scale,
+			c->sum[2].load(std::memory_order_relaxed) * scale);
+		return true;
+	}
+
+	size_t radiance_cache::used_cells() const
+	{
+		size_t used = 0;
+		for (size_t i = 0; i < capacity; ++i)
+		{
+			used += cells[i].key.load(std::memory_order_relaxed) != 0 ? 1 : 0;
+		}
+		return used;
+	}
+
+	void radiance_cache::count_path(int path_segments)
+	{
+		paths.fetch_add(1, std::memory_order_relaxed);
+		segments.fetch_add(path_segments, std::memory_order_relaxed);
+	}
+
+	double radiance_cache::average_path_length() const
+	{
+		auto n = paths.load(std::memory_order_relaxed);
+		return n > 0 ? double(segments.load(std::memory_order_relaxed)) / n : 0;
+	}
+
+	void radiance_cache::reset_statistics()
+	{
+		paths.store(0, std::memory_order_relaxed);
+		segments.store(0, std::memory_order_relaxed);
+	}
+}
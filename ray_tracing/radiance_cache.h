@@ -0,0 +1,65 @@
+#pragma once
+
+#include<atomic>
+#include<cstdint>
+#include<memory>
+#include"aabb.h"
+#include"constantAndTool.h"
+
+namespace ray_tracing
+{
+	struct radiance_cache_settings
+	{
+		bool enabled = false;
+		double cell_fraction = 1.0 / 64;	//cell edge over the scene's diagonal, smaller blurs less and fills slower
+		uint32_t min_samples = 8;			//a cell answers once this many paths went through it
+		double training_fraction = 0.1;		//paths traced in full to fill the cache, the rest end in it
+		int capacity_log2 = 18;				//cells in the table, 40 bytes each
+	};
+
+	/*
+	Radiance leaving diffuse surfaces, averaged over cells of a world space grid split by the
+	dominant axis of the normal. Cells live in an open addressed hash table; a path claims one by
+	swapping its key in and accumulates into it with integer atomic adds, so render threads fill
+	the cache while others read it and never lock. A cell full of probes drops what it is handed.
+	Values are stored divided by the albedo, so texture detail survives the averaging.
+	*/
+	class radiance_cache
+	{
+	public:
+		radiance_cache(const aabb& bounds, const radiance_cache_settings& settings);
+
+		//0 when p lies past what a key can hold
+		uint64_t key(const vec3& p, const vec3& normal) const;
+		void add(uint64_t key, const vec3& radiance);
+		//false until the cell has settings.min_samples paths
+		bool lookup(uint64_t key, vec3& radiance) const;
+
+		const radiance_cache_settings& get_settings() const { return settings; }
+		size_t used_cells() const;
+		size_t memory_bytes() const { return capacity * sizeof(cell); }
+
+		//path statistics of every render that used the cache
+		void count_path(int segments);
+		double average_path_length() const;
+		void reset_statistics();
+
+	private:
+		struct cell
+		{
+			std::atomic<uint64_t> key;		//0 while free
+			std::atomic<uint64_t> sum[3];	//fixed point
+			std::atomic<uint32_t> count;
+		};
+
+		radiance_cache_settings settings;
+		vec3 origin;
+		double inverse_cell;
+		size_t capacity;
+		std::unique_ptr<cell[]> cells;
+		std::atomic<uint64_t> paths;
+		std::atomic<uint64_t> segments;
+
+		cell* find(uint64_t key, bool claim) const;
+	};
+}
@@ -0,0 +1,808 @@
+#include "renderer.h"
+
+#include<algorithm>
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<cstring>
+#include<mutex>
+#include<sstream>
+#include<string>
+#include<thread>
+#include"integrator.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		inline void add3(float* v, const vec3& a)
+		{
+			v[0] += static_cast<float>(a.x());
+			v[1] += static_cast<float>(a.y());
+			v[2] += static_cast<float>(a.z());
+		}
+
+		//pixels the first hit moves over the shutter; points behind the camera do not move on screen
+		void screen_motion(const camera& cam, const aov_sample& first, int width, int height, float* v)
+		{
+			double s0, t0, s1, t1;
+			if (cam.project(first.position, s0, t0) == false || cam.project(first.position + first.velocity * cam.shutter(), s1, t1) == false)
+			{
+				return;
+			}
+			v[0] += static_cast<float>((s1 - s0) * width);
+			v[1] += static_cast<float>((t0 - t1) * height);
+		}
+
+		//adds sample number n of pixel i to the enabled channels
+		void accumulate_aovs(const camera& cam, const render_settings& settings, const aov_sample& first, int n, int i, aov_buffers& aovs)
+		{
+			if (aovs.has(aov_depth) == true)
+			{
+				aovs.at(aov_depth, i)[0] += static_cast<float>(first.depth);
+			}
+			if (aovs.has(aov_normal) == true)
+			{
+				add3(aovs.at(aov_normal, i), first.normal);
+			}
+			if (aovs.has(aov_albedo) == true)
+			{
+				add3(aovs.at(aov_albedo, i), first.albedo);
+			}
+			//ids do not average, keep the first sample's
+			if (aovs.has(aov_material_id) == true && n == 0)
+			{
+				aovs.at(aov_material_id, i)[0] = static_cast<float>(first.material);
+			}
+			if (aovs.has(aov_motion) == true)
+			{
+				screen_motion(cam, first, settings.width, settings.height, aovs.at(aov_motion, i));
+			}
+		}
+
+		//pixel i of the tile's sums to pixel p of the image
+		void resolve_aovs(const aov_buffers& sums, int i, int samples, aov_buffers& aovs, int p)
+		{
+			for (int c = 0; c < aov_channel_count; ++c)
+			{
+				auto channel = static_cast<aov_channel>(c);
+				if (aovs.has(channel) == false)
+				{
+					continue;
+				}
+
+				float* out = aovs.at(channel, p);
+				if (channel == aov_sample_count)
+				{
+					out[0] = static_cast<float>(samples);
+					continue;
+				}
+				const float* in = sums.at(channel, i);
+				auto scale = channel == aov_material_id ? 1.0f : 1.0f / samples;
+				for (int k = 0; k < aov_components(channel); ++k)
+				{
+					out[k] = in[k] * scale;
+				}
+			}
+		}
+
+		//adds samples [first_sample, first_sample + count) of every pixel of t, sample s to the tile's sums[s & 1]
+		//and aovs; both sums may be the same. No sample past the first begins after deadline; returns those taken
+		int sample_tile(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, const tile& t,
+			int first_sample, int count, std::chrono::steady_clock::time_point deadline, vector<vec3>* sums[2], aov_buffers& aovs,
+			path_guide* guide, radiance_cache* cache, const photon_map* photons)
+		{
+			//disabled channels cost nothing past this test
+			const bool track_first = (settings.aovs & first_hit_aovs) != 0;
+			vector<aov_sample> first(track_first == true ? t.width() * t.height() : 0);
+			//reservoirs draw many candidates per bounce, one fixed dimension cannot serve them all
+			auto pixel_sampler = make_sampler(settings.sampler, settings.seed);
+			const double spread = settings.filter_textures == true ? cam.pixel_spread(settings.height) : 0;
+			use_sampler(settings.direct == direct_restir ? nullptr : pixel_sampler.get());
+
+			int s = first_sample;
+			for (; s < first_sample + count; ++s)
+			{
+				if (s > first_sample && std::chrono::steady_clock::now() >= deadline)
+				{
+					break;
+				}
+				vector<vec3>& sum = *sums[s & 1];
+				if (settings.direct == direct_restir)
+				{
+					restir_pass(world, cam, background, settings.width, settings.height, settings.max_depth, settings.restir, t, sum,
+						track_first == true ? first.data() : nullptr);
+				}
+				else
+				{
+					for (int y = t.y0; y < t.y1; ++y)
+					{
+						for (int x = t.x0; x < t.x1; ++x)
+						{
+							auto i = (y - t.y0) * t.width() + (x - t.x0);
+							pixel_sampler->start_pixel_sample(x, y, s);
+							sum[i] += ray_color(pixel_ray(cam, x, y, settings.width, settings.height), background, world, settings.max_depth, true,
+								track_first == true ? &first[i] : nullptr, guide, cache, photons, spread);
+						}
+					}
+				}
+
+				for (size_t i = 0; i < first.size(); ++i)
+				{
+					accumulate_aovs(cam, settings, first[i], s, static_cast<int>(i), aovs);
+				}
+			}
+
+			use_sampler(nullptr);
+			return s - first_sample;
+		}
+
+		//the averages of the tile's samples to its pixels of image, which holds the rows from first_row down
+		void resolve_tile(const tile& t, const vector<vec3>& sum, const aov_buffers& aovs, int samples, framebuffer& image, int first_row)
+		{
+			for (int y = t.y0; y < t.y1; ++y)
+			{
+				for (int x = t.x0; x < t.x1; ++x)
+				{
+					auto i = (y - t.y0) * t.width() + (x - t.x0);
+					auto p = (y - first_row) * image.width + x;
+					image.pixels[p] = sum[i] / samples;
+					image.samples[p] = samples;
+					if (aovs.enabled != 0)
+					{
+						resolve_aovs(aovs, i, samples, image.aovs, p);
+					}
+				}
+			}
+		}
+
+		void render_tile(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, const tile& t, framebuffer& image,
+			int first_row, path_guide* guide, radiance_cache* cache, const photon_map* photons)
+		{
+			vector<vec3> sum(t.width() * t.height(), vec3(0, 0, 0));
+			aov_buffers aovs;
+			aovs.allocate(settings.aovs, t.width(), t.height());
+			vector<vec3>* sums[2] = { &sum, &sum };
+			sample_tile(world, cam, background, settings, t, 0, settings.samples_per_pixel, std::chrono::steady_clock::time_point::max(), sums, aovs,
+				guide, cache, photons);
+			resolve_tile(t, sum, aovs, settings.samples_per_pixel, image, first_row);
+		}
+
+		//adds pass, which took weight of the image's samples, to the running average in image
+		void accumulate(const framebuffer& pass, double weight, bool is_first, framebuffer& image)
+		{
+			for (size_t p = 0; p < image.pixels.size(); ++p)
+			{
+				image.pixels[p] += pass.pixels[p] * weight;
+				image.samples[p] += pass.samples[p];
+			}
+			for (int c = 0; c < aov_channel_count; ++c)
+			{
+				auto channel = static_cast<aov_channel>(c);
+				if (image.aovs.has(channel) == false)
+				{
+					continue;
+				}
+				auto& out = image.aovs.channels[c];
+				const auto& in = pass.aovs.channels[c];
+				for (size_t k = 0; k < out.size(); ++k)
+				{
+					if (channel == aov_material_id)
+					{
+						out[k] = is_first == true ? in[k] : out[k];
+					}
+					else
+					{
+						out[k] += channel == aov_sample_count ? in[k] : static_cast<float>(in[k] * weight);
+					}
+				}
+			}
+		}
+
+		//the guide and the cache render uses when none are given, kept in trained and own_cache
+		void prepare_estimators(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings,
+			path_guide*& guide, radiance_cache*& cache, std::unique_ptr<path_guide>& trained, std::unique_ptr<radiance_cache>& own_cache)
+		{
+			aabb bounds;
+			if (guide == nullptr && settings.guiding.enabled == true && settings.direct == direct_path && world.bounding_box(bounds) == true)
+			{
+				trained.reset(new path_guide(bounds, settings.guiding));
+				train_guide(world, cam, background, settings, *trained);
+				guide = trained.get();
+			}
+			//filled as the tiles go, so the first tiles end fewer paths in it than the last
+			if (cache == nullptr && settings.cache.enabled == true && settings.direct == direct_path && world.bounding_box(bounds) == true)
+			{
+				own_cache.reset(new radiance_cache(bounds, settings.cache));
+				cache = own_cache.get();
+			}
+		}
+
+		//what render_budgeted keeps of a tile between its passes
+		struct budget_tile
+		{
+			vector<vec3> halves[2];		//sums of the even and of the odd samples
+			aov_buffers aovs;
+			int samples = 0;
+			double error = infinity;
+			double sample_time = 0;		//seconds of one thread per sample of a pixel, when the tile last ran
+		};
+
+		double luminance(const vec3& c)
+		{
+			return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+		}
+
+		//how far the averages of the even and of the odd samples are apart, averaged over the tile; about
+		//the deviation of a pixel's samples over the square root of their count
+		double tile_error(const budget_tile& state)
+		{
+			if (state.samples < 2)
+			{
+				return infinity;
+			}
+			auto even = (state.samples + 1) / 2, odd = state.samples / 2;
+			double error = 0;
+			for (size_t i = 0; i < state.halves[0].size(); ++i)
+			{
+				auto a = luminance(state.halves[0][i]), b = luminance(state.halves[1][i]);
+				error += std::fabs(a / even - b / odd);
+			}
+			return error / state.halves[0].size();
+		}
+
+		//tile i of make_tiles(width, height, tile_size), without the list
+		tile tile_at(size_t i, int width, int height, int tile_size)
+		{
+			auto across = static_cast<size_t>((width + tile_size - 1) / tile_size);
+			auto x = static_cast<int>(i % across) * tile_size, y = static_cast<int>(i / across) * tile_size;
+			return { x, y, std::min(x + tile_size, width), std::min(y + tile_size, height) };
+		}
+
+		//the bytes write_image puts out for a pixel, in binary
+		void encode_pixel(const vec3& pixel, unsigned char* out)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				out[k] = static_cast<unsigned char>(static_cast<int>(255 * clamp(sqrt(pixel[k]), 0.0, 0.999)));
+			}
+		}
+
+		struct exr_channel
+		{
+			std::string name;
+			const float* data;
+			int stride;		//floats from one pixel to the next
+		};
+
+		void put_bytes(std::ostream& out, const void* data, size_t size)
+		{
+			//exr is little endian, like every machine this runs on
+			out.write(static_cast<const char*>(data), size);
+		}
+
+		void put_int(std::ostream& out, int32_t value)
+		{
+			put_bytes(out, &value, sizeof(value));
+		}
+
+		void put_float(std::ostream& out, float value)
+		{
+			put_bytes(out, &value, sizeof(value));
+		}
+
+		void put_string(std::ostream& out, const std::string& s)
+		{
+			put_bytes(out, s.c_str(), s.size() + 1);
+		}
+
+		void put_attribute(std::ostream& out, const char* name, const char* type, int32_t size)
+		{
+			put_string(out, name);
+			put_string(out, type);
+			put_int(out, size);
+		}
+	}
+
+	vector<tile> make_tiles(int width, int height, int tile_size)
+	{
+		vector<tile> tiles;
+		for (int y = 0; y < height; y += tile_size)
+		{
+			for (int x = 0; x < width; x += tile_size)
+			{
+				tiles.push_back({ x, y, std::min(x + tile_size, width), std::min(y + tile_size, height) });
+			}
+		}
+		return tiles;
+	}
+
+	ray pixel_ray(const camera& cam, int x, int y, int width, int height)
+	{
+		double jitter_x, jitter_y;
+		sample_2d(dim_pixel, jitter_x, jitter_y);
+		auto u = (x + jitter_x) / width;
+		auto v = (height - 1 - y + jitter_y) / height;
+		return cam.get_ray(u, v);
+	}
+
+	void render(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, framebuffer& image,
+		path_guide* guide, radiance_cache* cache, const photon_map* photons)
+	{
+		std::unique_ptr<path_guide> trained;
+		std::unique_ptr<radiance_cache> own_cache;
+		prepare_estimators(world, cam, background, settings, guide, cache, trained, own_cache);
+		const bool photon_iterations = photons == nullptr && settings.photons.enabled == true && settings.direct == direct_path
+			&& world.light_count() > 0;
+
+		image.width = settings.width;
+		image.height = settings.height;
+		image.pixels.assign(settings.width * settings.height, vec3(0, 0, 0));
+		image.samples.assign(settings.width * settings.height, 0);
+		image.aovs.allocate(settings.aovs, settings.width, settings.height);
+
+		if (photon_iterations == true)
+		{
+			auto iterations = std::max(1, std::min(settings.photons.iterations, settings.samples_per_pixel));
+			auto first_radius = settings.photons.radius;
+			auto pass_settings = settings;
+			pass_settings.photons.enabled = false;
+			pass_settings.on_tile = nullptr;
+			framebuffer pass;
+			for (int i = 0; i < iterations; ++i)
+			{
+				pass_settings.samples_per_pixel = settings.samples_per_pixel * (i + 1) / iterations - settings.samples_per_pixel * i / iterations;
+				pass_settings.seed = settings.seed + 104729u * i;
+				photon_map map(world, settings.photons, i == 0 ? first_radius : photon_radius(first_radius, settings.photons.alpha, i),
+					settings.seed * 7919u + i, settings.threads);
+				first_radius = i == 0 ? map.get_radius() : first_radius;
+				render(world, cam, background, pass_settings, pass, guide, cache, &map);
+				accumulate(pass, double(pass_settings.samples_per_pixel) / settings.samples_per_pixel, i == 0, image);
+				if (settings.on_tile != nullptr)
+				{
+					for (const auto& t : make_tiles(settings.width, settings.height, settings.tile_size))
+					{
+						settings.on_tile(t);
+					}
+				}
+			}
+			return;
+		}
+
+		auto tiles = make_tiles(settings.width, settings.height, settings.tile_size);
+		std::atomic<size_t> next_tile(0);
+		auto worker = [&]()
+		{
+			for (size_t i = next_tile++; i < tiles.size(); i = next_tile++)
+			{
+				seed_random(settings.seed * 2654435761u + static_cast<unsigned>(i));
+				render_tile(world, cam, background, settings, tiles[i], image, 0, guide, cache, photons);
+				if (settings.on_tile != nullptr)
+				{
+					settings.on_tile(tiles[i]);
+				}
+			}
+		};
+
+		int thread_count = settings.threads > 0 ? settings.threads : static_cast<int>(std::thread::hardware_concurrency());
+		thread_count = std::max(1, std::min(thread_count, static_cast<int>(tiles.size())));
+		vector<std::thread> pool;
+		for (int i = 1; i < thread_count; ++i)
+		{
+			pool.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : pool)
+		{
+			thread.join();
+		}
+	}
+
+	size_t render_bands(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, std::ostream& out,
+		int band_rows, int window, path_guide* guide, radiance_cache* cache)
+	{
+		std::unique_ptr<path_guide> trained;
+		std::unique_ptr<radiance_cache> own_cache;
+		prepare_estimators(world, cam, background, settings, guide, cache, trained, own_cache);
+
+		auto band_settings = settings;
+		band_settings.aovs = 0;
+		band_rows = std::max(1, (band_rows + settings.tile_size - 1) / settings.tile_size) * settings.tile_size;
+		window = std::max(1, window);
+		const int band_count = (settings.height + band_rows - 1) / band_rows;
+		const int tiles_across = (settings.width + settings.tile_size - 1) / settings.tile_size;
+		const size_t tiles_per_band = static_cast<size_t>(tiles_across) * (band_rows / settings.tile_size);
+		const size_t tile_count = static_cast<size_t>(tiles_across) * ((settings.height + settings.tile_size - 1) / settings.tile_size);
+
+		//band b renders into slot b % window once band b - window is written
+		vector<framebuffer> slots(std::min(window, band_count));
+		for (auto& slot : slots)
+		{
+			slot.width = settings.width;
+			slot.height = band_rows;
+			slot.pixels.assign(settings.width * band_rows, vec3(0, 0, 0));
+			slot.samples.assign(settings.width * band_rows, 0);
+		}
+		vector<size_t> unfinished(band_count);
+		for (int b = 0; b < band_count; ++b)
+		{
+			unfinished[b] = std::min(tiles_per_band, tile_count - b * tiles_per_band);
+		}
+		std::mutex lock;
+		std::condition_variable band_done, band_written;
+		int written = 0;
+
+		//tiles are taken in order, so whoever waits for a slot waits on bands already being rendered
+		std::atomic<size_t> next_tile(0);
+		auto worker = [&]()
+		{
+			for (size_t i = next_tile++; i < tile_count; i = next_tile++)
+			{
+				auto t = tile_at(i, settings.width, settings.height, settings.tile_size);
+				auto band = t.y0 / band_rows;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					band_written.wait(guard, [&]() { return band < written + window; });
+				}
+				seed_random(settings.seed * 2654435761u + static_cast<unsigned>(i));
+				render_tile(world, cam, background, band_settings, t, slots[band % window], band * band_rows, guide, cache, nullptr);
+				if (settings.on_tile != nullptr)
+				{
+					settings.on_tile(t);
+				}
+				std::lock_guard<std::mutex> guard(lock);
+				if (--unfinished[band] == 0)
+				{
+					band_done.notify_all();
+				}
+			}
+		};
+
+		int thread_count = settings.threads > 0 ? settings.threads : static_cast<int>(std::thread::hardware_concurrency());
+		thread_count = std::max(1, static_cast<int>(std::min<size_t>(thread_count, tile_count)));
+		vector<std::thread> pool;
+		for (int i = 0; i < thread_count; ++i)
+		{
+			pool.emplace_back(worker);
+		}
+
+		//this thread encodes and writes the bands in order while the pool renders the ones below
+		out << "P6\n" << settings.width << ' ' << settings.height << "\n255\n";
+		vector<unsigned char> row(settings.width * 3);
+		for (int b = 0; b < band_count; ++b)
+		{
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				band_done.wait(guard, [&]() { return unfinished[b] == 0; });
+			}
+			const framebuffer& band = slots[b % window];
+			for (int y = b * band_rows; y < std::min((b + 1) * band_rows, settings.height); ++y)
+			{
+				for (int x = 0; x < settings.width; ++x)
+				{
+					encode_pixel(band.at(x, y - b * band_rows), &row[x * 3]);
+				}
+				out.write(reinterpret_cast<const char*>(row.data()), row.size());
+			}
+			out.flush();
+			std::lock_guard<std::mutex> guard(lock);
+			written = b + 1;
+			band_written.notify_all();
+		}
+		for (auto& thread : pool)
+		{
+			thread.join();
+		}
+		return slots.size() * settings.width * band_rows * sizeof(vec3);
+	}
+
+	budget_stats render_budgeted(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings,
+		double seconds, bool noisy_first, framebuffer& image, path_guide* guide, radiance_cache* cache)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+		std::unique_ptr<path_guide> trained;
+		std::unique_ptr<radiance_cache> own_cache;
+		prepare_estimators(world, cam, background, settings, guide, cache, trained, own_cache);
+
+		image.width = settings.width;
+		image.height = settings.height;
+		image.pixels.assign(settings.width * settings.height, vec3(0, 0, 0));
+		image.samples.assign(settings.width * settings.height, 0);
+		image.aovs.allocate(settings.aovs, settings.width, settings.height);
+
+		auto tiles = make_tiles(settings.width, settings.height, settings.tile_size);
+		vector<budget_tile> states(tiles.size());
+		for (size_t i = 0; i < tiles.size(); ++i)
+		{
+			states[i].halves[0].assign(tiles[i].width() * tiles[i].height(), vec3(0, 0, 0));
+			states[i].halves[1].assign(tiles[i].width() * tiles[i].height(), vec3(0, 0, 0));
+			states[i].aovs.allocate(settings.aovs, tiles[i].width(), tiles[i].height());
+		}
+
+		int thread_count = settings.threads > 0 ? settings.threads : static_cast<int>(std::thread::hardware_concurrency());
+		thread_count = std::max(1, std::min(thread_count, static_cast<int>(tiles.size())));
+		budget_stats stats;
+		vector<size_t> order;
+		vector<int> pass_counts(tiles.size());
+		while (true)
+		{
+			auto pass_start = std::chrono::steady_clock::now();
+			std::chrono::duration<double> remaining = deadline - pass_start;
+			if (stats.passes > 0 && remaining.count() <= 0)
+			{
+				break;
+			}
+
+			order.clear();
+			for (size_t i = 0; i < tiles.size(); ++i)
+			{
+				if (states[i].samples < settings.samples_per_pixel)
+				{
+					order.push_back(i);
+				}
+			}
+			if (order.empty() == true)
+			{
+				break;
+			}
+			//about a quarter of the time left, so the passes shrink towards the deadline
+			double sample_time = 0;
+			for (auto i : order)
+			{
+				sample_time += states[i].halves[0].size() * states[i].sample_time / thread_count;
+			}
+			int pass_samples = 1;
+			if (stats.passes > 0 && sample_time > 0)
+			{
+				pass_samples = static_cast<int>(std::min(remaining.count() / 4 / sample_time, double(settings.samples_per_pixel)));
+				pass_samples = std::max(1, pass_samples);
+			}
+			for (auto i : order)
+			{
+				pass_counts[i] = std::min(pass_samples, settings.samples_per_pixel - states[i].samples);
+			}
+
+			//samples go where they take the most off the summed variance of the tiles for their time: a tile whose
+			//samples deviate by sigma and take c seconds each should end with samples in proportion to sigma / sqrt(c)
+			bool estimated = true;
+			for (auto i : order)
+			{
+				estimated = estimated && states[i].samples >= 2 && states[i].sample_time > 0;
+			}
+			double spent = 0, weighted = 0;
+			for (auto i : order)
+			{
+				auto cost = states[i].halves[0].size() * states[i].sample_time;
+				spent += states[i].samples * cost;
+				weighted += states[i].error * std::sqrt(double(states[i].samples) / states[i].sample_time) * cost;
+			}
+			//with no disagreement anywhere every tile goes on evenly
+			if (noisy_first == true && estimated == true && weighted > 0)
+			{
+				auto scale = (spent + remaining.count() / 4 * thread_count) / weighted;
+				for (auto i : order)
+				{
+					auto target = scale * states[i].error * std::sqrt(double(states[i].samples) / states[i].sample_time);
+					pass_counts[i] = static_cast<int>(std::min(std::max(target - states[i].samples + 0.5, 0.0), double(settings.samples_per_pixel - states[i].samples)));
+				}
+				std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return pass_counts[a] > pass_counts[b]; });
+				pass_counts[order[0]] = std::max(pass_counts[order[0]], 1);
+				while (pass_counts[order.back()] == 0)
+				{
+					order.pop_back();
+				}
+			}
+
+			const bool is_first = stats.passes == 0;
+			const auto pass = static_cast<unsigned>(stats.passes);
+			//the first pass gives every pixel a sample whatever it takes
+			auto pass_deadline = is_first == true ? std::chrono::steady_clock::time_point::max() : deadline;
+			std::atomic<size_t> next_tile(0);
+			auto worker = [&]()
+			{
+				for (size_t k = next_tile++; k < order.size(); k = next_tile++)
+				{
+					auto tile_start = std::chrono::steady_clock::now();
+					if (tile_start >= pass_deadline)
+					{
+						return;
+					}
+					auto i = order[k];
+					budget_tile& state = states[i];
+					auto count = pass_counts[i];
+					seed_random((settings.seed * 2654435761u) ^ (static_cast<unsigned>(i) * 2246822519u) ^ (pass * 3266489917u));
+					vector<vec3>* sums[2] = { &state.halves[0], &state.halves[1] };
+					count = sample_tile(world, cam, background, settings, tiles[i], state.samples, count, pass_deadline, sums, state.aovs, guide, cache, nullptr);
+					std::chrono::duration<double> tile_time = std::chrono::steady_clock::now() - tile_start;
+					state.sample_time = tile_time.count() / (double(count) * state.halves[0].size());
+					state.samples += count;
+					state.error = tile_error(state);
+
+					vector<vec3> sum(state.halves[0]);
+					for (size_t j = 0; j < sum.size(); ++j)
+					{
+						sum[j] += state.halves[1][j];
+					}
+					resolve_tile(tiles[i], sum, state.aovs, state.samples, image, 0);
+					if (settings.on_tile != nullptr)
+					{
+						settings.on_tile(tiles[i]);
+					}
+				}
+			};
+
+			vector<std::thread> pool;
+			for (int i = 1; i < thread_count; ++i)
+			{
+				pool.emplace_back(worker);
+			}
+			worker();
+			for (auto& thread : pool)
+			{
+				thread.join();
+			}
+			++stats.passes;
+		}
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		stats.seconds = elapsed.count();
+		stats.fewest_samples = *std::min_element(image.samples.begin(), image.samples.end());
+		stats.most_samples = *std::max_element(image.samples.begin(), image.samples.end());
+		double total = 0;
+		for (auto samples : image.samples)
+		{
+			total += samples;
+		}
+		stats.mean_samples = total / image.samples.size();
+		return stats;
+	}
+
+	void train_guide(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, path_guide& guide)
+	{
+		auto pass_settings = settings;
+		pass_settings.direct = direct_path;
+		pass_settings.aovs = 0;
+		pass_settings.on_tile = nullptr;
+		pass_settings.cache.enabled = false;
+		pass_settings.photons.enabled = false;
+		guide.set_training(true);
+		framebuffer discarded;
+		for (int pass = 0; pass < settings.guiding.training_passes; ++pass)
+		{
+			pass_settings.samples_per_pixel = 1 << pass;
+			pass_settings.seed = settings.seed + 7919u * (pass + 1);
+			render(world, cam, background, pass_settings, discarded, &guide);
+			guide.refine(pass);
+		}
+		guide.set_training(false);
+	}
+
+	void parallel_for(int count, int threads, const std::function<void(int, int)>& body)
+	{
+		int thread_count = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+		thread_count = std::max(1, std::min(thread_count, count));
+		vector<std::thread> pool;
+		for (int i = 1; i < thread_count; ++i)
+		{
+			pool.emplace_back(body, count * i / thread_count, count * (i + 1) / thread_count);
+		}
+		body(0, count / thread_count);
+		for (auto& thread : pool)
+		{
+			thread.join();
+		}
+	}
+
+	void write_image(std::ostream& out, const framebuffer& image)
+	{
+		out << "P3" << endl << image.width << ' ' << image.height << endl << "255" << endl;
+		for (const auto& pixel : image.pixels)
+		{
+			vec3 color = pixel;
+			color.write_color(out, 1);
+		}
+	}
+
+	void write_exr(std::ostream& out, const framebuffer& image)
+	{
+		const int pixel_count = image.width * image.height;
+		vector<float> rgb(pixel_count * 3);
+		for (int p = 0; p < pixel_count; ++p)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				rgb[p * 3 + k] = static_cast<float>(image.pixels[p][k]);
+			}
+		}
+
+		vector<exr_channel> channels = { { "R", &rgb[0], 3 }, { "G", &rgb[1], 3 }, { "B", &rgb[2], 3 } };
+		for (int c = 0; c < aov_channel_count; ++c)
+		{
+			auto channel = static_cast<aov_channel>(c);
+			if (image.aovs.has(channel) == false)
+			{
+				continue;
+			}
+			const aov_info& info = get_aov_info(channel);
+			auto components = aov_components(channel);
+			if (strlen(info.components) == 0)
+			{
+				channels.push_back({ info.name, image.aovs.at(channel, 0), 1 });
+				continue;
+			}
+			for (int k = 0; k < components; ++k)
+			{
+				channels.push_back({ std::string(info.name) + "." + info.components[k], image.aovs.at(channel, 0) + k, components });
+			}
+		}
+		//readers expect the channel list in name order
+		std::sort(channels.begin(), channels.end(), [](const exr_channel& a, const exr_channel& b) { return a.name < b.name; });
+
+		//the header goes through a string first so the offsets do not depend on out being seekable
+		std::ostringstream header;
+		const unsigned char magic[] = { 0x76, 0x2f, 0x31, 0x01 };
+		put_bytes(header, magic, sizeof(magic));
+		put_int(header, 2);		//version 2, single part scanline file
+
+		int32_t list_size = 1;
+		for (const auto& channel : channels)
+		{
+			list_size += static_cast<int32_t>(channel.name.size()) + 1 + 16;
+		}
+		put_attribute(header, "channels", "chlist", list_size);
+		for (const auto& channel : channels)
+		{
+			const unsigned char linear_and_reserved[4] = { 0, 0, 0, 0 };
+			put_string(header, channel.name);
+			put_int(header, 2);		//FLOAT
+			put_bytes(header, linear_and_reserved, 4);
+			put_int(header, 1);		//x and y sampling
+			put_int(header, 1);
+		}
+		header.put(0);
+
+		const char no_compression = 0, increasing_y = 0;
+		put_attribute(header, "compression", "compression", 1);
+		header.put(no_compression);
+		put_attribute(header, "dataWindow", "box2i", 16);
+		const int32_t window[4] = { 0, 0, image.width - 1, image.height - 1 };
+		put_bytes(header, window, sizeof(window));
+		put_attribute(header, "displayWindow", "box2i", 16);
+		put_bytes(header, window, sizeof(window));
+		put_attribute(header, "lineOrder", "lineOrder", 1);
+		header.put(increasing_y);
+		put_attribute(header, "pixelAspectRatio", "float", 4);
+		put_float(header, 1.0f);
+		put_attribute(header, "screenWindowCenter", "v2f", 8);
+		put_float(header, 0.0f);
+		put_float(header, 0.0f);
+		put_attribute(header, "screenWindowWidth", "float", 4);
+		put_float(header, 1.0f);
+		header.put(0);
+
+		const std::string header_bytes = header.str();
+		put_bytes(out, header_bytes.data(), header_bytes.size());
+
+		//offset table, then one block per scanline: y, byte count, and the row of every channel in turn
+		const int32_t row_bytes = static_cast<int32_t>(channels.size() * image.width * sizeof(float));
+		uint64_t offset = header_bytes.size() + sizeof(uint64_t) * image.height;
+		for (int y = 0; y < image.height; ++y)
+		{
+			put_bytes(out, &offset, sizeof(offset));
+			offset += 8 + row_bytes;
+		}
+		for (int y = 0; y < image.height; ++y)
+		{
+			put_int(out, y);
+			put_int(out, row_bytes);
+			for (const auto& channel : channels)
+			{
+				for (int x = 0; x < image.width; ++x)
+				{
+					put_float(out, channel.data[(y * image.width + x) * channel.stride]);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include<functional>
+#include<ostream>
+#include"aov.h"
+#include"compiled_scene.h"
+#include"constantAndTool.h"
+#include"guiding.h"
+#include"photon_map.h"
+#include"radiance_cache.h"
+#include"restir.h"
+#include"sampler.h"
+
+namespace ray_tracing
+{
+	//how light arriving straight from the emitters is estimated
+	enum direct_lighting
+	{
+		direct_path,		//light sampling and material sampling combined at every bounce
+		direct_restir		//reservoir resampling at the first hit, see restir.h
+	};
+
+	struct tile;
+
+	struct render_settings
+	{
+		int width = 400;
+		int height = 225;
+		int samples_per_pixel = 16;
+		int max_depth = 50;
+		int tile_size = 32;
+		int threads = 0;		//0 uses every hardware thread
+		unsigned seed = 1;
+		direct_lighting direct = direct_path;
+		sampler_type sampler = sampler_independent;		//for the path estimator, ReSTIR passes draw independently
+		restir_settings restir;
+		guiding_settings guiding;		//for the path estimator
+		radiance_cache_settings cache;	//for the path estimator
+		photon_settings photons;		//for the path estimator
+		bool filter_textures = true;	//pixel sized ray cones pick image texture levels, else the finest is read
+		//called by the thread that finished a tile, once its pixels are in the image; with photon
+		//iterations every tile is reported again as each iteration is averaged in
+		std::function<void(const tile&)> on_tile;
+		unsigned aovs = 0;		//aov_bit mask of the channels to fill next to the radiance
+	};
+
+	//the pixels [x0, x1) x [y0, y1), the unit of work handed to a render thread
+	struct tile
+	{
+		int x0, y0, x1, y1;
+
+		int width() const { return x1 - x0; }
+		int height() const { return y1 - y0; }
+	};
+
+	//linear radiance averaged over the samples, row 0 at the top
+	struct framebuffer
+	{
+		int width = 0;
+		int height = 0;
+		vector<vec3> pixels;
+		vector<int> samples;		//taken at each pixel
+		aov_buffers aovs;		//the enabled channels, averaged over the samples where that makes sense
+
+		vec3& at(int x, int y) { return pixels[y * width + x]; }
+		const vec3& at(int x, int y) const { return pixels[y * width + x]; }
+	};
+
+	//what render_budgeted did with its time
+	struct budget_stats
+	{
+		int passes = 0;
+		double seconds = 0;		//from the call until the last tile was in
+		int fewest_samples = 0;
+		int most_samples = 0;
+		double mean_samples = 0;
+	};
+
+	vector<tile> make_tiles(int width, int height, int tile_size);
+
+	//jittered camera ray through pixel (x, y) of a width x height image
+	ray pixel_ray(const camera& cam, int x, int y, int width, int height);
+
+	//renders every tile on a pool of threads; each tile reseeds the generator of the thread
+	//that takes it, so the image does not depend on the thread count
+	//guide, when given, is used as it is; otherwise one is trained first if settings.guiding asks for it
+	//cache, when given, is read and filled, keeping what earlier renders put in; otherwise an empty one
+	//is made if settings.cache asks for it
+	//photons, when given, serve every sample; otherwise settings.photons may split the samples into
+	//iterations with fresh photons and a smaller radius each, averaged into image
+	void render(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, framebuffer& image,
+		path_guide* guide = nullptr, radiance_cache* cache = nullptr, const photon_map* photons = nullptr);
+
+	//renders the image band_rows rows at a time, rounded up to whole tiles, and writes it to out as a binary
+	//ppm, gamma 2 as write_image, each band as soon as it and those above it are done; the pixels are those
+	//render makes. At most window bands are held, so memory does not grow with the height; returns their bytes
+	//settings.aovs and photon iterations are not streamed
+	size_t render_bands(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, std::ostream& out,
+		int band_rows, int window = 3, path_guide* guide = nullptr, radiance_cache* cache = nullptr);
+
+	//renders passes over the tiles until seconds have gone since the call or every pixel has settings.samples_per_pixel
+	//samples, each pixel left the average of the samples it got and their count in image.samples. The first pass takes
+	//one sample per pixel and always completes; each later one is sized from the time the last took to fill about a
+	//quarter of what is left, and no sample begins past the deadline. With noisy_first, once every tile has two samples,
+	//each pass gives the tiles whose even and odd samples disagree the most for their cost the most samples, first
+	//photon iterations are not run
+	budget_stats render_budgeted(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings,
+		double seconds, bool noisy_first, framebuffer& image, path_guide* guide = nullptr, radiance_cache* cache = nullptr);
+
+	//renders settings.guiding.training_passes throwaway images into guide, pass k at 2^k samples per pixel,
+	//refining it after each, and leaves it done training
+	void train_guide(const compiled_scene& world, const camera& cam, const vec3& background, const render_settings& settings, path_guide& guide);
+
+	//body(begin, end) over contiguous slices of [0, count), one slice per thread
+	void parallel_for(int count, int threads, const std::function<void(int, int)>& body);
+
+	//plain text ppm, gamma 2
+	void write_image(std::ostream& out, const framebuffer& image);
+
+	//uncompressed scanline OpenEXR with linear R, G, B and every enabled channel as 32 bit floats,
+	//components named like "normal.X"; out must be opened in binary mode
+	void write_exr(std::ostream& out, const framebuffer& image);
+}
@@ -0,0 +1,208 @@
+#include "restir.h"
+
+#include"integrator.h"
+#include"renderer.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		//first hit of a pixel that takes its direct light from a reservoir
+		struct restir_pixel
+		{
+			ray r_in;
+			hit_record rec;
+			const material* mat;
+			bool valid;
+		};
+
+		inline double luminance(const vec3& c)
+		{
+			return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+		}
+
+		//unshadowed light the sample sends out of the pixel, per unit light area; 0 when it cannot reach
+		double target_density(const restir_pixel& px, const light_sample& ls)
+		{
+			vec3 wi = ls.p - px.rec.p;
+			auto dist_squared = wi.length_squared();
+			if (dist_squared <= 0)
+			{
+				return 0;
+			}
+			wi /= sqrt(dist_squared);
+			auto geometry = std::fabs(dot(ls.normal, wi)) / dist_squared;
+			return luminance(px.mat->eval(px.r_in, px.rec, wi) * ls.radiance) * geometry;
+		}
+
+		bool similar(const restir_pixel& a, const restir_pixel& b)
+		{
+			return b.valid == true && dot(a.rec.normal, b.rec.normal) > 0.9 && std::fabs(a.rec.t - b.rec.t) < 0.1 * a.rec.t;
+		}
+
+		bool unoccluded(const compiled_scene& world, const restir_pixel& px, const light_sample& ls)
+		{
+			vec3 d = ls.p - px.rec.p;
+			auto dist = d.length();
+			return world.occluded(ray(px.rec.p, d / dist, px.r_in.get_time()), 0.001, dist * 0.999) == false;
+		}
+	}
+
+	void restir_pass(const compiled_scene& world, const camera& cam, const vec3& background, int width, int height,
+		int max_depth, const restir_settings& settings, const tile& t, vector<vec3>& sum, aov_sample* first)
+	{
+		const int tw = t.width(), th = t.height();
+		vector<restir_pixel> pixels(tw * th);
+		vector<reservoir> reservoirs(tw * th);
+
+		//first hits, everything but their direct light, and one resampled light sample each
+		for (int y = 0; y < th; ++y)
+		{
+			for (int x = 0; x < tw; ++x)
+			{
+				auto i = y * tw + x;
+				restir_pixel& px = pixels[i];
+				px.valid = false;
+				px.r_in = pixel_ray(cam, t.x0 + x, t.y0 + y, width, height);
+				if (first != nullptr)
+				{
+					record_background(px.r_in, first[i]);
+				}
+				hit_detail detail;
+				if (max_depth <= 0 || world.hit(px.r_in, 0.001, infinity, px.rec, first != nullptr ? &detail : nullptr) == false)
+				{
+					if (max_depth > 0)
+					{
+						sum[i] += background;
+					}
+					continue;
+				}
+
+				px.mat = &world.get_material(px.rec.mat_id);
+				if (first != nullptr)
+				{
+					record_first_hit(px.r_in, px.rec, detail.velocity, *px.mat, first[i]);
+				}
+				sum[i] += px.mat->emitted(px.rec.u, px.rec.v, px.rec.p);
+				scatter_record srec;
+				if (px.mat->sample(px.r_in, px.rec, srec) == false)
+				{
+					continue;
+				}
+				if (srec.is_specular == true || world.light_count() == 0)
+				{
+					sum[i] += srec.attenuation * ray_color(srec.scattered, background, world, max_depth - 1);
+					continue;
+				}
+				//lights hit by the continuation were already counted by the reservoir
+				sum[i] += srec.attenuation * ray_color(srec.scattered, background, world, max_depth - 1, false);
+				px.valid = true;
+
+				reservoir& r = reservoirs[i];
+				for (int c = 0; c < settings.candidates; ++c)
+				{
+					light_sample ls;
+					if (world.sample_light(px.rec.p, px.rec.normal, px.r_in.get_time(), settings.candidate_selection, ls) == true && ls.pdf > 0)
+					{
+						//target over source density, both in area measure
+						auto geometry = std::fabs(dot(ls.normal, ls.wi)) / (ls.dist * ls.dist);
+						auto target = target_density(px, ls);
+						if (geometry > 0 && target > 0)
+						{
+							r.update(ls, target, target / (ls.pdf * geometry));
+						}
+					}
+				}
+				r.count = settings.candidates;
+				r.weight = r.target > 0 ? r.weight_sum / (r.count * r.target) : 0;
+
+				//the survivor's shadow ray; an occluded sample is not worth passing on
+				if (r.weight > 0 && unoccluded(world, px, r.sample) == false)
+				{
+					r.weight = 0;
+				}
+			}
+		}
+
+		if (settings.spatial_reuse == true)
+		{
+			vector<reservoir> merged(tw * th);
+			vector<int> sources;
+			for (int y = 0; y < th; ++y)
+			{
+				for (int x = 0; x < tw; ++x)
+				{
+					auto i = y * tw + x;
+					const restir_pixel& px = pixels[i];
+					if (px.valid == false)
+					{
+						continue;
+					}
+
+					//the pixel's own reservoir, then a few similar ones around it
+					reservoir& out = merged[i];
+					const reservoir& own = reservoirs[i];
+					out.update(own.sample, own.target, own.target * own.weight * own.count);
+					out.count = own.count;
+					sources.assign(1, i);
+					for (int k = 0; k < settings.neighbors; ++k)
+					{
+						auto nx = x + static_cast<int>(floor(random_double(-settings.radius, settings.radius + 1)));
+						auto ny = y + static_cast<int>(floor(random_double(-settings.radius, settings.radius + 1)));
+						if (nx < 0 || ny < 0 || nx >= tw || ny >= th || (nx == x && ny == y))
+						{
+							continue;
+						}
+						auto j = ny * tw + nx;
+						if (similar(px, pixels[j]) == false)
+						{
+							continue;
+						}
+
+						const reservoir& other = reservoirs[j];
+						auto target = other.weight > 0 ? target_density(px, other.sample) : 0;
+						out.update(other.sample, target, target * other.weight * other.count);
+						out.count += other.count;
+						sources.push_back(j);
+					}
+
+					//normalize by the candidates of the pixels that could have produced the survivor: their reservoirs
+					//dropped occluded samples, so a neighbour counts only if it also sees the survivor; the pixel's own
+					//visibility is tested when it is shaded
+					double z = 0;
+					for (auto s : sources)
+					{
+						if (s == i ? out.target > 0 : target_density(pixels[s], out.sample) > 0 && unoccluded(world, pixels[s], out.sample) == true)
+						{
+							z += reservoirs[s].count;
+						}
+					}
+					out.weight = out.target > 0 && z > 0 ? out.weight_sum / (z * out.target) : 0;
+				}
+			}
+			reservoirs.swap(merged);
+		}
+
+		//shade with the surviving sample
+		for (int i = 0; i < tw * th; ++i)
+		{
+			const restir_pixel& px = pixels[i];
+			const reservoir& r = reservoirs[i];
+			if (px.valid == false || r.weight <= 0)
+			{
+				continue;
+			}
+			//a reused sample has not been tested from this pixel yet
+			if (settings.spatial_reuse == true && unoccluded(world, px, r.sample) == false)
+			{
+				continue;
+			}
+
+			vec3 wi = r.sample.p - px.rec.p;
+			auto dist_squared = wi.length_squared();
+			wi /= sqrt(dist_squared);
+			auto geometry = std::fabs(dot(r.sample.normal, wi)) / dist_squared;
+			sum[i] += px.mat->eval(px.r_in, px.rec, wi) * r.sample.radiance * (geometry * r.weight);
+		}
+	}
+}
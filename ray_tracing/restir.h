@@ -0,0 +1,58 @@
+#pragma once
+
+#include"compiled_scene.h"
+#include"constantAndTool.h"
+#include"integrator.h"
+#include"material.h"
+
+namespace ray_tracing
+{
+	struct tile;
+
+	struct restir_settings
+	{
+		int candidates = 32;		//light samples streamed through each pixel's reservoir
+		light_selection candidate_selection = select_power;		//cheap is better than accurate here
+		bool spatial_reuse = true;	//also resample the reservoirs of nearby pixels of the same tile
+		int neighbors = 5;
+		int radius = 10;			//in pixels
+	};
+
+	//one light sample kept out of a stream of weighted candidates
+	struct reservoir
+	{
+		light_sample sample;
+		double target = 0;			//target density of sample at the owning pixel, in area measure
+		double weight_sum = 0;
+		double count = 0;			//candidates seen
+		double weight = 0;			//contribution weight of sample, weight_sum / (count * target)
+
+		//keep candidate with probability w / weight_sum
+		bool update(const light_sample& candidate, double candidate_target, double w)
+		{
+			weight_sum += w;
+			if (w > 0 && random_double() * weight_sum < w)
+			{
+				sample = candidate;
+				target = candidate_target;
+				return true;
+			}
+			return false;
+		}
+	};
+
+	/*
+	Direct light at the first hit by resampled importance sampling.
+	Every pixel streams settings.candidates cheap light samples through a reservoir, weighted by
+	the unshadowed light they would deliver, and only the survivor gets a shadow ray. Spatial
+	reuse then merges the reservoirs of similar pixels inside the tile, which multiplies the
+	effective candidate count at the cost of one more shadow ray, and one for each neighbour that
+	could have produced the survivor: the merge normalizes only by the pixels that see it, which
+	keeps the estimate unbiased around shadow edges. Light found by the rest of the path is left
+	to ray_color.
+	Adds one sample of every pixel of t to sum, stored row by row over the tile.
+	*/
+	//first, when given, receives what each camera ray met, in the same order
+	void restir_pass(const compiled_scene& world, const camera& cam, const vec3& background, int width, int height,
+		int max_depth, const restir_settings& settings, const tile& t, vector<vec3>& sum, aov_sample* first = nullptr);
+}
@@ -0,0 +1,279 @@
+#include"sampler.h"
+
+#include<random>
+#include"constantAndTool.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const int mask_size = 64;		//a power of two, offsets wrap with a mask
+
+		inline uint32_t hash(uint32_t x)
+		{
+			x ^= x >> 16;
+			x *= 0x7feb352du;
+			x ^= x >> 15;
+			x *= 0x846ca68bu;
+			x ^= x >> 16;
+			return x;
+		}
+
+		inline uint32_t hash_combine(uint32_t seed, uint32_t v)
+		{
+			return hash(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+		}
+
+		inline uint32_t reverse_bits(uint32_t x)
+		{
+			x = (x << 16) | (x >> 16);
+			x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+			x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+			x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+			x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+			return x;
+		}
+
+		//Owen scrambling as a hash, each bit flipped depending only on the bits above it (Burley 2020)
+		inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+		{
+			x = reverse_bits(x);
+			x += seed;
+			x ^= x * 0x6c50b47cu;
+			x ^= x * 0xb82f1e52u;
+			x ^= x * 0xc7afe638u;
+			x ^= x * 0x8d22f6e6u;
+			return reverse_bits(x);
+		}
+
+		//the first two Sobol dimensions, a (0, 2) sequence: every power of two prefix is stratified in 2d
+		inline uint32_t sobol(uint32_t index, uint32_t component)
+		{
+			if (component == 0)
+			{
+				return reverse_bits(index);
+			}
+			uint32_t v = 1u << 31, result = 0;
+			for (; index != 0; index >>= 1, v ^= v >> 1)
+			{
+				if ((index & 1) != 0)
+				{
+					result ^= v;
+				}
+			}
+			return result;
+		}
+
+		//shuffling the index as well keeps pairs that share a seed from lining up
+		inline double owen_sobol(uint32_t index, uint32_t component, uint32_t seed)
+		{
+			index = nested_uniform_scramble(index, seed);
+			return nested_uniform_scramble(sobol(index, component), hash_combine(seed, component + 1)) / 4294967296.0;
+		}
+
+		//ranks of a void and cluster pattern (Ulichney 1993): every threshold of it is evenly spread
+		vector<float> build_blue_noise_mask()
+		{
+			const int n = mask_size * mask_size;
+			const double sigma = 1.5;
+			vector<double> kernel(n);
+			for (int y = 0; y < mask_size; ++y)
+			{
+				for (int x = 0; x < mask_size; ++x)
+				{
+					auto dx = std::min(x, mask_size - x), dy = std::min(y, mask_size - y);
+					kernel[y * mask_size + x] = exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+				}
+			}
+
+			vector<char> ones(n, 0);
+			vector<double> energy(n, 0);
+			auto splat = [&](int p, double sign)
+			{
+				int px = p % mask_size, py = p / mask_size;
+				for (int q = 0; q < n; ++q)
+				{
+					auto dx = (q % mask_size - px) & (mask_size - 1), dy = (q / mask_size - py) & (mask_size - 1);
+					energy[q] += sign * kernel[dy * mask_size + dx];
+				}
+			};
+			auto tightest_cluster = [&]()
+			{
+				int best = -1;
+				for (int p = 0; p < n; ++p)
+				{
+					if (ones[p] == 1 && (best < 0 || energy[p] > energy[best]))
+					{
+						best = p;
+					}
+				}
+				return best;
+			};
+			auto largest_void = [&]()
+			{
+				int best = -1;
+				for (int p = 0; p < n; ++p)
+				{
+					if (ones[p] == 0 && (best < 0 || energy[p] < energy[best]))
+					{
+						best = p;
+					}
+				}
+				return best;
+			};
+
+			//a random tenth of the points, relaxed by moving the tightest cluster into the largest void
+			std::mt19937 engine(1);
+			const int initial = n / 10;
+			for (int count = 0; count < initial;)
+			{
+				int p = static_cast<int>(engine() % n);
+				if (ones[p] == 0)
+				{
+					ones[p] = 1;
+					splat(p, 1);
+					++count;
+				}
+			}
+			for (int i = 0; i < n; ++i)
+			{
+				auto cluster = tightest_cluster();
+				ones[cluster] = 0;
+				splat(cluster, -1);
+				auto hole = largest_void();
+				ones[hole] = 1;
+				splat(hole, 1);
+				if (hole == cluster)
+				{
+					break;
+				}
+			}
+
+			//ranks below the initial points come from taking clusters away, the rest from filling voids
+			vector<int> rank(n);
+			auto relaxed = ones;
+			auto relaxed_energy = energy;
+			for (int r = initial - 1; r >= 0; --r)
+			{
+				auto cluster = tightest_cluster();
+				ones[cluster] = 0;
+				splat(cluster, -1);
+				rank[cluster] = r;
+			}
+			ones = relaxed;
+			energy = relaxed_energy;
+			for (int r = initial; r < n; ++r)
+			{
+				auto hole = largest_void();
+				ones[hole] = 1;
+				splat(hole, 1);
+				rank[hole] = r;
+			}
+
+			vector<float> mask(n);
+			for (int p = 0; p < n; ++p)
+			{
+				mask[p] = static_cast<float>((rank[p] + 0.5) / n);
+			}
+			return mask;
+		}
+
+		const vector<float>& blue_noise_mask()
+		{
+			static const vector<float> mask = build_blue_noise_mask();
+			return mask;
+		}
+
+		class independent_sampler : public sampler
+		{
+		public:
+			virtual void start_pixel_sample(int x, int y, int index) override {}
+			virtual double get(uint32_t dimension) override { return random_double(); }
+		};
+
+		//every pixel and every pair of dimensions gets its own scramble
+		class sobol_sampler : public sampler
+		{
+		private:
+			uint32_t seed;
+			uint32_t pixel_seed = 0;
+			uint32_t index = 0;
+
+		public:
+			sobol_sampler(unsigned s) : seed(hash(s)) {}
+
+			virtual void start_pixel_sample(int x, int y, int i) override
+			{
+				pixel_seed = hash_combine(hash_combine(seed, static_cast<uint32_t>(x)), static_cast<uint32_t>(y));
+				index = static_cast<uint32_t>(i);
+			}
+			virtual double get(uint32_t dimension) override
+			{
+				return owen_sobol(index, dimension & 1, hash_combine(pixel_seed, dimension >> 1));
+			}
+		};
+
+		//the same points in every pixel, each pixel shifting them (Cranley-Patterson) by its mask value,
+		//so the error left after any number of samples is spread as blue noise over the image
+		class blue_noise_sampler : public sampler
+		{
+		private:
+			uint32_t seed;
+			int x = 0, y = 0;
+			uint32_t index = 0;
+
+		public:
+			blue_noise_sampler(unsigned s) : seed(hash(s)) { blue_noise_mask(); }
+
+			virtual void start_pixel_sample(int px, int py, int i) override
+			{
+				x = px;
+				y = py;
+				index = static_cast<uint32_t>(i);
+			}
+			virtual double get(uint32_t dimension) override
+			{
+				auto pair_seed = hash_combine(seed, dimension >> 1);
+				auto value = owen_sobol(index, dimension & 1, pair_seed);
+				//each dimension reads the mask at its own offset, or they would all shift alike
+				auto offset = hash_combine(pair_seed, (dimension & 1) + 1);
+				auto mx = (x + static_cast<int>(offset)) & (mask_size - 1);
+				auto my = (y + static_cast<int>(offset >> 8)) & (mask_size - 1);
+				value += blue_noise_mask()[my * mask_size + mx];
+				return value >= 1 ? value - 1 : value;
+			}
+		};
+	}
+
+	std::unique_ptr<sampler> make_sampler(sampler_type type, unsigned seed)
+	{
+		switch (type)
+		{
+		case sampler_sobol:
+			return std::unique_ptr<sampler>(new sobol_sampler(seed));
+		case sampler_blue_noise:
+			return std::unique_ptr<sampler>(new blue_noise_sampler(seed));
+		default:
+			return std::unique_ptr<sampler>(new independent_sampler());
+		}
+	}
+
+	const char* sampler_name(sampler_type type)
+	{
+		const char* names[] = { "independent", "sobol", "blue_noise" };
+		return names[type];
+	}
+
+	thread_local sampler_binding current_sampler;
+
+	void use_sampler(sampler* s)
+	{
+		current_sampler.active = s;
+		current_sampler.bounce_offset = 0;
+	}
+
+	void start_bounce(int bounce)
+	{
+		current_sampler.bounce_offset = static_cast<uint32_t>(bounce) * bounce_dimensions;
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include<cstdint>
+#include<memory>
+
+namespace ray_tracing
+{
+	enum sampler_type
+	{
+		sampler_independent,	//a fresh random number for every dimension
+		sampler_sobol,			//Owen scrambled Sobol points, scrambled apart for every pixel
+		sampler_blue_noise		//one Owen scrambled Sobol sequence, shifted per pixel by a blue noise mask
+	};
+
+	/*
+	Fixed dimensions of a camera sample. The ones before dim_light are drawn once per path, the
+	rest repeat for every bounce in a block of bounce_dimensions. 2d dimensions start on an even
+	index so the two values come from the same stratified pair.
+	*/
+	enum sample_dimension : uint32_t
+	{
+		dim_pixel = 0,			//2d, jitter inside the pixel
+		dim_lens = 2,			//2d, point on the lens
+		dim_time = 4,
+		dim_light = 6,			//2d, point on the chosen light
+		dim_light_select = 8,
+		dim_bsdf_lobe = 9,		//discrete choices inside a material, like reflect or refract
+		dim_bsdf = 10,			//2d, scattered direction
+		bounce_dimensions = 6
+	};
+
+	//the values of one pixel sample, in [0, 1) for every dimension
+	class sampler
+	{
+	public:
+		virtual ~sampler() = default;
+		//index counts the samples already taken in pixel (x, y)
+		virtual void start_pixel_sample(int x, int y, int index) = 0;
+		virtual double get(uint32_t dimension) = 0;
+	};
+
+	std::unique_ptr<sampler> make_sampler(sampler_type type, unsigned seed);
+	const char* sampler_name(sampler_type type);
+
+	/*
+	The sampler the calling thread's camera paths draw from. Consumers ask for their fixed
+	dimension with sample_1d and sample_2d and never see the sampler; with none set, as in
+	ReSTIR passes and the benchmarks that trace paths themselves, they get random_double.
+	*/
+	void use_sampler(sampler* s);
+	//moves the per bounce dimensions to the block of bounce
+	void start_bounce(int bounce);
+
+	//the calling thread's sampler and bounce block, read inline on every draw
+	struct sampler_binding
+	{
+		sampler* active = nullptr;
+		uint32_t bounce_offset = 0;
+	};
+	extern thread_local sampler_binding current_sampler;
+	//in constantAndTool.h, which includes this header before defining it
+	inline double random_double();
+
+	inline double sample_1d(uint32_t dimension)
+	{
+		if (current_sampler.active == nullptr)
+		{
+			return random_double();
+		}
+		return current_sampler.active->get(dimension >= dim_light ? dimension + current_sampler.bounce_offset : dimension);
+	}
+
+	inline void sample_2d(uint32_t dimension, double& u, double& v)
+	{
+		u = sample_1d(dimension);
+		v = sample_1d(dimension + 1);
+	}
+}
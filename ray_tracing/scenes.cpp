@@ -0,0 +1,269 @@
+#include"scenes.h"
+#include"material.h"
+#include"texture.h"
+#include"constant_medium.h"
+
+namespace ray_tracing
+{
+	hittable_list final_scene() {
+		hittable_list boxes1;
+		auto ground =
+			make_shared<lambertian>(make_shared<constant_texture>(vec3(0.48, 0.83, 0.53)));
+
+		const int boxes_per_side = 20;
+		for (int i = 0; i < boxes_per_side; i++) {
+			for (int j = 0; j < boxes_per_side; j++) {
+				auto w = 100.0;
+				auto x0 = -1000.0 + i * w;
+				auto z0 = -1000.0 + j * w;
+				auto y0 = 0.0;
+				auto x1 = x0 + w;
+				auto y1 = random_double(1, 101);
+				auto z1 = z0 + w;
+
+				boxes1.add(make_shared<box>(vec3(x0, y0, z0), vec3(x1, y1, z1), ground));
+			}
+		}
+
+		hittable_list objects;
+
+		objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+
+		auto light = make_shared<diffus_light>(make_shared<constant_texture>(vec3(7, 7, 7)));
+		objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+
+		auto center1 = vec3(400, 400, 200);
+		auto center2 = center1 + vec3(30, 0, 0);
+		auto moving_sphere_material =
+			make_shared<lambertian>(make_shared<constant_texture>(vec3(0.7, 0.3, 0.1)));
+		objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+		objects.add(make_shared<sphere>(vec3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
+		objects.add(make_shared<sphere>(
+			vec3(0, 150, 145), 50, make_shared<metal>(vec3(0.8, 0.8, 0.9), 10.0)
+			));
+
+		auto boundary = make_shared<sphere>(vec3(360, 150, 145), 70, make_shared<dielectric>(1.5));
+		objects.add(boundary);
+		objects.add(make_shared<constant_medium>(
+			boundary, 0.2, make_shared<constant_texture>(vec3(0.2, 0.4, 0.9))
+			));
+		boundary = make_shared<sphere>(vec3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
+		objects.add(make_shared<constant_medium>(
+			boundary, .0001, make_shared<constant_texture>(vec3(1, 1, 1))));
+
+		auto emat = make_shared<lambertian>(make_shared<image_texture>("Bronya.jpg"));
+		objects.add(make_shared<sphere>(vec3(400, 200, 400), 100, emat));
+		auto pertext = make_shared<noise_texture>(0.1);
+		objects.add(make_shared<sphere>(vec3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
+
+		hittable_list boxes2;
+		auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
+		int ns = 1000;
+		for (int j = 0; j < ns; j++) {
+			boxes2.add(make_shared<sphere>(vec3::random(0, 165), 10, white));
+		}
+
+		objects.add(make_shared<translate>(
+			make_shared<rotate_y>(
+				make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
+			vec3(-100, 270, 395)
+			)
+		);
+
+		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+	}
+	hittable_list cornell_box()
+	{
+		hittable_list objects;
+		auto red = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.65, 0.05, 0.05)));
+		auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
+		auto green = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.12, 0.45, 0.15)));
+		auto light = make_shared<diffus_light>(make_shared<constant_texture>(vec3(7, 7, 7)));
+
+		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+		objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+		objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+		objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+		objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+		objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+		shared_ptr<hittable> box1 = make_shared<box>(vec3(0, 0, 0), vec3(165, 330, 165), white);
+		box1 = make_shared<rotate_y>(box1, 15);
+		box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+		objects.add(box1);
+		
+		shared_ptr<hittable> box2 = make_shared<box>(vec3(0, 0, 0), vec3(165, 165, 165), white);
+		box2 = make_shared<rotate_y>(box2, -18);
+		box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+		objects.add(box2);
+
+		objects.add(make_shared<constant_medium>(box1, 0.01, make_shared<constant_texture>(vec3(0, 0, 0))));
+		objects.add(make_shared<constant_medium>(box2, 0.01, make_shared<constant_texture>(vec3(1, 1, 1))));
+		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+	}
+
+	hittable_list simple_light()
+	{
+		hittable_list objects;
+		auto pertext = make_shared<noise_texture>(4);
+		objects.add(make_shared<sphere>(vec3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+		objects.add(make_shared<sphere>(vec3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+
+		auto diff_light = make_shared<diffus_light>(make_shared<constant_texture>(vec3(4, 4, 4)));
+		//objects.add(make_shared<sphere>(vec3(0, 7, 0), 2, diff_light));
+		objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, diff_light));
+
+		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+		//return objects;
+	}
+
+	hittable_list texture_mapping()
+	{
+		auto bronya_surface = make_shared<lambertian>(make_shared<image_texture>("Bronya.jpg"));
+		auto bronya = make_shared<sphere>(vec3(0, 0, 0), 2, bronya_surface);
+		return hittable_list(bronya);
+	}
+
+	hittable_list perlin_spheres(int bake_resolution)
+	{
+
+		hittable_list objects;
+		auto pertext = make_shared<noise_texture>(5.0);
+		if (bake_resolution > 0)
+		{
+			pertext->bake(aabb(vec3(-1, 0, -1), vec3(1, 2, 1)), bake_resolution);
+		}
+		objects.add(make_shared<sphere>(vec3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
+		objects.add(make_shared<sphere>(vec3(0, 1, 0), 1, make_shared<lambertian>(pertext)));
+		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+
+	}
+
+	hittable_list two_perlin_spheres()
+	{
+		return perlin_spheres(0);
+	}
+
+	hittable_list two_spheres()
+	{
+		hittable_list objects;
+
+		auto checkerboard = make_shared<checker_texture>
+			(
+			make_shared<constant_texture>(vec3(0.2, 0.3, 0.1)),
+			make_shared<constant_texture>(vec3(0.9, 0.9, 0.9))
+			);
+		objects.add(make_shared<sphere>(vec3(0, -10, 0), 10, make_shared<lambertian>(checkerboard)));
+		objects.add(make_shared<sphere>(vec3(0, 10, 0), 10, make_shared<lambertian>(checkerboard)));
+
+		return static_cast<hittable_list>(make_shared<bvh_node>(objects, 0.0, 1.0));
+	}
+
+	hittable_list random_scene()
+	{
+		hittable_list world;
+
+		auto checkerboard = make_shared<checker_texture>(make_shared<constant_texture>(vec3(0.2, 0.3, 0.1)),
+			make_shared<constant_texture>(vec3(0.9, 0.9, 0.9)));
+		world.add(make_shared<sphere>(vec3(0, -1000, 0), 1000, make_shared<lambertian>(checkerboard)));
+
+		int i = 1;
+		for (int a = -10; a < 10; ++a)
+		{
+			for (int b = -10; b < 10; ++b)
+			{
+				auto choose_mat = random_double();
+				vec3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+				if ((center - vec3(4, 0.2, 0)).length() > 0.9)
+				{
+					if (choose_mat < 0.8)
+					{
+						//diffuse
+						auto albedo = vec3::random() * vec3::random();
+						world.add(make_shared<moving_sphere>(center, center + vec3(0, random_double(0, 0.5), 0), 0.0, 1.0, 0.2, make_shared<lambertian>(make_shared<constant_texture>(albedo))));
+					}
+					else if (choose_mat < 0.95)
+					{
+						//metal
+						auto albedo = vec3::random(0.5, 1);
+						auto fuzz = random_double(0, 0.5);
+						world.add(make_shared<sphere>(center, 0.2, make_shared<metal>(albedo, fuzz)));
+					}
+					else
+					{
+						//glass
+						world.add(make_shared<sphere>(center, 0.2, make_shared<dielectric>(1.5)));
+					}
+				}
+			}
+		}
+
+		world.add(make_shared<sphere>(vec3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
+
+		world.add(
+			make_shared<sphere>(vec3(-4, 1, 0), 1.0, make_shared<lambertian>(make_shared<constant_texture>(vec3(0.4, 0.2, 0.1)))));
+
+		world.add(
+			make_shared<sphere>(vec3(4, 1, 0), 1.0, make_shared<metal>(vec3(0.7, 0.6, 0.5), 0.0)));
+
+		return static_cast<hittable_list>(make_shared<bvh_node>(world, 0.0, 1.0));
+	}
+
+	hittable_list many_lights()
+	{
+		hittable_list objects;
+		auto white = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.73, 0.73, 0.73)));
+		objects.add(make_shared<xz_rect>(-60, 60, -60, 60, 0, white));
+		objects.add(make_shared<sphere>(vec3(-8, 4, 0), 4, white));
+		objects.add(make_shared<sphere>(vec3(8, 4, 0), 4, make_shared<metal>(vec3(0.8, 0.8, 0.8), 0.3)));
+		objects.add(make_shared<box>(vec3(-3, 0, -12), vec3(3, 10, -6), white));
+
+		hittable_list lights;
+		const int light_count = 4000;
+		for (int i = 0; i < light_count; ++i)
+		{
+			auto emit = make_shared<diffus_light>(make_shared<constant_texture>(vec3::random(0.2, 1) * pow(10, random_double(-1, 2))));
+			vec3 center(random_double(-50, 50), random_double(13, 16), random_double(-50, 50));
+			if (random_double() < 0.5)
+			{
+				lights.add(make_shared<sphere>(center, random_double(0.05, 0.2), emit));
+			}
+			else
+			{
+				auto half = random_double(0.1, 0.4);
+				lights.add(make_shared<xz_rect>(center.x() - half, center.x() + half, center.z() - half, center.z() + half, center.y(), emit));
+			}
+		}
+		objects.add(make_shared<bvh_node>(lights, 0.0, 1.0));
+
+		return objects;
+	}
+
+	shared_ptr<const density_grid> cloud_grid(int majorant_cell)
+	{
+		auto noise = make_shared<perlin>();
+		auto field = [noise](const vec3& p)
+		{
+			vec3 q(p.x() / 6, (p.y() - 4) / 3, p.z() / 6);
+			return 3 * ffmax(0, 1 - q.length() - 0.8 * noise->turb(p * 0.5));
+		};
+		return make_shared<density_grid>(aabb(vec3(-6, 1, -6), vec3(6, 7, 6)), 128, 64, 128, field, majorant_cell);
+	}
+
+	hittable_list cloud_scene(const shared_ptr<const density_grid>& grid)
+	{
+		hittable_list objects;
+		auto ground = make_shared<lambertian>(make_shared<constant_texture>(vec3(0.48, 0.83, 0.53)));
+		objects.add(make_shared<xz_rect>(-100, 100, -100, 100, 0, ground));
+		auto sun = make_shared<diffus_light>(make_shared<constant_texture>(vec3(15, 14, 12)));
+		objects.add(make_shared<xz_rect>(-5, 5, -5, 5, 20, sun));
+		objects.add(make_shared<grid_medium>(grid, make_shared<constant_texture>(vec3(0.9, 0.9, 0.9))));
+		return objects;
+	}
+
+	hittable_list cloud()
+	{
+		return cloud_scene(cloud_grid(density_grid::brick_size));
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include"hittable.h"
+#include"grid_medium.h"
+
+namespace ray_tracing
+{
+	hittable_list final_scene();
+	hittable_list cornell_box();
+
+	//About the rectangle and the light source
+	hittable_list simple_light();
+	hittable_list texture_mapping();
+
+	//about perlin noise; a bake_resolution above 0 bakes the turbulence around the small sphere
+	hittable_list perlin_spheres(int bake_resolution);
+	hittable_list two_perlin_spheres();
+
+	//about rgb texture
+	hittable_list two_spheres();
+	hittable_list random_scene();
+
+	//thousands of small emitters spanning three orders of magnitude in power, hung above a diffuse floor out of view
+	hittable_list many_lights();
+
+	//a flattened ball of density eaten into by turbulence, baked into a 128 x 64 x 128 grid
+	shared_ptr<const density_grid> cloud_grid(int majorant_cell);
+	hittable_list cloud_scene(const shared_ptr<const density_grid>& grid);
+	hittable_list cloud();
+}
@@ -1,42 +1,127 @@
 #include "texture.h"
+#include "hittable.h"
+#include "texture_program.h"
+
+#include<algorithm>
+#include<random>
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
 
 namespace ray_tracing
 {
 
-	//make the value of permutation table out of order
-	void perlin::permute(int* p, int n)
+	namespace
 	{
-		for (int i = n - 1; i > 0; --i)
+		//a fixed seed of its own, so scenes draw the same numbers from the shared generator with or without noise
+		perlin::tables build_tables()
 		{
-			int target = random_int(0, i);
-			int tmp = p[i];
-			p[i] = p[target];	//Get a random value
-			p[target] = tmp;	//Prevent duplicate 
+			perlin::tables t;
+			std::mt19937 engine(2020);
+			std::uniform_real_distribution<double> uniform(-1, 1);
+			for (int i = 0; i < perlin::point_count; ++i)
+			{
+				auto g = unit_vector(vec3(uniform(engine), uniform(engine), uniform(engine)));
+				t.packed[i] = 0;
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					//rounded to what the packed form holds, so both forms describe the same noise
+					int q = static_cast<int>(std::lround(g[axis] * perlin::gradient_scale));
+					t.gradient[axis][i] = double(q) / perlin::gradient_scale;
+					t.packed[i] |= (q & 1023) << (10 * axis);
+				}
+			}
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				for (int i = 0; i < perlin::point_count; ++i)
+				{
+					t.perm[axis][i] = i;
+				}
+				std::shuffle(t.perm[axis], t.perm[axis] + perlin::point_count, engine);
+			}
+			return t;
 		}
-	}
 
-	int* perlin::perlin_generate_perm()
-	{
-		auto p = new int[point_count];
-		for (int i = 0; i < perlin::point_count; ++i)
+		const perlin::tables& shared_tables()
 		{
-			p[i] = i;
+			static const perlin::tables t = build_tables();
+			return t;
 		}
-		permute(p, point_count);
-		return p;
-	}
 
-	perlin::perlin()
-	{
-		ran_vec3 = new vec3[point_count];
-		for (int i = 0; i < point_count; ++i)
+#ifdef __AVX2__
+		//the masked form, the plain one reads an undefined register gcc warns about
+		inline __m256i gather(const int* base, __m256i index)
 		{
-			ran_vec3[i] = unit_vector(vec3::random(-1, 1));
+			return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base, index, _mm256_set1_epi32(-1), 4);
+		}
+
+		//floor and fraction of eight coordinates given as two halves; the fraction is taken in double,
+		//far from the origin a float has too few bits left for it
+		inline void split(__m256d low, __m256d high, __m256i& lattice, __m256& fraction)
+		{
+			__m256d floor_low = _mm256_floor_pd(low), floor_high = _mm256_floor_pd(high);
+			lattice = _mm256_set_m128i(_mm256_cvtpd_epi32(floor_high), _mm256_cvtpd_epi32(floor_low));
+			fraction = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(high, floor_high)), _mm256_cvtpd_ps(_mm256_sub_pd(low, floor_low)));
+		}
+
+		//one signed 10 bit component of a packed gradient, shift picking which
+		inline __m256 component(__m256i packed, int shift)
+		{
+			__m256i q = _mm256_srai_epi32(_mm256_sll_epi32(packed, _mm_cvtsi32_si128(22 - shift)), 22);
+			return _mm256_mul_ps(_mm256_cvtepi32_ps(q), _mm256_set1_ps(1.0f / perlin::gradient_scale));
+		}
+
+		//noise at eight points, one per float lane, the arithmetic of perlin::noise
+		inline __m256 noise8(const perlin::tables& t, const __m256d x[2], const __m256d y[2], const __m256d z[2])
+		{
+			const __m256i mask = _mm256_set1_epi32(perlin::point_count - 1);
+			const __m256i one = _mm256_set1_epi32(1);
+			const __m256 ones = _mm256_set1_ps(1);
+
+			__m256i i, j, k;
+			__m256 u, v, w;
+			split(x[0], x[1], i, u);
+			split(y[0], y[1], j, v);
+			split(z[0], z[1], k, w);
+
+			//each axis's permutation at the lower and upper corner
+			__m256i px[2] = { gather(t.perm[0], _mm256_and_si256(i, mask)), gather(t.perm[0], _mm256_and_si256(_mm256_add_epi32(i, one), mask)) };
+			__m256i py[2] = { gather(t.perm[1], _mm256_and_si256(j, mask)), gather(t.perm[1], _mm256_and_si256(_mm256_add_epi32(j, one), mask)) };
+			__m256i pz[2] = { gather(t.perm[2], _mm256_and_si256(k, mask)), gather(t.perm[2], _mm256_and_si256(_mm256_add_epi32(k, one), mask)) };
+			__m256 du[2] = { u, _mm256_sub_ps(u, ones) };
+			__m256 dv[2] = { v, _mm256_sub_ps(v, ones) };
+			__m256 dw[2] = { w, _mm256_sub_ps(w, ones) };
+
+			//gradient of corner (di, dj, dk), all three components in one gather, dotted with the offset from it
+			__m256 c[2][2][2];
+			for (int di = 0; di < 2; ++di)
+			{
+				for (int dj = 0; dj < 2; ++dj)
+				{
+					for (int dk = 0; dk < 2; ++dk)
+					{
+						__m256i g = gather(t.packed, _mm256_xor_si256(_mm256_xor_si256(px[di], py[dj]), pz[dk]));
+						c[di][dj][dk] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(component(g, 0), du[di]), _mm256_mul_ps(component(g, 10), dv[dj])),
+							_mm256_mul_ps(component(g, 20), dw[dk]));
+					}
+				}
+			}
+
+			auto smooth = [](__m256 a) { return _mm256_mul_ps(_mm256_mul_ps(a, a), _mm256_sub_ps(_mm256_set1_ps(3), _mm256_add_ps(a, a))); };
+			auto lerp = [](__m256 a, __m256 b, __m256 s) { return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), s)); };
+			__m256 uu = smooth(u), vv = smooth(v), ww = smooth(w);
+			__m256 y0z0 = lerp(c[0][0][0], c[1][0][0], uu);
+			__m256 y1z0 = lerp(c[0][1][0], c[1][1][0], uu);
+			__m256 y0z1 = lerp(c[0][0][1], c[1][0][1], uu);
+			__m256 y1z1 = lerp(c[0][1][1], c[1][1][1], uu);
+			return lerp(lerp(y0z0, y1z0, vv), lerp(y0z1, y1z1, vv), ww);
 		}
+#endif
+	}
 
-		perm_x = perlin_generate_perm();
-		perm_y = perlin_generate_perm();
-		perm_z = perlin_generate_perm();
+	perlin::perlin()
+		: shared(&shared_tables())
+	{
 	}
 
 	double perlin::noise(const vec3& p) const
@@ -65,7 +150,8 @@ namespace ray_tracing
 					//Finds the index of the gradient table by the index values of the permutation table
 					//The gradient value is found by the index of the gradient table
 					//Here, the operands between Perm have no effect, just the color of the result
-					c[di][dj][dk] = ran_vec3[perm_x[(i + di) & 255] ^ perm_y[(j + dj) & 255] ^ perm_z[(k + dk) & 255]];
+					auto g = shared->perm[0][(i + di) & 255] ^ shared->perm[1][(j + dj) & 255] ^ shared->perm[2][(k + dk) & 255];
+					c[di][dj][dk] = vec3(shared->gradient[0][g], shared->gradient[1][g], shared->gradient[2][g]);
 				}
 			}
 		}
@@ -74,6 +160,33 @@ namespace ray_tracing
 	}
 
 	double perlin::turb(const vec3& p, int depth) const
+	{
+#ifdef __AVX2__
+		//eight octaves per call of noise8, lanes past depth weigh nothing
+		double accum = 0, frequency = 1, weight = 1;
+		for (int octave = 0; octave < depth; octave += 8)
+		{
+			const __m256d low = _mm256_set_pd(8 * frequency, 4 * frequency, 2 * frequency, frequency);
+			const __m256d high = _mm256_mul_pd(low, _mm256_set1_pd(16));
+			__m256d x[2] = { _mm256_mul_pd(_mm256_set1_pd(p.x()), low), _mm256_mul_pd(_mm256_set1_pd(p.x()), high) };
+			__m256d y[2] = { _mm256_mul_pd(_mm256_set1_pd(p.y()), low), _mm256_mul_pd(_mm256_set1_pd(p.y()), high) };
+			__m256d z[2] = { _mm256_mul_pd(_mm256_set1_pd(p.z()), low), _mm256_mul_pd(_mm256_set1_pd(p.z()), high) };
+			float lanes[8];
+			_mm256_storeu_ps(lanes, noise8(*shared, x, y, z));
+			for (int lane = 0; lane < 8 && octave + lane < depth; ++lane)
+			{
+				accum += weight * lanes[lane];
+				weight *= 0.5;
+			}
+			frequency *= 256;
+		}
+		return std::fabs(accum);
+#else
+		return turb_scalar(p, depth);
+#endif
+	}
+
+	double perlin::turb_scalar(const vec3& p, int depth) const
 	{
 		auto accum = 0.0;
 		vec3 temp_p = p;
@@ -88,30 +201,156 @@ namespace ray_tracing
 		return std::fabs(accum);
 	}
 
-	vec3 image_texture::value(double u, double v, const vec3& p) const 
+	noise_volume::noise_volume(const perlin& noise, const aabb& bounds, int resolution, int depth)
+		: box(bounds), n(resolution + 1)
 	{
-		if (data == nullptr)
+		vec3 size = bounds.get_max() - bounds.get_min();
+		inverse_voxel = vec3(resolution / size.x(), resolution / size.y(), resolution / size.z());
+		values.resize(static_cast<size_t>(n) * n * n);
+		for (int z = 0; z < n; ++z)
 		{
-			return vec3(0, 1, 1);
+			for (int y = 0; y < n; ++y)
+			{
+				for (int x = 0; x < n; ++x)
+				{
+					vec3 p = bounds.get_min() + vec3(x / inverse_voxel.x(), y / inverse_voxel.y(), z / inverse_voxel.z());
+					values[(static_cast<size_t>(z) * n + y) * n + x] = static_cast<float>(noise.turb(p, depth));
+				}
+			}
+		}
+	}
+
+	bool noise_volume::contains(const vec3& p) const
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (p[axis] < box.get_min()[axis] || p[axis] > box.get_max()[axis])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	double noise_volume::value(const vec3& p) const
+	{
+		int c[3];
+		double f[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			auto g = (p[axis] - box.get_min()[axis]) * inverse_voxel[axis];
+			c[axis] = std::min(static_cast<int>(g), n - 2);
+			f[axis] = g - c[axis];
+		}
+
+		auto at = [&](int dx, int dy, int dz) { return values[(static_cast<size_t>(c[2] + dz) * n + c[1] + dy) * n + c[0] + dx]; };
+		auto lerp = [](double a, double b, double t) { return a + (b - a) * t; };
+		auto y0z0 = lerp(at(0, 0, 0), at(1, 0, 0), f[0]);
+		auto y1z0 = lerp(at(0, 1, 0), at(1, 1, 0), f[0]);
+		auto y0z1 = lerp(at(0, 0, 1), at(1, 0, 1), f[0]);
+		auto y1z1 = lerp(at(0, 1, 1), at(1, 1, 1), f[0]);
+		return lerp(lerp(y0z0, y1z0, f[1]), lerp(y0z1, y1z1, f[1]), f[2]);
+	}
+
+	namespace
+	{
+		thread_local double current_footprint = 0;
+	}
+
+	void use_footprint(double uv_width)
+	{
+		current_footprint = uv_width;
+	}
+
+	vec3 texture::value_at(const hit_record& rec) const
+	{
+		return value(rec.u, rec.v, rec.p);
+	}
+
+	void texture::compile(texture_program& program) const
+	{
+		program.emit_opaque(*this);
+	}
+
+	void constant_texture::compile(texture_program& program) const
+	{
+		program.emit_constant(color);
+	}
+
+	vec3 checker_texture::value_at(const hit_record& rec) const
+	{
+		return checker_is_odd(rec.p) == true ? odd->value_at(rec) : even->value_at(rec);
+	}
+
+	void checker_texture::compile(texture_program& program) const
+	{
+		program.emit_checker(*even, *odd);
+	}
+
+	image_texture::image_texture(shared_ptr<const tiled_image> tiles)
+		: image(nullptr), resolved(false)
+	{
+		std::promise<shared_ptr<const tiled_image>> ready;
+		ready.set_value(tiles);
+		loading = ready.get_future().share();
+	}
+
+	const tiled_image* image_texture::get_image() const
+	{
+		if (resolved.load(std::memory_order_acquire) == false)
+		{
+			//the future keeps the image alive, the pointer is all lookups need
+			image.store(loading.get().get(), std::memory_order_relaxed);
+			resolved.store(true, std::memory_order_release);
 		}
+		return image.load(std::memory_order_relaxed);
+	}
 
-		//texture-space locations
-		auto i = static_cast<int>(u * nx);
-		auto j = static_cast<int>((1 - v) * ny - 0.001);
+	vec3 image_texture::bilinear(const tiled_image& tiles, int level, double u, double v) const
+	{
+		auto& cache = texture_cache::global();
+		//texture-space locations, rows from the top
+		auto x = u * tiles.width(level) - 0.5;
+		auto y = (1 - v) * tiles.height(level) - 0.5;
+		auto i = static_cast<int>(floor(x));
+		auto j = static_cast<int>(floor(y));
+		auto fx = x - i, fy = y - j;
 
-		if (i < 0)
-			i = 0;
-		if (j < 0)
-			j = 0;
-		if (i > nx - 1)
-			i = nx - 1;
-		if (j > ny - 1)
-			j = ny - 1;
+		return (cache.texel(tiles, level, i, j) * (1 - fx) + cache.texel(tiles, level, i + 1, j) * fx) * (1 - fy) +
+			(cache.texel(tiles, level, i, j + 1) * (1 - fx) + cache.texel(tiles, level, i + 1, j + 1) * fx) * fy;
+	}
 
-		auto r = static_cast<int>(data[3 * i + 3 * nx * j + 0]) / 255.0;
-		auto g = static_cast<int>(data[3 * i + 3 * nx * j + 1]) / 255.0;
-		auto b = static_cast<int>(data[3 * i + 3 * nx * j + 2]) / 255.0;
+	vec3 image_texture::value(double u, double v, const vec3& p) const 
+	{
+		auto tiles = get_image();
+		if (tiles == nullptr)
+		{
+			return vec3(0, 1, 1);
+		}
+		return bilinear(*tiles, 0, u, v);
+	}
 
-		return vec3(r, g, b);
+	vec3 image_texture::value_at(const hit_record& rec) const
+	{
+		auto tiles = get_image();
+		if (tiles == nullptr)
+		{
+			return vec3(0, 1, 1);
+		}
+
+		//texels of the finest level across the footprint
+		auto texels = current_footprint * sqrt(double(tiles->width(0)) * tiles->height(0));
+		if (texels <= 1)
+		{
+			return bilinear(*tiles, 0, rec.u, rec.v);
+		}
+		auto lod = ffmin(log2(texels), tiles->levels() - 1.0);
+		auto level = static_cast<int>(lod);
+		auto f = lod - level;
+		if (level + 1 >= tiles->levels())
+		{
+			return bilinear(*tiles, level, rec.u, rec.v);
+		}
+		return bilinear(*tiles, level, rec.u, rec.v) * (1 - f) + bilinear(*tiles, level + 1, rec.u, rec.v) * f;
 	}
-}
\ No newline at end of file
+}
@@ -1,14 +1,32 @@
 #pragma once
 
+#include<atomic>
+#include<future>
+#include<memory>
+#include "aabb.h"
 #include "constantAndTool.h"
+#include "texture_cache.h"
 
 namespace ray_tracing
 {
 	/*Texture mapping*/
+	struct hit_record;
+	class texture_program;
+
+	/*
+	Width in (u, v) of the ray cone where the calling thread's path meets the surface it is
+	shading, set by the integrator before each hit; 0, the default, samples textures at the point.
+	*/
+	void use_footprint(double uv_width);
+
 	class texture
 	{
 	public:
 		virtual vec3 value(double u, double v, const vec3& p) const = 0;
+		//value over the footprint set by use_footprint; value at its point unless overridden
+		virtual vec3 value_at(const hit_record& rec) const;
+		//add this texture to a program; one the program cannot see into is called through value_at
+		virtual void compile(texture_program& program) const;
 	};
 
 	class constant_texture : public texture
@@ -20,11 +38,23 @@ namespace ray_tracing
 		{
 			return color;
 		}
+		virtual void compile(texture_program& program) const override;
 
 	private:
 		vec3 color;
 	};
 
+	//the sign of sin(10x) * sin(10y) * sin(10z), from the parity of the half periods instead of three sines;
+	//a product of 0 counts as even, as it does for the sines
+	inline bool checker_is_odd(const vec3& p)
+	{
+		auto x = 10 * p.x(), y = 10 * p.y(), z = 10 * p.z();
+		auto cells = static_cast<long long>(floor(x * (1 / pi))) + static_cast<long long>(floor(y * (1 / pi))) +
+			static_cast<long long>(floor(z * (1 / pi)));
+		//no branches, the cells of neighbouring shading points are rarely predictable
+		return ((cells & 1) != 0) & (x != 0) & (y != 0) & (z != 0);
+	}
+
 	//checkerboard texture
 	class checker_texture : public texture
 	{
@@ -32,11 +62,10 @@ namespace ray_tracing
 		checker_texture() = default;
 		checker_texture(shared_ptr<texture> t0, shared_ptr<texture> t1) : even(t0), odd(t1) {}
 
-		//use the sine and cosine functions to change periodically to create a checkerboard texture
+		//cells pi / 5 wide along every axis, alternating between the two textures
 		virtual vec3 value(double u, double v, const vec3& p) const override
 		{
-			auto sine = sin(10 * p.x()) * sin(10 * p.y()) * sin(10 * p.z());
-			if (sine < 0)
+			if (checker_is_odd(p) == true)
 			{
 				return odd->value(u, v, p);
 			}
@@ -45,6 +74,8 @@ namespace ray_tracing
 				return even->value(u, v, p);
 			}
 		}
+		virtual vec3 value_at(const hit_record& rec) const override;
+		virtual void compile(texture_program& program) const override;
 
 	private:
 		//The odd and even pointer points to a static texture
@@ -52,40 +83,58 @@ namespace ray_tracing
 		shared_ptr<texture> even;
 	};
 
-	//perlin noise
+	/*
+	Perlin noise: gradients on the integer lattice, picked by hashing each corner through three
+	permutation tables. The tables are built once from a fixed seed and shared, read only, by
+	every perlin, so making one costs nothing and all of them agree.
+	With AVX2, turb evaluates eight octaves at once, one per float lane. Gradients are rounded
+	to 10 bits per component so a corner's whole gradient packs into one int and arrives with
+	a single gather.
+	*/
 	class perlin
 	{
-	private:
-		static const int point_count = 256;
-		double* ranfloat;	//Get a random floating value
-		vec3* ran_vec3;	//Get a random vec3
-		//Permutation Table
-		int* perm_x;
-		int* perm_y;
-		int* perm_z;
-
-		//make the value of permutation table out of order
-		static void permute(int* p, int n);
-
-		//Generate a permutation table
-		static int* perlin_generate_perm();
 	public:
-		perlin();
+		static const int point_count = 256;
+		static const int gradient_scale = 511;	//gradient components are multiples of 1 / gradient_scale
 
-		~perlin()
-		{
-			delete[] ran_vec3;
-			delete[] perm_x;
-			delete[] perm_y;
-			delete[] perm_z;
-		}
+		perlin();
 
 		//Calculate the random value of position P
 		double noise(const vec3& p) const;
 
 		//turbulence
-		double turb(const vec3& p, int depth = 7)const;
+		double turb(const vec3& p, int depth = 7) const;
+		//turb one octave at a time, what builds without AVX2 run
+		double turb_scalar(const vec3& p, int depth = 7) const;
+
+		//the gradients twice: components apart for the scalar code, packed for the vector code
+		struct tables
+		{
+			double gradient[3][point_count];
+			int perm[3][point_count];
+			int packed[point_count];		//x, y and z in bits 0, 10 and 20, two's complement
+		};
 
+	private:
+		const tables* shared;
+	};
+
+	//turb sampled at the corners of a resolution^3 grid over a box and interpolated trilinearly;
+	//octaves finer than a voxel are blurred away
+	class noise_volume
+	{
+	public:
+		noise_volume(const perlin& noise, const aabb& bounds, int resolution, int depth = 7);
+
+		bool contains(const vec3& p) const;
+		double value(const vec3& p) const;
+		size_t memory_bytes() const { return values.size() * sizeof(float); }
+
+	private:
+		aabb box;
+		int n;			//samples per axis, resolution + 1
+		vec3 inverse_voxel;
+		vector<float> values;
 	};
 
 	class noise_texture : public texture
@@ -93,41 +142,57 @@ namespace ray_tracing
 	private:
 		perlin noise;
 		double scale;
+		shared_ptr<const noise_volume> baked;
 	public:
 		noise_texture() = default;
 		noise_texture(double sc) : scale(sc) {}
+
+		//turbulence inside bounds is read from a grid baked now, outside it is still evaluated
+		void bake(const aabb& bounds, int resolution)
+		{
+			baked = make_shared<noise_volume>(noise, bounds, resolution);
+		}
+
 		virtual vec3 value(double u, double v, const vec3& p) const override
 		{
-			return vec3(1, 1, 1) * (1 + sin(scale * p.z() + 10 * noise.turb(p))) * 0.7;
+			auto turbulence = baked != nullptr && baked->contains(p) == true ? baked->value(p) : noise.turb(p);
+			return vec3(1, 1, 1) * (1 + sin(scale * p.z() + 10 * turbulence)) * 0.7;
 		}
 	};
 
 	//Texture mapping
+	//texels come through texture_cache::global(); one file opened by many textures is converted once
+	//a texture made from a path decodes it on the asset loader, the first lookup waits for it
 	class image_texture : public texture
 	{
 	private:
-		unsigned char* data;
-		int nx, ny;
+		std::shared_future<shared_ptr<const tiled_image>> loading;
+		//the loaded image, read without touching the future once resolved is set
+		mutable std::atomic<const tiled_image*> image;
+		mutable std::atomic<bool> resolved;
+
+		const tiled_image* get_image() const;
+		//texel centers at half integers, edges clamped
+		vec3 bilinear(const tiled_image& tiles, int level, double u, double v) const;
+
 	public:
-		image_texture() = default;
-		image_texture(unsigned char* pixels, int A, int B)
-			: data(pixels), nx(A), ny(B) {}
-		~image_texture()
-		{
-			delete data;
-		}
+		image_texture(const char* path)
+			: loading(texture_cache::global().open_async(path)), image(nullptr), resolved(false) {}
+		image_texture(shared_ptr<const tiled_image> tiles);
 
-		virtual vec3 value(double u, double v, const vec3& p) const override;
 
+		//the finest level, filtered bilinearly
+		virtual vec3 value(double u, double v, const vec3& p) const override;
+		//trilinear, between the two levels whose texels are nearest the footprint in size
+		virtual vec3 value_at(const hit_record& rec) const override;
 	};
 
-
 	//Բֵ
 	inline double trilinear_interp(double c[2][2][2], double u, double v, double w)
 	{
-		u = 3 * std::pow(u, 2) - 2 * std::pow(u, 3);
-		v = 3 * std::pow(v, 2) - 2 * std::pow(v, 3);
-		w = 3 * std::pow(w, 2) - 2 * std::pow(w, 3);
+		u = u * u * (3 - 2 * u);
+		v = v * v * (3 - 2 * v);
+		w = w * w * (3 - 2 * w);
 		auto lerp_x_y0_z0 = c[0][0][0] + (u - 0) / 1 * (c[1][0][0] - c[0][0][0]);
 		auto lerp_x_y1_z0 = c[0][1][0] + u * (c[1][1][0] - c[0][1][0]);
 		auto lerp_x_y0_z1 = c[0][0][1] + u * (c[1][0][1] - c[0][0][1]);
@@ -141,9 +206,9 @@ namespace ray_tracing
 	//vec3Բֵ
 	inline double vec3_trilinear_interp(vec3 c[2][2][2], double u, double v, double w)
 	{
-		auto uu = 3 * std::pow(u, 2) - 2 * std::pow(u, 3);
-		auto vv = 3 * std::pow(v, 2) - 2 * std::pow(v, 3);
-		auto ww = 3 * std::pow(w, 2) - 2 * std::pow(w, 3);
+		auto uu = u * u * (3 - 2 * u);
+		auto vv = v * v * (3 - 2 * v);
+		auto ww = w * w * (3 - 2 * w);
 
 		auto lerp_x_y0_z0 = dot(vec3(u, v, w), c[0][0][0]) + (dot(vec3(u - 1, v, w), c[1][0][0]) - dot(vec3(u, v, w), c[0][0][0])) * uu;
 		auto lerp_x_y1_z0 = dot(vec3(u, v - 1, w), c[0][1][0]) + (dot(vec3(u - 1, v - 1, w), c[1][1][0]) - dot(vec3(u, v - 1, w), c[0][1][0])) * uu;
@@ -0,0 +1,336 @@
+#include"texture_cache.h"
+
+#include<atomic>
+#include"asset_loader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace ray_tracing
+{
+	namespace
+	{
+		const size_t default_budget = size_t(64) << 20;
+		const size_t tile_bytes = texture_cache::tile_size * texture_cache::tile_size * 3;
+		const int recent_tiles = 8;		//per thread, a power of two
+
+		//the image id in the top bits, so keys of different images never meet; 0 is no tile
+		inline uint64_t tile_key(uint32_t id, int level, int tile_x, int tile_y)
+		{
+			return (uint64_t(id) << 44) | (uint64_t(level) << 38) | (uint64_t(tile_y) << 19) | uint64_t(tile_x);
+		}
+
+		struct recent_tile
+		{
+			uint64_t key = 0;
+			shared_ptr<const vector<unsigned char>> data;
+		};
+		thread_local recent_tile recent_by_thread[recent_tiles];
+		//counted across caches, as the threads' recent tiles are
+		std::atomic<uint32_t> next_image_id(1);
+	}
+
+	tiled_image::~tiled_image()
+	{
+		if (file != nullptr)
+		{
+			fclose(file);
+		}
+	}
+
+	size_t tiled_image::total_bytes() const
+	{
+		size_t tiles = 0;
+		for (int level = 0; level < levels(); ++level)
+		{
+			tiles += size_t(tiles_across[level]) * ((heights[level] + texture_cache::tile_size - 1) / texture_cache::tile_size);
+		}
+		return tiles * tile_bytes;
+	}
+
+	texture_cache& texture_cache::global()
+	{
+		static texture_cache cache(default_budget);
+		return cache;
+	}
+
+	texture_cache::texture_cache(size_t budget_bytes)
+		: budget(budget_bytes)
+	{
+	}
+
+	shared_ptr<const tiled_image> texture_cache::open(const std::string& path)
+	{
+		return load(path, nullptr);
+	}
+
+	std::shared_future<shared_ptr<const tiled_image>> texture_cache::open_async(const std::string& path)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = loading.find(path);
+		if (found != loading.end())
+		{
+			return found->second;
+		}
+		auto readable = std::make_shared<image_promise>();
+		std::shared_future<shared_ptr<const tiled_image>> image = readable->get_future().share();
+		asset_loader::global().submit<bool>([this, path, readable]() { return load(path, readable.get()) != nullptr; });
+		loading[path] = image;
+		return image;
+	}
+
+	shared_ptr<const tiled_image> texture_cache::add(const std::string& name, const unsigned char* rgb, int width, int height)
+	{
+		return convert(name, rgb, width, height, nullptr);
+	}
+
+	shared_ptr<const tiled_image> texture_cache::load(const std::string& path, image_promise* readable)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto found = images.find(path);
+			if (found != images.end())
+			{
+				if (readable != nullptr)
+				{
+					readable->set_value(found->second);
+				}
+				return found->second;
+			}
+		}
+
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 3);
+		if (pixels == nullptr)
+		{
+			if (readable != nullptr)
+			{
+				readable->set_value(nullptr);
+			}
+			return nullptr;
+		}
+		auto image = convert(path, pixels, width, height, readable);
+		stbi_image_free(pixels);
+		return image;
+	}
+
+	shared_ptr<const tiled_image> texture_cache::convert(const std::string& name, const unsigned char* rgb, int width, int height,
+		image_promise* readable)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto found = images.find(name);
+			if (found != images.end())
+			{
+				if (readable != nullptr)
+				{
+					readable->set_value(found->second);
+				}
+				return found->second;
+			}
+		}
+
+		shared_ptr<tiled_image> image(new tiled_image());
+		image->file = std::tmpfile();
+		if (image->file == nullptr)
+		{
+			if (readable != nullptr)
+			{
+				readable->set_value(nullptr);
+			}
+			return nullptr;
+		}
+
+		//the layout of every level is known up front, the tiles follow
+		long offset = 0;
+		for (int w = width, h = height; ; w = std::max(1, w / 2), h = std::max(1, h / 2))
+		{
+			auto across = (w + tile_size - 1) / tile_size;
+			auto down = (h + tile_size - 1) / tile_size;
+			image->widths.push_back(w);
+			image->heights.push_back(h);
+			image->tiles_across.push_back(across);
+			image->level_offsets.push_back(offset);
+			offset += static_cast<long>(size_t(across) * down * tile_bytes);
+			if (w == 1 && h == 1)
+			{
+				break;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			//another thread may be converting the same name, the first one wins
+			auto inserted = images.insert(std::make_pair(name, image));
+			if (inserted.second == false)
+			{
+				if (readable != nullptr)
+				{
+					readable->set_value(inserted.first->second);
+				}
+				return inserted.first->second;
+			}
+			image->id = next_image_id++;
+		}
+
+		//each level a 2x2 box filter of the one above, an odd last row or column repeated
+		vector<unsigned char> level(rgb, rgb + size_t(width) * height * 3);
+		tile buffer(tile_bytes);
+		for (int l = 0; l < image->levels(); ++l)
+		{
+			if (l > 0)
+			{
+				auto next_width = image->widths[l], next_height = image->heights[l];
+				vector<unsigned char> next(size_t(next_width) * next_height * 3);
+				for (int y = 0; y < next_height; ++y)
+				{
+					for (int x = 0; x < next_width; ++x)
+					{
+						int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+						int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+						for (int c = 0; c < 3; ++c)
+						{
+							int sum = level[(size_t(y0) * width + x0) * 3 + c] + level[(size_t(y0) * width + x1) * 3 + c] +
+								level[(size_t(y1) * width + x0) * 3 + c] + level[(size_t(y1) * width + x1) * 3 + c];
+							next[(size_t(y) * next_width + x) * 3 + c] = static_cast<unsigned char>((sum + 2) / 4);
+						}
+					}
+				}
+				level.swap(next);
+				width = next_width;
+				height = next_height;
+			}
+
+			//readers move the file position too
+			{
+				std::lock_guard<std::mutex> guard(image->file_lock);
+				fseek(image->file, image->level_offsets[l], SEEK_SET);
+				//tiles past the level's edge repeat its last texels
+				auto down = (height + tile_size - 1) / tile_size;
+				for (int ty = 0; ty < down; ++ty)
+				{
+					for (int tx = 0; tx < image->tiles_across[l]; ++tx)
+					{
+						for (int y = 0; y < tile_size; ++y)
+						{
+							auto row = std::min(ty * tile_size + y, height - 1);
+							for (int x = 0; x < tile_size; ++x)
+							{
+								auto column = std::min(tx * tile_size + x, width - 1);
+								for (int c = 0; c < 3; ++c)
+								{
+									buffer[(y * tile_size + x) * 3 + c] = level[(size_t(row) * width + column) * 3 + c];
+								}
+							}
+						}
+						fwrite(buffer.data(), 1, tile_bytes, image->file);
+					}
+				}
+				fflush(image->file);
+				image->written_levels.store(l + 1, std::memory_order_release);
+			}
+			image->level_written.notify_all();
+			if (l == 0 && readable != nullptr)
+			{
+				readable->set_value(image);
+			}
+		}
+		return image;
+	}
+
+	vec3 texture_cache::texel(const tiled_image& image, int level, int x, int y)
+	{
+		x = std::min(std::max(x, 0), image.widths[level] - 1);
+		y = std::min(std::max(y, 0), image.heights[level] - 1);
+		auto tile_x = x / tile_size, tile_y = y / tile_size;
+
+		auto key = tile_key(image.id, level, tile_x, tile_y);
+		auto& mine = recent_by_thread[(key ^ (key >> 19) ^ (key >> 44)) & (recent_tiles - 1)];
+		if (mine.key != key)
+		{
+			mine.data = fetch(image, level, tile_x, tile_y);
+			mine.key = key;
+		}
+
+		const unsigned char* t = mine.data->data() + ((y - tile_y * tile_size) * tile_size + (x - tile_x * tile_size)) * 3;
+		return vec3(t[0], t[1], t[2]) / 255.0;
+	}
+
+	shared_ptr<const texture_cache::tile> texture_cache::fetch(const tiled_image& image, int level, int tile_x, int tile_y)
+	{
+		auto key = tile_key(image.id, level, tile_x, tile_y);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			++counts.requests;
+			auto found = tiles.find(key);
+			if (found != tiles.end())
+			{
+				recent.splice(recent.begin(), recent, found->second.recency);
+				return found->second.data;
+			}
+		}
+
+		//read without holding the cache, other threads keep finding resident tiles meanwhile
+		auto data = std::make_shared<tile>(tile_bytes);
+		{
+			std::unique_lock<std::mutex> guard(image.file_lock);
+			//the level may still be on its way from the loader
+			image.level_written.wait(guard, [&]() { return level < image.written_levels.load(std::memory_order_relaxed); });
+			auto offset = image.level_offsets[level] + static_cast<long>((size_t(tile_y) * image.tiles_across[level] + tile_x) * tile_bytes);
+			fseek(image.file, offset, SEEK_SET);
+			if (fread(data->data(), 1, tile_bytes, image.file) != tile_bytes)
+			{
+				std::fill(data->begin(), data->end(), static_cast<unsigned char>(0));
+			}
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = tiles.find(key);
+		if (found != tiles.end())
+		{
+			recent.splice(recent.begin(), recent, found->second.recency);
+			return found->second.data;
+		}
+		++counts.reads;
+		recent.push_front(key);
+		tiles[key] = slot{ data, recent.begin() };
+		counts.resident_bytes += tile_bytes;
+		evict();
+		counts.peak_bytes = std::max(counts.peak_bytes, counts.resident_bytes);
+		return data;
+	}
+
+	//with the cache locked
+	void texture_cache::evict()
+	{
+		while (counts.resident_bytes > budget && recent.size() > 1)
+		{
+			tiles.erase(recent.back());
+			recent.pop_back();
+			counts.resident_bytes -= tile_bytes;
+			++counts.evictions;
+		}
+	}
+
+	void texture_cache::set_budget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		budget = bytes;
+		evict();
+	}
+
+	texture_cache_stats texture_cache::stats()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return counts;
+	}
+
+	void texture_cache::reset_stats()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto resident = counts.resident_bytes;
+		counts = texture_cache_stats();
+		counts.resident_bytes = resident;
+		counts.peak_bytes = resident;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include<atomic>
+#include<condition_variable>
+#include<cstdint>
+#include<cstdio>
+#include<future>
+#include<list>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<unordered_map>
+#include"constantAndTool.h"
+
+namespace ray_tracing
+{
+	/*
+	An image converted into a mip pyramid, every level cut into square tiles of
+	texture_cache::tile_size texels. The tiles are written once to an anonymous temporary
+	file and the decoded image is dropped; texels are only ever read back through the
+	texture_cache, tile by tile. The levels are written finest first and each can be read as
+	soon as it is in, so a lookup only waits for the level it asks for.
+	*/
+	class tiled_image
+	{
+	public:
+		~tiled_image();
+		tiled_image(const tiled_image&) = delete;
+		tiled_image& operator=(const tiled_image&) = delete;
+
+		int levels() const { return static_cast<int>(widths.size()); }
+		int width(int level) const { return widths[level]; }
+		int height(int level) const { return heights[level]; }
+		//bytes of every tile of every level
+		size_t total_bytes() const;
+
+	private:
+		friend class texture_cache;
+		tiled_image() = default;
+
+		uint32_t id = 0;
+		vector<int> widths, heights;
+		vector<int> tiles_across;
+		vector<long> level_offsets;		//where each level's tiles start in the file, row by row
+		FILE* file = nullptr;
+		mutable std::mutex file_lock;
+		std::atomic<int> written_levels{ 0 };		//the levels below it are in the file
+		mutable std::condition_variable level_written;
+	};
+
+	struct texture_cache_stats
+	{
+		size_t requests = 0;		//tiles asked of the shared cache, past each thread's few recent ones
+		size_t reads = 0;			//of those, tiles that had to come from the file
+		size_t evictions = 0;
+		size_t resident_bytes = 0;
+		size_t peak_bytes = 0;
+	};
+
+	/*
+	Every tile of every tiled_image shares one budget: tiles are read on demand and the least
+	recently used ones are dropped once the resident bytes pass it. Images are converted once
+	per file name, so scenes loading the same file share its tiles. The cache is locked for
+	each tile it hands out; every thread also keeps its last few tiles, which spares the lock
+	for the neighbouring texels of a filtered lookup. Those may outlive their eviction by a
+	little, so a render can hold up to threads * 8 tiles past the budget.
+	*/
+	class texture_cache
+	{
+	public:
+		static const int tile_size = 32;
+
+		//the one cache every image_texture reads through
+		static texture_cache& global();
+
+		explicit texture_cache(size_t budget_bytes);
+
+		//nullptr when the file cannot be decoded
+		shared_ptr<const tiled_image> open(const std::string& path);
+		//open on asset_loader::global(), the same future for a path already asked for; it is ready
+		//once the finest level can be read, the coarser ones follow on the loader
+		std::shared_future<shared_ptr<const tiled_image>> open_async(const std::string& path);
+		//rgb rows from the top, three bytes a texel; name stands in for the file when deduplicating
+		shared_ptr<const tiled_image> add(const std::string& name, const unsigned char* rgb, int width, int height);
+
+		//texel (x, y) of a level with rows from the top, coordinates clamped to the level's edge
+		vec3 texel(const tiled_image& image, int level, int x, int y);
+
+		void set_budget(size_t bytes);
+		size_t get_budget() const { return budget; }
+		texture_cache_stats stats();
+		//forgets the counts, not the tiles
+		void reset_stats();
+
+	private:
+		typedef vector<unsigned char> tile;
+		struct slot
+		{
+			shared_ptr<const tile> data;
+			std::list<uint64_t>::iterator recency;
+		};
+
+		std::mutex lock;
+		size_t budget;
+		std::list<uint64_t> recent;		//most recently used first
+		std::unordered_map<uint64_t, slot> tiles;
+		std::map<std::string, shared_ptr<tiled_image>> images;
+		std::map<std::string, std::shared_future<shared_ptr<const tiled_image>>> loading;
+		texture_cache_stats counts;
+
+		typedef std::promise<shared_ptr<const tiled_image>> image_promise;
+
+		//open and add, handing the image to readable, when given, as soon as its finest level is written
+		shared_ptr<const tiled_image> load(const std::string& path, image_promise* readable);
+		shared_ptr<const tiled_image> convert(const std::string& name, const unsigned char* rgb, int width, int height, image_promise* readable);
+		shared_ptr<const tile> fetch(const tiled_image& image, int level, int tile_x, int tile_y);
+		void evict();
+	};
+}
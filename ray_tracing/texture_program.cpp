@@ -0,0 +1,77 @@
+#include"texture_program.h"
+
+namespace ray_tracing
+{
+	texture_program::texture_program(const shared_ptr<texture>& graph)
+		: root(graph)
+	{
+		graph->compile(*this);
+	}
+
+	void texture_program::emit_constant(const vec3& color)
+	{
+		instruction i;
+		i.op = op_constant;
+		i.color[0] = color;
+		code.push_back(i);
+	}
+
+	void texture_program::emit_opaque(const texture& tex)
+	{
+		instruction i;
+		i.op = op_opaque;
+		i.leaf = &tex;
+		code.push_back(i);
+	}
+
+	void texture_program::emit_checker(const texture& even, const texture& odd)
+	{
+		texture_program even_code, odd_code;
+		even.compile(even_code);
+		odd.compile(odd_code);
+
+		if (even_code.is_constant() == true && odd_code.is_constant() == true)
+		{
+			auto a = even_code.code[0].color[0], b = odd_code.code[0].color[0];
+			if (a.x() == b.x() && a.y() == b.y() && a.z() == b.z())
+			{
+				emit_constant(a);
+				return;
+			}
+			instruction i;
+			i.op = op_checker_constant;
+			i.color[0] = a;
+			i.color[1] = b;
+			code.push_back(i);
+			return;
+		}
+
+		instruction i;
+		i.op = op_checker;
+		i.skip = static_cast<uint32_t>(even_code.code.size());
+		code.push_back(i);
+		code.insert(code.end(), even_code.code.begin(), even_code.code.end());
+		code.insert(code.end(), odd_code.code.begin(), odd_code.code.end());
+	}
+
+	vec3 texture_program::run(const hit_record* rec, double u, double v, const vec3& p) const
+	{
+		const instruction* i = code.data();
+		while (true)
+		{
+			switch (i->op)
+			{
+			case op_constant:
+				return i->color[0];
+			case op_opaque:
+				return rec != nullptr ? i->leaf->value_at(*rec) : i->leaf->value(u, v, p);
+			case op_checker:
+				i += checker_is_odd(p) == true ? 1 + i->skip : 1;
+				break;
+			case op_checker_constant:
+				//indexed rather than branched on, see checker_is_odd
+				return i->color[checker_is_odd(p)];
+			}
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include<cstdint>
+#include<memory>
+#include"constantAndTool.h"
+#include"hittable.h"
+#include"texture.h"
+
+namespace ray_tracing
+{
+	/*
+	A texture graph flattened into a list of instructions when a material is built. Every branch
+	ends in an instruction that yields the color, so running it is one loop that either jumps or
+	returns, with no recursion and no virtual call until an opaque texture is reached. Constant
+	textures are folded into the instructions that select them: a checker of two constants is a
+	single instruction holding both colors, and one of two equal constants is just that constant.
+	*/
+	class texture_program
+	{
+	public:
+		explicit texture_program(const shared_ptr<texture>& graph);
+
+		//value_at of the root texture
+		vec3 eval(const hit_record& rec) const { return run(&rec, rec.u, rec.v, rec.p); }
+		//value of the root texture
+		vec3 eval(double u, double v, const vec3& p) const { return run(nullptr, u, v, p); }
+
+		bool is_constant() const { return code.size() == 1 && code[0].op == op_constant; }
+		size_t size() const { return code.size(); }
+
+		//what textures add to the program from texture::compile
+		void emit_constant(const vec3& color);
+		//a texture the program cannot see into, called through texture::value_at
+		void emit_opaque(const texture& tex);
+		void emit_checker(const texture& even, const texture& odd);
+
+	private:
+		enum opcode : uint8_t
+		{
+			op_constant,		//yields color[0]
+			op_opaque,			//yields the value of leaf
+			op_checker,			//goes on to the even branch, or skips it to the odd one
+			op_checker_constant	//yields color[0] on even checker cells, color[1] on odd ones
+		};
+
+		struct instruction
+		{
+			opcode op;
+			uint32_t skip = 0;		//instructions of the even branch, for op_checker
+			vec3 color[2];
+			const texture* leaf = nullptr;
+		};
+
+		vector<instruction> code;
+		shared_ptr<texture> root;		//keeps the opaque leaves alive
+
+		texture_program() = default;
+		vec3 run(const hit_record* rec, double u, double v, const vec3& p) const;
+	};
+}